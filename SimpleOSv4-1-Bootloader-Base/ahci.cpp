@@ -0,0 +1,352 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "ahci.h"
+#include "fs.h"
+#include "pci.h"
+#include "vm.h"
+#include "x86.h"
+#include "constants.h"
+#include "exceptions.h"
+
+volatile uint32_t *ahciHostRegister(uint32_t offset)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    return (volatile uint32_t *)(AhciDevice->abar + offset);
+}
+
+void ahciMapWindow(uint32_t *pageDirectory)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    // The HBA registers sit near the top of the 4 GB address space. Identity map that 4 MB region, uncached, for the kernel only.
+    installKernelLargePage(pageDirectory, AhciDevice->abar, PAGE_WRITE_THROUGH | PAGE_CACHE_DISABLE);
+}
+
+volatile uint32_t *ahciPortRegister(uint32_t offset)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    return ahciHostRegister(AHCI_PORT_BASE + (AhciDevice->port * AHCI_PORT_SIZE) + offset);
+}
+
+bool ahciInitialize()
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+    struct ahciCommandHeader *CommandHeader = (struct ahciCommandHeader*)AHCI_COMMAND_LIST;
+    struct pciDevice PciDevice;
+
+    if (!pciFindClass(PCI_CLASS_AHCI, &PciDevice))
+    {
+        return false;
+    }
+
+    // Command list, received FIS area, driver state and all 32 command tables
+    fillMemory((uint8_t *)AHCI_COMMAND_LIST, 0x0, (AHCI_COMMAND_TABLES + (AHCI_MAX_COMMAND_SLOTS * AHCI_COMMAND_TABLE_SIZE)) - AHCI_COMMAND_LIST);
+
+    AhciDevice->abar = pciConfigRead(&PciDevice, PCI_CONFIG_BAR5) & PCI_BAR_MEMORY_MASK;
+    AhciDevice->interruptLine = pciConfigRead(&PciDevice, PCI_CONFIG_INTERRUPT_LINE) & 0xFF;
+    pciEnableDevice(&PciDevice);
+
+    // Before paging the registers are reached directly. After it, only the loaded directory gets the window here, and createPageDirectory() adds it to new ones.
+    if (readCR0() & CR0_PAGING)
+    {
+        ahciMapWindow((uint32_t *)(readCR3() & PAGE_FRAME_MASK));
+    }
+
+    *ahciHostRegister(AHCI_GLOBAL_HOST_CONTROL) |= AHCI_GHC_AHCI_ENABLE;
+
+    uint32_t portsImplemented = *ahciHostRegister(AHCI_PORTS_IMPLEMENTED);
+    bool driveFound = false;
+
+    while (!driveFound && AhciDevice->port < AHCI_MAX_PORTS)
+    {
+        if ((portsImplemented & (1 << AhciDevice->port)) &&
+            (*ahciPortRegister(AHCI_PORT_SATA_STATUS) & 0xF) == AHCI_SATA_STATUS_DEVICE_PRESENT &&
+            *ahciPortRegister(AHCI_PORT_SIGNATURE) == AHCI_SIGNATURE_ATA)
+        {
+            driveFound = true;
+        }
+        else
+        {
+            AhciDevice->port++;
+        }
+    }
+
+    if (!driveFound)
+    {
+        return false;
+    }
+
+    // The port must be idle before its command list and FIS area can be moved
+    *ahciPortRegister(AHCI_PORT_COMMAND) &= ~(AHCI_PORT_CMD_START | AHCI_PORT_CMD_FIS_RECEIVE_ENABLE);
+    while (*ahciPortRegister(AHCI_PORT_COMMAND) & (AHCI_PORT_CMD_LIST_RUNNING | AHCI_PORT_CMD_FIS_RECEIVE_RUNNING)) {}
+
+    *ahciPortRegister(AHCI_PORT_COMMAND_LIST_BASE) = AHCI_COMMAND_LIST;
+    *ahciPortRegister(AHCI_PORT_COMMAND_LIST_BASE_UPPER) = 0;
+    *ahciPortRegister(AHCI_PORT_FIS_BASE) = AHCI_RECEIVED_FIS;
+    *ahciPortRegister(AHCI_PORT_FIS_BASE_UPPER) = 0;
+
+    for (uint32_t slot = 0; slot < AHCI_MAX_COMMAND_SLOTS; slot++)
+    {
+        CommandHeader[slot].commandTableBase = AHCI_COMMAND_TABLES + (slot * AHCI_COMMAND_TABLE_SIZE);
+        CommandHeader[slot].commandTableBaseUpper = 0;
+    }
+
+    *ahciPortRegister(AHCI_PORT_SATA_ERROR) = 0xFFFFFFFF;
+    *ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS) = 0xFFFFFFFF;
+    *ahciPortRegister(AHCI_PORT_COMMAND) |= AHCI_PORT_CMD_FIS_RECEIVE_ENABLE;
+    *ahciPortRegister(AHCI_PORT_COMMAND) |= AHCI_PORT_CMD_START;
+
+    ahciBuildCommand(0, ATA_IDENTIFY, 0, 1, (uint8_t *)AHCI_IDENTIFY_BUFFER, false);
+    ahciIssueCommand(0, false);
+    ahciWaitForCommands();
+
+    uint16_t *identifyData = (uint16_t *)AHCI_IDENTIFY_BUFFER;
+    uint32_t hostCapabilities = *ahciHostRegister(AHCI_HOST_CAPABILITIES);
+
+    AhciDevice->totalSectors = identifyTotalSectors(identifyData);
+    AhciDevice->queueDepth = ((hostCapabilities >> 8) & 0x1F) + 1;
+
+    // NCQ needs both the HBA and the drive, and the drive may take fewer tags than the HBA has slots
+    if ((hostCapabilities & AHCI_CAP_NCQ) && (identifyData[ATA_IDENTIFY_SATA_CAPABILITIES] & ATA_IDENTIFY_NCQ_SUPPORTED))
+    {
+        AhciDevice->ncqSupported = 1;
+
+        if (((identifyData[ATA_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1) < AhciDevice->queueDepth)
+        {
+            AhciDevice->queueDepth = (identifyData[ATA_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1;
+        }
+    }
+
+    *ahciPortRegister(AHCI_PORT_INTERRUPT_ENABLE) = AHCI_PORT_IS_DEVICE_TO_HOST_FIS | AHCI_PORT_IS_SET_DEVICE_BITS_FIS | AHCI_PORT_IS_TASK_FILE_ERROR;
+    *ahciHostRegister(AHCI_GLOBAL_HOST_CONTROL) |= AHCI_GHC_INTERRUPT_ENABLE;
+
+    return true;
+}
+
+void ahciBuildCommand(uint32_t slot, uint8_t command, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *buffer, bool write)
+{
+    struct ahciCommandHeader *CommandHeader = (struct ahciCommandHeader*)AHCI_COMMAND_LIST + slot;
+    uint8_t *commandFis = (uint8_t *)(AHCI_COMMAND_TABLES + (slot * AHCI_COMMAND_TABLE_SIZE));
+    struct ahciPrdtEntry *PrdtEntry = (struct ahciPrdtEntry*)(commandFis + AHCI_COMMAND_TABLE_PRDT_OFFSET);
+    uint32_t prdtEntries = 0;
+    uint32_t bytesLeft = 0;
+
+    if (buffer)
+    {
+        bytesLeft = numberOfSectors * SECTOR_SIZE;
+    }
+
+    // Scatter-gather straight from the caller's pages, merging the ones that are physically contiguous
+    while (bytesLeft > 0)
+    {
+        uint32_t physicalAddress = virtualToPhysical(buffer);
+        uint32_t lengthInPage = PAGE_SIZE - (physicalAddress & (PAGE_SIZE - 1));
+
+        if (lengthInPage > bytesLeft)
+        {
+            lengthInPage = bytesLeft;
+        }
+
+        if (prdtEntries > 0 &&
+            (PrdtEntry[prdtEntries - 1].dataBase + PrdtEntry[prdtEntries - 1].byteCount + 1) == physicalAddress &&
+            (PrdtEntry[prdtEntries - 1].byteCount + 1 + lengthInPage) <= AHCI_MAX_PRDT_BYTES)
+        {
+            PrdtEntry[prdtEntries - 1].byteCount = PrdtEntry[prdtEntries - 1].byteCount + lengthInPage;
+        }
+        else
+        {
+            if (prdtEntries == AHCI_MAX_PRDT_ENTRIES)
+            {
+                panic((uint8_t *)"ahci.cpp:ahciBuildCommand() -> too many PRDT entries");
+            }
+
+            PrdtEntry[prdtEntries].dataBase = physicalAddress;
+            PrdtEntry[prdtEntries].dataBaseUpper = 0;
+            PrdtEntry[prdtEntries].reserved = 0;
+            PrdtEntry[prdtEntries].byteCount = lengthInPage - 1;
+            prdtEntries++;
+        }
+
+        buffer = buffer + lengthInPage;
+        bytesLeft = bytesLeft - lengthInPage;
+    }
+
+    fillMemory(commandFis, 0x0, AHCI_COMMAND_TABLE_PRDT_OFFSET);
+    commandFis[0] = AHCI_FIS_REGISTER_HOST_TO_DEVICE;
+    commandFis[1] = AHCI_FIS_COMMAND;
+    commandFis[2] = command;
+    commandFis[4] = (uint8_t)sectorNumber;
+    commandFis[5] = (uint8_t)(sectorNumber >> 8);
+    commandFis[6] = (uint8_t)(sectorNumber >> 16);
+    commandFis[7] = ATA_DRIVE_MASTER_LBA48;
+    commandFis[8] = (uint8_t)(sectorNumber >> 24);
+
+    if (command == ATA_READ_FPDMA_QUEUED || command == ATA_WRITE_FPDMA_QUEUED)
+    {
+        // Queued commands carry the sector count in the features field and the tag in the count field
+        commandFis[3] = (uint8_t)numberOfSectors;
+        commandFis[11] = (uint8_t)(numberOfSectors >> 8);
+        commandFis[12] = (uint8_t)(slot << 3);
+    }
+    else
+    {
+        commandFis[12] = (uint8_t)numberOfSectors;
+        commandFis[13] = (uint8_t)(numberOfSectors >> 8);
+    }
+
+    // The H2D register FIS is 5 dwords long
+    CommandHeader->flags = 5 | (write ? AHCI_COMMAND_WRITE : 0) | (prdtEntries << 16);
+    CommandHeader->prdByteCount = 0;
+}
+
+void ahciIssueCommand(uint32_t slot, bool queued)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    // The command table must be complete before the HBA sees the slot
+    asm volatile ("" : : : "memory");
+
+    if (queued)
+    {
+        *ahciPortRegister(AHCI_PORT_SATA_ACTIVE) = (1 << slot);
+    }
+    *ahciPortRegister(AHCI_PORT_COMMAND_ISSUE) = (1 << slot);
+
+    if ((slot + 1) > AhciDevice->maxCommandsInFlight)
+    {
+        AhciDevice->maxCommandsInFlight = slot + 1;
+    }
+}
+
+void ahciWaitForCommands()
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    // System calls run with interrupts off, so poll there. Otherwise sleep until the completion interrupt.
+    while ((*ahciPortRegister(AHCI_PORT_SATA_ACTIVE) | *ahciPortRegister(AHCI_PORT_COMMAND_ISSUE)) != 0)
+    {
+        if (AhciDevice->taskFileError || (*ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS) & AHCI_PORT_IS_TASK_FILE_ERROR))
+        {
+            panic((uint8_t *)"ahci.cpp:ahciWaitForCommands() -> drive reported an error");
+        }
+
+        if (readEFLAGS() & EFLAGS_INTERRUPT_ENABLE)
+        {
+            asm volatile ("hlt\n\t");
+        }
+    }
+
+    // Clears the interrupt if we finished by polling
+    *ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS) = *ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS);
+    *ahciHostRegister(AHCI_INTERRUPT_STATUS) = (1 << AhciDevice->port);
+}
+
+void ahciTransfer(bool write, uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *buffer)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+    uint32_t sectorNumber = (blockNumber * SECTORS_PER_BLOCK) + EXT2_SECTOR_START;
+    uint32_t sectorsLeft = numberOfBlocks * SECTORS_PER_BLOCK;
+    uint32_t slot = 0;
+    uint8_t command;
+
+    if (AhciDevice->ncqSupported)
+    {
+        command = write ? ATA_WRITE_FPDMA_QUEUED : ATA_READ_FPDMA_QUEUED;
+    }
+    else
+    {
+        command = write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT;
+    }
+
+    while (sectorsLeft > 0)
+    {
+        uint32_t sectorsThisCommand = sectorsLeft;
+
+        if (sectorsThisCommand > (AHCI_BYTES_PER_COMMAND / SECTOR_SIZE))
+        {
+            sectorsThisCommand = AHCI_BYTES_PER_COMMAND / SECTOR_SIZE;
+        }
+
+        // Each command is issued as soon as it is built so the drive can start while we build the next one
+        ahciBuildCommand(slot, command, sectorNumber, sectorsThisCommand, buffer, write);
+        ahciIssueCommand(slot, AhciDevice->ncqSupported);
+        slot++;
+
+        sectorNumber = sectorNumber + sectorsThisCommand;
+        buffer = buffer + (sectorsThisCommand * SECTOR_SIZE);
+        sectorsLeft = sectorsLeft - sectorsThisCommand;
+
+        if (slot == AhciDevice->queueDepth || sectorsLeft == 0)
+        {
+            ahciWaitForCommands();
+            slot = 0;
+        }
+    }
+}
+
+void ahciReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    ahciTransfer(false, blockNumber, numberOfBlocks, destinationMemory);
+}
+
+void ahciWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    ahciTransfer(true, blockNumber, numberOfBlocks, sourceMemory);
+    ahciFlush();
+}
+
+void ahciFlush()
+{
+    ahciBuildCommand(0, ATA_CACHE_FLUSH_EXT, 0, 0, 0, false);
+    ahciIssueCommand(0, false);
+    ahciWaitForCommands();
+}
+
+void ahciGeometry(struct blockDeviceGeometry *Geometry)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    Geometry->blockSize = BLOCK_SIZE;
+    Geometry->totalBlocks = (AhciDevice->totalSectors - EXT2_SECTOR_START) / SECTORS_PER_BLOCK;
+}
+
+void ahciInstallInterruptHandler(uint8_t *idtMemory)
+{
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+
+    setInterruptHandler(idtMemory, (PIC_IRQ_VECTOR_BASE + AhciDevice->interruptLine), &ahciInterruptHandler);
+}
+
+void ahciInterruptHandler()
+{
+    asm volatile ("pusha\n\t");
+    asm volatile ("cld\n\t");
+
+    struct ahciDevice *AhciDevice = (struct ahciDevice*)AHCI_STATE;
+    uint32_t portInterruptStatus = *ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS);
+
+    // Remember errors for ahciWaitForCommands() since clearing the status hides them
+    if (portInterruptStatus & AHCI_PORT_IS_TASK_FILE_ERROR)
+    {
+        AhciDevice->taskFileError = 1;
+    }
+
+    *ahciPortRegister(AHCI_PORT_INTERRUPT_STATUS) = portInterruptStatus;
+    *ahciHostRegister(AHCI_INTERRUPT_STATUS) = (1 << AhciDevice->port);
+    AhciDevice->interruptCount++;
+
+    if (AhciDevice->interruptLine >= PIC_SLAVE_FIRST_IRQ)
+    {
+        outputIOPort(SLAVE_PIC_COMMAND_PORT, INTERRUPT_END_OF_INTERRUPT);
+    }
+    outputIOPort(MASTER_PIC_COMMAND_PORT, INTERRUPT_END_OF_INTERRUPT);
+
+    asm volatile ("popa\n\t");
+    asm volatile ("leave\n\t");
+    asm volatile ("iret\n\t");
+}
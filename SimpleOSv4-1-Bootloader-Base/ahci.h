@@ -0,0 +1,133 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+// https://www.intel.com/content/www/us/en/io/serial-ata/serial-ata-ahci-spec-rev1-3-1.html
+// https://wiki.osdev.org/AHCI
+
+#include "constants.h"
+/**
+ * An AHCI command header. The command list holds one per command slot.
+ */
+struct ahciCommandHeader
+{
+    /** Bits 0-4 are the command FIS length in dwords, bit 6 is the write flag, bits 16-31 are the PRDT length. */
+    uint32_t flags;
+    /** The number of bytes transferred, filled in by the HBA. */
+    uint32_t prdByteCount;
+    uint32_t commandTableBase;
+    uint32_t commandTableBaseUpper;
+    uint32_t reserved[4];
+};
+
+/**
+ * A physical region descriptor table entry. Each one points at a physically contiguous piece of the buffer.
+ */
+struct ahciPrdtEntry
+{
+    uint32_t dataBase;
+    uint32_t dataBaseUpper;
+    uint32_t reserved;
+    /** The byte count minus one in bits 0-21. */
+    uint32_t byteCount;
+};
+
+/**
+ * The AHCI driver state. This lives at AHCI_STATE so the kernel can keep using the port that bootloader stage 2 set up.
+ */
+struct ahciDevice
+{
+    /** The physical address of the HBA registers from BAR5. */
+    uint32_t abar;
+    /** The port the drive is attached to. */
+    uint32_t port;
+    /** The legacy PCI interrupt line (IRQ) of the HBA. */
+    uint32_t interruptLine;
+    /** 1 if the drive supports native command queuing. */
+    uint32_t ncqSupported;
+    /** How many command slots are used at once. Up to 32 with NCQ. */
+    uint32_t queueDepth;
+    /** The number of addressable sectors on the drive. */
+    uint32_t totalSectors;
+    /** The number of HBA interrupts handled. */
+    uint32_t interruptCount;
+    /** The most commands that were ever in flight together. */
+    uint32_t maxCommandsInFlight;
+    /** Set by the interrupt handler when the drive reports an error. */
+    uint32_t taskFileError;
+};
+
+/** Finds an AHCI HBA with a SATA drive attached, starts the port and identifies the drive. Returns false if none is present. */
+bool ahciInitialize();
+
+/** Returns a pointer to a register of the port the drive is attached to, making sure the HBA registers are mapped first.
+ * \param offset The register offset inside the port register block.
+ */
+volatile uint32_t *ahciPortRegister(uint32_t offset);
+
+/** Returns a pointer to a global HBA register. Once paging is on, the registers are reached through the window ahciMapWindow() adds to every page directory.
+ * \param offset The register offset from the start of the HBA registers.
+ */
+volatile uint32_t *ahciHostRegister(uint32_t offset);
+
+/** Adds the uncached 4 MB page that identity maps the HBA registers to a page directory. Nothing is needed before paging is enabled.
+ * \param pageDirectory The page directory to add the window to.
+ */
+void ahciMapWindow(uint32_t *pageDirectory);
+
+/** Builds the command header, command FIS and PRDT for one command slot. The buffer is split by physical page and merged again where pages are contiguous.
+ * \param slot The command slot to fill in.
+ * \param command The ATA command to issue.
+ * \param sectorNumber The first sector of the command in LBA format.
+ * \param numberOfSectors The number of sectors to transfer.
+ * \param buffer The memory to read into or write from. It may be a mapped user address. 0 if the command moves no data.
+ * \param write true if the data moves from memory to the drive.
+ */
+void ahciBuildCommand(uint32_t slot, uint8_t command, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *buffer, bool write);
+
+/** Issues a built command slot. Queued commands also set the slot's bit in PxSACT.
+ * \param slot The command slot to issue.
+ * \param queued true for FPDMA QUEUED commands.
+ */
+void ahciIssueCommand(uint32_t slot, bool queued);
+
+/** Waits until every issued command has completed and panics if the drive reported an error. */
+void ahciWaitForCommands();
+
+/** Splits a transfer into commands of up to AHCI_BYTES_PER_COMMAND and keeps up to queueDepth of them in flight.
+ * \param write true to write to the drive, false to read from it.
+ * \param blockNumber The first EXT2 block number.
+ * \param numberOfBlocks The number of blocks to transfer.
+ * \param buffer The memory to read into or write from.
+ */
+void ahciTransfer(bool write, uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *buffer);
+
+/** Reads consecutive EXT2 blocks from the AHCI drive.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks. It may be a mapped user address.
+ */
+void ahciReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/** Writes consecutive EXT2 blocks to the AHCI drive and flushes them.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write. It may be a mapped user address.
+ */
+void ahciWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
+/** Flushes the drive's write cache with FLUSH CACHE EXT. */
+void ahciFlush();
+
+/** Fills in the geometry of the AHCI drive from its IDENTIFY data.
+ * \param Geometry The geometry structure to fill in.
+ */
+void ahciGeometry(struct blockDeviceGeometry *Geometry);
+
+/** Points the HBA's IRQ vector at ahciInterruptHandler().
+ * \param idtMemory The starting location of the interrupt descriptor table.
+ */
+void ahciInstallInterruptHandler(uint8_t *idtMemory);
+
+/** The AHCI interrupt handler. Clears the port and HBA interrupt status. */
+void ahciInterruptHandler();
@@ -0,0 +1,146 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "fs.h"
+#include "kernel.h"
+#include "constants.h"
+#include "x86.h"
+#include "exceptions.h"
+#include "vm.h"
+
+const struct blockDeviceOperations *currentBlockDevice()
+{
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    if (KernelConfiguration->blockDevice >= MAX_BLOCK_DEVICES)
+    {
+        panic((uint8_t *)"block-device.cpp:currentBlockDevice() -> invalid block device");
+    }
+
+    return &blockDevices[KernelConfiguration->blockDevice];
+}
+
+bool selectBlockDevice(uint32_t blockDevice)
+{
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    // Stage 2 links a smaller table, where the devices it cannot boot from have no operations
+    if (blockDevice >= MAX_BLOCK_DEVICES || !blockDevices[blockDevice].initialize || !blockDevices[blockDevice].initialize())
+    {
+        return false;
+    }
+
+    // Every backend flushes at the end of its writes, so the old device has nothing pending
+    KernelConfiguration->blockDevice = blockDevice;
+
+    return true;
+}
+
+void blockDeviceInstallInterruptHandler(uint8_t *idtMemory)
+{
+    if (currentBlockDevice()->installInterruptHandler)
+    {
+        currentBlockDevice()->installInterruptHandler(idtMemory);
+    }
+}
+
+bool ataInitialize()
+{
+    return true;
+}
+
+void ataReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    uint32_t sectorStart = (blockNumber * SECTORS_PER_BLOCK) + EXT2_SECTOR_START;
+
+    if (!diskReadSectors(ATA_PRIMARY_MASTER, sectorStart, numberOfBlocks * SECTORS_PER_BLOCK, destinationMemory))
+    {
+        panic((uint8_t *)"block-device.cpp:ataReadBlocks() -> drive reported an error");
+    }
+}
+
+void ataWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    uint32_t sectorStart = (blockNumber * SECTORS_PER_BLOCK) + EXT2_SECTOR_START;
+
+    if (!diskWriteSectors(ATA_PRIMARY_MASTER, sectorStart, numberOfBlocks * SECTORS_PER_BLOCK, sourceMemory))
+    {
+        panic((uint8_t *)"block-device.cpp:ataWriteBlocks() -> drive reported an error");
+    }
+}
+
+void ataFlush()
+{
+    diskFlushCache(ATA_PRIMARY_MASTER);
+}
+
+void ataGeometry(struct blockDeviceGeometry *Geometry)
+{
+    Geometry->blockSize = BLOCK_SIZE;
+    Geometry->totalBlocks = (diskTotalSectors(ATA_PRIMARY_MASTER) - EXT2_SECTOR_START) / SECTORS_PER_BLOCK;
+}
+
+bool ramDiskInitialize()
+{
+    struct ext2SuperBlock *SuperBlock = (struct ext2SuperBlock*)SUPERBLOCK_LOC;
+
+    if (SuperBlock->sb_total_blocks == 0 || (SuperBlock->sb_total_blocks * BLOCK_SIZE) > RAMDISK_MAX_SIZE)
+    {
+        return false;
+    }
+
+    // Before paging the RAM disk is reached directly. After it, only the loaded directory gets the window here, and createPageDirectory() adds it to new ones.
+    if (readCR0() & CR0_PAGING)
+    {
+        ramDiskMapWindow((uint32_t *)(readCR3() & PAGE_FRAME_MASK));
+    }
+
+    // The whole file system comes in with one transfer from the device we booted from
+    currentBlockDevice()->readBlocks(0, SuperBlock->sb_total_blocks, (uint8_t *)RAMDISK_BASE);
+
+    return true;
+}
+
+void ramDiskMapWindow(uint32_t *pageDirectory)
+{
+    // The RAM disk is identity mapped and only the kernel may touch it
+    installKernelLargePage(pageDirectory, RAMDISK_BASE, 0);
+}
+
+void ramDiskReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    struct ext2SuperBlock *SuperBlock = (struct ext2SuperBlock*)SUPERBLOCK_LOC;
+
+    if ((blockNumber + numberOfBlocks) > SuperBlock->sb_total_blocks)
+    {
+        panic((uint8_t *)"block-device.cpp:ramDiskReadBlocks() -> read past end of RAM disk");
+    }
+
+    memoryCopy((uint8_t *)(RAMDISK_BASE + (blockNumber * BLOCK_SIZE)), destinationMemory, numberOfBlocks * BLOCK_SIZE);
+}
+
+void ramDiskWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    struct ext2SuperBlock *SuperBlock = (struct ext2SuperBlock*)SUPERBLOCK_LOC;
+
+    if ((blockNumber + numberOfBlocks) > SuperBlock->sb_total_blocks)
+    {
+        panic((uint8_t *)"block-device.cpp:ramDiskWriteBlocks() -> write past end of RAM disk");
+    }
+
+    memoryCopy(sourceMemory, (uint8_t *)(RAMDISK_BASE + (blockNumber * BLOCK_SIZE)), numberOfBlocks * BLOCK_SIZE);
+}
+
+void ramDiskFlush()
+{
+}
+
+void ramDiskGeometry(struct blockDeviceGeometry *Geometry)
+{
+    struct ext2SuperBlock *SuperBlock = (struct ext2SuperBlock*)SUPERBLOCK_LOC;
+
+    Geometry->blockSize = BLOCK_SIZE;
+    Geometry->totalBlocks = SuperBlock->sb_total_blocks;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "constants.h"
+/**
+ * The geometry of a block device, measured in EXT2 blocks.
+ */
+struct blockDeviceGeometry
+{
+    /** The size of one block in bytes. */
+    uint32_t blockSize;
+    /** The number of EXT2 blocks the device can hold. */
+    uint32_t totalBlocks;
+};
+
+/**
+ * The block device operations table. Each backend fills in one entry, and readBlocks() and writeBlocks() dispatch through the entry selected in the kernelConfiguration structure.
+ */
+struct blockDeviceOperations
+{
+    /** Prepares the device for use. Returns false if the device is not present. */
+    bool (*initialize)();
+    /** Reads consecutive EXT2 blocks into memory. */
+    void (*readBlocks)(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+    /** Writes consecutive EXT2 blocks from memory. */
+    void (*writeBlocks)(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+    /** Makes sure all written blocks have reached the device. */
+    void (*flush)();
+    /** Fills in the geometry structure for the device. */
+    void (*geometry)(struct blockDeviceGeometry *Geometry);
+    /** Points the device's IRQ at its handler once the kernel IDT is loaded. 0 if the device is polled. */
+    void (*installInterruptHandler)(uint8_t *idtMemory);
+};
+
+/** The operations of every block device, indexed by block device ID. block-devices.cpp defines the kernel table and boot-block-devices.cpp the smaller stage 2 table, which leaves out the RAM disk and stripe. */
+extern const struct blockDeviceOperations blockDevices[MAX_BLOCK_DEVICES];
+
+/** Returns the operations table of the block device currently selected in the kernelConfiguration structure. */
+const struct blockDeviceOperations *currentBlockDevice();
+
+/** Initializes a block device and, if it is present, makes it the device used for all file system I/O. Returns false and keeps the current device otherwise. kInit() calls it before the first page directory is created, so every directory gets the device's window.
+ * \param blockDevice The block device ID, such as BLOCK_DEVICE_ATA, BLOCK_DEVICE_RAMDISK or BLOCK_DEVICE_STRIPE.
+ */
+bool selectBlockDevice(uint32_t blockDevice);
+
+/** Adds the kernel window the current block device needs, the RAM disk or the AHCI registers, to a page directory. Called by createPageDirectory(). The stage 2 version does nothing.
+ * \param pageDirectory The page directory to add the window to.
+ */
+void blockDeviceMapWindow(uint32_t *pageDirectory);
+
+/** Installs the interrupt handler of the current block device, if it has one. Called by the kernel after the IDT is loaded.
+ * \param idtMemory The starting location of the interrupt descriptor table.
+ */
+void blockDeviceInstallInterruptHandler(uint8_t *idtMemory);
+
+/** The ATA backend initialization. The primary master is always assumed to be present. */
+bool ataInitialize();
+
+/** Reads consecutive EXT2 blocks from the primary ATA drive.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks.
+ */
+void ataReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/** Writes consecutive EXT2 blocks to the primary ATA drive.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write.
+ */
+void ataWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
+/** Flushes the write cache of the primary ATA drive. */
+void ataFlush();
+
+/** Fills in the geometry of the primary ATA drive using IDENTIFY DEVICE.
+ * \param Geometry The geometry structure to fill in.
+ */
+void ataGeometry(struct blockDeviceGeometry *Geometry);
+
+/** Copies the whole EXT2 file system from the current block device into RAMDISK_BASE and builds the kernel page table that maps it. */
+bool ramDiskInitialize();
+
+/** Adds the 4 MB page that identity maps the RAM disk to a page directory. Nothing is needed before paging is enabled.
+ * \param pageDirectory The page directory to add the window to.
+ */
+void ramDiskMapWindow(uint32_t *pageDirectory);
+
+/** Copies consecutive EXT2 blocks out of the RAM disk.
+ * \param blockNumber The first EXT2 block number.
+ * \param numberOfBlocks The number of blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks.
+ */
+void ramDiskReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/** Copies consecutive EXT2 blocks into the RAM disk. Nothing is written back to the disk the image came from.
+ * \param blockNumber The first EXT2 block number.
+ * \param numberOfBlocks The number of blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write.
+ */
+void ramDiskWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
+/** The RAM disk has no cache to flush. */
+void ramDiskFlush();
+
+/** Fills in the geometry of the RAM disk, which is the size of the EXT2 file system in the superblock.
+ * \param Geometry The geometry structure to fill in.
+ */
+void ramDiskGeometry(struct blockDeviceGeometry *Geometry);
@@ -0,0 +1,34 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "kernel.h"
+#include "constants.h"
+#include "virtio-blk.h"
+#include "ahci.h"
+#include "stripe.h"
+
+// Indexed by the block device ID stored in the kernelConfiguration structure
+const struct blockDeviceOperations blockDevices[MAX_BLOCK_DEVICES] =
+{
+    { ataInitialize, ataReadBlocks, ataWriteBlocks, ataFlush, ataGeometry, 0 },                         // BLOCK_DEVICE_ATA
+    { ramDiskInitialize, ramDiskReadBlocks, ramDiskWriteBlocks, ramDiskFlush, ramDiskGeometry, 0 },      // BLOCK_DEVICE_RAMDISK
+    { virtioBlockInitialize, virtioBlockReadBlocks, virtioBlockWriteBlocks, virtioBlockFlush, virtioBlockGeometry, virtioBlockInstallInterruptHandler }, // BLOCK_DEVICE_VIRTIO
+    { ahciInitialize, ahciReadBlocks, ahciWriteBlocks, ahciFlush, ahciGeometry, ahciInstallInterruptHandler },  // BLOCK_DEVICE_AHCI
+    { stripeInitialize, stripeReadBlocks, stripeWriteBlocks, stripeFlush, stripeGeometry, 0 }            // BLOCK_DEVICE_STRIPE
+};
+
+void blockDeviceMapWindow(uint32_t *pageDirectory)
+{
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    if (KernelConfiguration->blockDevice == BLOCK_DEVICE_RAMDISK)
+    {
+        ramDiskMapWindow(pageDirectory);
+    }
+    else if (KernelConfiguration->blockDevice == BLOCK_DEVICE_AHCI)
+    {
+        ahciMapWindow(pageDirectory);
+    }
+}
@@ -0,0 +1,23 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "constants.h"
+#include "virtio-blk.h"
+#include "ahci.h"
+
+// The stage 2 table. It only has the devices stage 2 can boot from, so the RAM disk and stripe backends stay out of the image that has to fit before the ext2 image.
+const struct blockDeviceOperations blockDevices[MAX_BLOCK_DEVICES] =
+{
+    { ataInitialize, ataReadBlocks, ataWriteBlocks, ataFlush, ataGeometry, 0 },                         // BLOCK_DEVICE_ATA
+    { 0, 0, 0, 0, 0, 0 },                                                                               // BLOCK_DEVICE_RAMDISK
+    { virtioBlockInitialize, virtioBlockReadBlocks, virtioBlockWriteBlocks, virtioBlockFlush, virtioBlockGeometry, 0 }, // BLOCK_DEVICE_VIRTIO
+    { ahciInitialize, ahciReadBlocks, ahciWriteBlocks, ahciFlush, ahciGeometry, 0 },                    // BLOCK_DEVICE_AHCI
+    { 0, 0, 0, 0, 0, 0 }                                                                                // BLOCK_DEVICE_STRIPE
+};
+
+void blockDeviceMapWindow(uint32_t *pageDirectory)
+{
+    // Stage 2 never turns on paging, so there is no window to add
+}
@@ -15,6 +15,31 @@ bits 16
     ;; ASSIGNMENT 1 TO DO
 
 
+;; collect the BIOS E820 memory map for the frame allocator (struct e820Map at E820_MAP_LOC)
+    xor ax, ax
+    mov es, ax
+    mov dword [e820_map], 0x0
+    mov di, e820_map + 0x4
+    xor ebx, ebx                ;; continuation value, 0 for the first entry
+
+e820_next_entry:
+    mov eax, 0xE820
+    mov edx, 0x534D4150         ;; "SMAP"
+    mov ecx, 0x18               ;; 24 byte entries
+    mov dword [es:di + 0x14], 0x1   ;; extended attributes stay valid if the BIOS only fills 20 bytes
+    int 0x15
+    jc e820_done                ;; no E820 support, or past the last entry
+    cmp eax, 0x534D4150
+    jne e820_done
+    add di, 0x18
+    inc dword [e820_map]
+    cmp dword [e820_map], E820_MAX_ENTRIES
+    je e820_done
+    test ebx, ebx               ;; 0 after the last entry
+    jnz e820_next_entry
+
+e820_done:
+
 
 ;; switch to protected mode
     cli
@@ -78,6 +103,8 @@ gdtr:
 
 
 data_segment equ ring_0_data_segment_descriptor - gdt
+e820_map equ 0x5000             ;; E820_MAP_LOC
+E820_MAX_ENTRIES equ 0x20
 
 bits 32
 
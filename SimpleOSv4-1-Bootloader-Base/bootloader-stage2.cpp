@@ -7,10 +7,14 @@
 #include "constants.h"
 #include "exceptions.h"
 #include "vm.h"
+#include "x86.h"
 
 
 void main()
 {
+    // Recorded before the first fillMemory(), which picks its store instructions from it
+    storeValueAtMemLoc(CPU_FEATURES_LOC, cpuidFeatures());
+
     clearScreen();
     printString(COLOR_WHITE, 5, 5, (uint8_t *)"Welcome to CSCN-443!");
     printString(COLOR_LIGHT_BLUE, 7, 5, (uint8_t *)"Bootloader-Stage2");
@@ -12,8 +12,9 @@ typedef unsigned char uint8_t;
 #define USER_PID_INFO 0x2000
 #define OPEN_BUFFER_TABLE ((uint8_t *)0x2100)
 #define RUNNING_PID_LOC ((uint8_t *)0x2FF0)
-#define RETURNED_MMAP_PAGE_LOC ((uint8_t *)0x2FF4)
 #define CURRENT_FILE_DESCRIPTOR ((uint8_t *)0x2FF8)
+#define CPU_FEATURES_LOC ((uint8_t *)0x2FFC)
+#define E820_MAP_LOC 0x5000
 #define GDT_LOC 0x7000
 #define USER_TEMP_INODE_LOC ((uint8_t *)0x30000)
 #define USER_TEMP_FILE_LOC ((uint8_t *)0x31000)
@@ -24,31 +25,56 @@ typedef unsigned char uint8_t;
 #define USERPROG_TEXTSEG_START 0x100000
 #define USER_HEAP 0x200000
 #define TEMP_FILE_START_LOC 0x210000
+#define RUNTIME_LIBRARY_BASE 0x2C0000
 #define STACK_PAGE 0x2FE000
 #define STACK_START_LOC 0x2FF000
 #define KERNEL_BASE 0x300000
 #define PROCESS_TABLE_LOC 0x348000
 #define EXT2_INDIRECT_BLOCK ((uint8_t *)0x349000)
+#define EXT2_PARTIAL_BLOCK_LOC ((uint8_t *)0x34A000)
+#define ELF_HEADER_BUFFER 0x34B000
 #define KERNEL_TEMP_INODE_LOC ((uint8_t *)0x350000)
 #define KERNEL_TEMP_FILE_LOC ((uint8_t *)0x352000)
-#define PAGE_DIR_BASE 0x370000
-#define PAGE_TABLE_BASE 0x371000
+#define KERNEL_HEAP_STATE 0x370000
 #define INTERRUPT_DESC_TABLE 0x392000
 #define INTERRUPT_DESC_TABLE_REG 0x393000
-#define KERNEL_HEAP 0x395000
-#define PAGEFRAME_MAP_BASE 0x397000
+#define SHARED_PAGE_TABLE 0x394000
+#define COPY_ON_WRITE_BUFFER 0x396000
 #define OPEN_FILE_TABLE 0x398000
+#define EXEC_CACHE 0x399000
 #define KERNEL_HASH_LOC ((uint8_t *)0x39A000)
 #define KERNEL_STACK 0x39F000
 #define EXT2_TEMP_INODE_STRUCTS ((uint8_t *)0x3A0000)
+#define VIRTIO_BLK_QUEUE 0x3A4000
+#define VIRTIO_BLK_STATE 0x3A7000
+#define AHCI_COMMAND_LIST 0x3A8000
+#define AHCI_RECEIVED_FIS 0x3A8400
+#define AHCI_STATE 0x3A8800
+#define AHCI_IDENTIFY_BUFFER 0x3A8C00
+#define AHCI_COMMAND_TABLES 0x3A9000
+#define STRIPE_STATE 0x3AB000
+#define RUNTIME_LIBRARY_MAPPING 0x3AC000
 #define EXT2_BLOCK_USAGE_MAP 0x3F0000
 #define EXT2_INODE_USAGE_MAP 0x3F1000
+#define FRAME_ALLOCATOR_STATE 0x3F5000
+#define ZERO_FRAME_WINDOW 0x3F6000
 #define EXT2_INDIRECT_BLOCK_TMP_LOC 0x3F2000
 #define KERNEL_CONFIGURATION 0x3FC000
 #define KERNEL_SEMAPHORE_TABLE 0x3FD000
 #define SUPERBLOCK_LOC ((uint8_t *)0x3FF000)
 #define BLOCK_GROUP_DESCRIPTOR_TABLE ((uint8_t *)0x3FF600)
 #define KERNEL_LIMIT 0x400000
+#define RAMDISK_BASE 0x400000
+#define FRAME_METADATA_BASE 0x800000
+#define PAGEFRAME_MAP_BASE 0x800000
+#define PAGEFRAME_REFCOUNT_BASE 0x810000
+#define BUDDY_ALLOCATOR_STATE 0x820000
+#define FRAME_METADATA_END 0x8B1000
+#define KERNEL_FRAME_POOL_END 0xC00000
+#define USER_BRK_BASE 0xC00000
+#define USER_BRK_LIMIT 0x10000000
+#define USER_MMAP_BASE 0x10000000
+#define USER_MMAP_LIMIT 0x40000000
 #define LAPIC_ADDR 0xFEE00000
 
 // IO PORTS
@@ -64,15 +90,24 @@ typedef unsigned char uint8_t;
 #define KEYBOARD_STATUS_PORT 0x64
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_PORT_B 0x61
-#define PRIMARY_ATA_DATA_REGISTER 0x1F0
-#define PRIMARY_ATA_SECTOR_COUNT_REGISTER 0x1F2
-#define PRIMARY_ATA_SECTOR_LOWBYTE_NUMBER 0x1F3
-#define PRIMARY_ATA_SECTOR_MIDBYTE_NUMBER 0x1F4
-#define PRIMARY_ATA_SECTOR_HIGHBYTE_NUMBER 0x1F5
-#define PRIMARY_ATA_DRIVE_HEADER_REGISTER 0x1F6
-#define PRIMARY_ATA_COMMAND_STATUS_REGISTER 0x1F7
+#define PCI_CONFIG_ADDRESS_PORT 0xCF8
+#define PCI_CONFIG_DATA_PORT 0xCFC
+#define PRIMARY_ATA_BASE_PORT 0x1F0
+#define SECONDARY_ATA_BASE_PORT 0x170
+#define ATA_DATA_OFFSET 0x0
+#define ATA_SECTOR_COUNT_OFFSET 0x2
+#define ATA_LBA_LOW_OFFSET 0x3
+#define ATA_LBA_MID_OFFSET 0x4
+#define ATA_LBA_HIGH_OFFSET 0x5
+#define ATA_DRIVE_HEAD_OFFSET 0x6
+#define ATA_COMMAND_STATUS_OFFSET 0x7
 #define ATA_READ 0x20
+#define ATA_READ_EXT 0x24
 #define ATA_WRITE 0x30
+#define ATA_WRITE_EXT 0x34
+#define ATA_CACHE_FLUSH 0xE7
+#define ATA_CACHE_FLUSH_EXT 0xEA
+#define ATA_IDENTIFY 0xEC
 
 // Constants
 #define KEYBOARD_BUFFER_SIZE 0x40
@@ -82,27 +117,219 @@ typedef unsigned char uint8_t;
 #define INTERRUPT_MASK_SYSTEM_TIMER_AND_KEYBOARD_ONLY 0xFC
 #define INTERRUPT_MASK_ALL_DISABLED 0xFF
 #define INTERRUPT_END_OF_INTERRUPT 0x20
+#define PIC_IRQ_VECTOR_BASE 0x20
+#define PIC_SLAVE_FIRST_IRQ 0x8
 #define BLOCK_SIZE 0x400
 #define SECTOR_SIZE 0x200
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
+#define ATA_LBA28_MAX_SECTORS 0x10000000
+#define ATA_LBA28_MAX_SECTORS_PER_COMMAND 0x100
+#define ATA_LBA48_MAX_SECTORS_PER_COMMAND 0x10000
+#define ATA_DRIVE_MASTER_LBA28 0xE0
+#define ATA_DRIVE_MASTER_LBA48 0x40
+#define ATA_DRIVE_SLAVE 0x10
+#define ATA_STATUS_BUSY 0x80
+#define ATA_STATUS_READY 0x40
+#define ATA_STATUS_DRIVE_FAULT 0x20
+#define ATA_STATUS_DATA_REQUEST 0x08
+#define ATA_STATUS_ERROR 0x01
+#define ATA_PRIMARY_MASTER 0x0
+#define ATA_PRIMARY_SLAVE 0x1
+#define ATA_SECONDARY_MASTER 0x2
+#define ATA_SECONDARY_SLAVE 0x3
+#define MAX_ATA_DRIVES 0x4
+#define ATA_IDENTIFY_LBA28_SECTORS 60
+#define ATA_IDENTIFY_COMMAND_SETS 83
+#define ATA_IDENTIFY_LBA48_SECTORS 100
+#define ATA_IDENTIFY_LBA48_SUPPORTED 0x400
+#define ATA_ADDRESSING_UNKNOWN 0x0
+#define ATA_ADDRESSING_LBA28 0x1
+#define ATA_ADDRESSING_LBA48 0x2
+#define BLOCK_DEVICE_ATA 0x0
+#define BLOCK_DEVICE_RAMDISK 0x1
+#define BLOCK_DEVICE_VIRTIO 0x2
+#define BLOCK_DEVICE_AHCI 0x3
+#define BLOCK_DEVICE_STRIPE 0x4
+#define MAX_BLOCK_DEVICES 0x5
+#define STRIPE_FIRST_MEMBER ATA_PRIMARY_SLAVE
+#define STRIPE_MAX_MEMBERS 0x3
+#define STRIPE_CHUNK_BLOCKS 0x10
+#define EXT2_SIGNATURE 0xEF53
+#define BLOCK_DEVICE_KEEP_BOOT_DISK 0xFF
+#define BOOT_BLOCK_DEVICE BLOCK_DEVICE_KEEP_BOOT_DISK
+#define RAMDISK_MAX_SIZE 0x400000
+#define PAGE_TABLE_SPAN 0x400000
+#define CR0_PAGING 0x80000000
+#define CR0_WRITE_PROTECT 0x10000
+#define CR4_PAGE_SIZE_EXTENSION 0x10
+#define CR4_PAGE_GLOBAL_ENABLE 0x80
+#define CPUID_PSE 0x8
+#define CPUID_PGE 0x2000
+#define CPUID_SSE2 0x4000000
+#define STREAMING_FILL_THRESHOLD 0x1000
+#define EFLAGS_INTERRUPT_ENABLE 0x200
+#define PAGE_FRAME_MASK 0xFFFFF000
+#define PAGE_ENTRIES_PER_TABLE 0x400
+#define PAGE_PRESENT 0x1
+#define PAGE_WRITABLE 0x2
+#define PAGE_USER 0x4
+#define PAGE_WRITE_THROUGH 0x8
+#define PAGE_CACHE_DISABLE 0x10
+#define PAGE_LARGE 0x80
+#define PAGE_GLOBAL 0x100
+#define PCI_MAX_BUSES 0x100
+#define PCI_DEVICES_PER_BUS 0x20
+#define PCI_FUNCTIONS_PER_DEVICE 0x8
+#define PCI_VENDOR_NONE 0xFFFF
+#define PCI_CONFIG_ENABLE 0x80000000
+#define PCI_CONFIG_COMMAND 0x04
+#define PCI_CONFIG_CLASS 0x08
+#define PCI_CONFIG_HEADER_TYPE 0x0C
+#define PCI_CONFIG_BAR0 0x10
+#define PCI_CONFIG_BAR5 0x24
+#define PCI_CONFIG_INTERRUPT_LINE 0x3C
+#define PCI_COMMAND_IO_SPACE 0x1
+#define PCI_COMMAND_MEMORY_SPACE 0x2
+#define PCI_COMMAND_BUS_MASTER 0x4
+#define PCI_BAR_IO_SPACE 0x1
+#define PCI_BAR_MEMORY_MASK 0xFFFFFFF0
+#define PCI_CLASS_AHCI 0x01060100
+#define PCI_CLASS_MASK 0xFFFFFF00
+#define PCI_VENDOR_AND_DEVICE_MASK 0xFFFFFFFF
+#define PCI_HEADER_MULTIFUNCTION 0x800000
+#define PCI_VENDOR_VIRTIO 0x1AF4
+#define PCI_DEVICE_VIRTIO_BLK_LEGACY 0x1001
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_ADDRESS 0x08
+#define VIRTIO_QUEUE_SIZE 0x0C
+#define VIRTIO_QUEUE_SELECT 0x0E
+#define VIRTIO_QUEUE_NOTIFY 0x10
+#define VIRTIO_DEVICE_STATUS 0x12
+#define VIRTIO_ISR_STATUS 0x13
+#define VIRTIO_BLK_CONFIG_CAPACITY 0x14
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x1
+#define VIRTIO_STATUS_DRIVER 0x2
+#define VIRTIO_STATUS_DRIVER_OK 0x4
+#define VIRTIO_STATUS_FAILED 0x80
+#define VIRTIO_BLK_FEATURE_FLUSH 0x200
+#define VIRTQ_DESC_FLAG_NEXT 0x1
+#define VIRTQ_DESC_FLAG_WRITE 0x2
+#define VIRTIO_BLK_REQUEST_IN 0x0
+#define VIRTIO_BLK_REQUEST_OUT 0x1
+#define VIRTIO_BLK_REQUEST_FLUSH 0x4
+#define VIRTIO_BLK_STATUS_OK 0x0
+#define VIRTIO_BLK_MAX_QUEUE_SIZE 0x100
+#define VIRTIO_BLK_QUEUE_PAGES 0x3
+#define VIRTIO_BLK_DESCRIPTORS_PER_REQUEST 0x4
+#define VIRTIO_BLK_MAX_BATCH 0x20
+#define VIRTIO_BLK_BYTES_PER_REQUEST PAGE_SIZE
+#define VIRTIO_BLK_HEADERS_OFFSET 0x100
+#define VIRTIO_BLK_STATUS_OFFSET 0x400
+#define AHCI_HOST_CAPABILITIES 0x00
+#define AHCI_GLOBAL_HOST_CONTROL 0x04
+#define AHCI_INTERRUPT_STATUS 0x08
+#define AHCI_PORTS_IMPLEMENTED 0x0C
+#define AHCI_CAP_NCQ 0x40000000
+#define AHCI_GHC_INTERRUPT_ENABLE 0x2
+#define AHCI_GHC_AHCI_ENABLE 0x80000000
+#define AHCI_MAX_PORTS 0x20
+#define AHCI_PORT_BASE 0x100
+#define AHCI_PORT_SIZE 0x80
+#define AHCI_PORT_COMMAND_LIST_BASE 0x00
+#define AHCI_PORT_COMMAND_LIST_BASE_UPPER 0x04
+#define AHCI_PORT_FIS_BASE 0x08
+#define AHCI_PORT_FIS_BASE_UPPER 0x0C
+#define AHCI_PORT_INTERRUPT_STATUS 0x10
+#define AHCI_PORT_INTERRUPT_ENABLE 0x14
+#define AHCI_PORT_COMMAND 0x18
+#define AHCI_PORT_TASK_FILE_DATA 0x20
+#define AHCI_PORT_SIGNATURE 0x24
+#define AHCI_PORT_SATA_STATUS 0x28
+#define AHCI_PORT_SATA_ERROR 0x30
+#define AHCI_PORT_SATA_ACTIVE 0x34
+#define AHCI_PORT_COMMAND_ISSUE 0x38
+#define AHCI_PORT_CMD_START 0x1
+#define AHCI_PORT_CMD_FIS_RECEIVE_ENABLE 0x10
+#define AHCI_PORT_CMD_FIS_RECEIVE_RUNNING 0x4000
+#define AHCI_PORT_CMD_LIST_RUNNING 0x8000
+#define AHCI_PORT_IS_DEVICE_TO_HOST_FIS 0x1
+#define AHCI_PORT_IS_SET_DEVICE_BITS_FIS 0x8
+#define AHCI_PORT_IS_TASK_FILE_ERROR 0x40000000
+#define AHCI_SATA_STATUS_DEVICE_PRESENT 0x3
+#define AHCI_SIGNATURE_ATA 0x00000101
+#define AHCI_MAX_COMMAND_SLOTS 0x20
+#define AHCI_COMMAND_HEADER_SIZE 0x20
+#define AHCI_COMMAND_TABLE_SIZE 0x100
+#define AHCI_COMMAND_TABLE_PRDT_OFFSET 0x80
+#define AHCI_MAX_PRDT_ENTRIES 0x8
+#define AHCI_BYTES_PER_COMMAND 0x4000
+#define AHCI_MAX_PRDT_BYTES 0x400000
+#define AHCI_COMMAND_WRITE 0x40
+#define AHCI_FIS_REGISTER_HOST_TO_DEVICE 0x27
+#define AHCI_FIS_COMMAND 0x80
+#define ATA_READ_DMA_EXT 0x25
+#define ATA_WRITE_DMA_EXT 0x35
+#define ATA_READ_FPDMA_QUEUED 0x60
+#define ATA_WRITE_FPDMA_QUEUED 0x61
+#define ATA_IDENTIFY_QUEUE_DEPTH 75
+#define ATA_IDENTIFY_SATA_CAPABILITIES 76
+#define ATA_IDENTIFY_NCQ_SUPPORTED 0x100
 #define PAGE_SIZE 0x1000
-#define MAX_PGTABLES_SIZE 0x2000
-#define HEAP_OBJ_SIZE 0x20
-#define HEAP_OBJ_USABLE_SIZE ((int)HEAP_OBJ_SIZE - 2) // 1 byte for PID and and extra byte for null
-#define MAX_HEAP_OBJECTS 0x80
+#define USER_HEAP_MAGIC 0x50414548
+#define USER_HEAP_CHUNK_HEADER 0x8
+#define USER_HEAP_MIN_CHUNK 0x10
+#define USER_HEAP_SMALL_CLASSES 0x6
+#define USER_HEAP_SMALL_MAX_CHUNK 0x200
+#define USER_HEAP_LARGE_OBJECT 0x8000
+#define USER_HEAP_GROWTH 0x10000
+#define USER_HEAP_IN_USE 0x1
+#define USER_HEAP_SMALL 0x2
+#define USER_HEAP_FLAGS 0xF
+#define KMALLOC_SIZE_CLASSES 0x8
+#define KMALLOC_MIN_OBJECT_SIZE 0x10
+#define KMALLOC_MAX_OBJECT_SIZE 0x800
+#define KMALLOC_LARGE_OBJECT 0xFE
+#define KMALLOC_NOT_HEAP 0xFF
+#define KMALLOC_NO_SLAB 0xFFFF
+#define KMALLOC_MAX_FRAMES_PER_PID 0x20
 #define SEMAPHORE_SIZE 0x10
 #define MAX_SEMAPHORE_OBJECTS 0x80
-#define TASK_STRUCT_SIZE 0xA8
+#define TASK_STRUCT_SIZE 0xB0
 #define PROC_SLEEPING 0x1
 #define PROC_RUNNING 0x2
 #define PROC_ZOMBIE 0x3
 #define PROC_KILLED 0x4
-#define MAX_PROCESSES 0x10
+#define MAX_PROCESSES 0xFC
 #define MAX_PROCESS_SIZE 0x400000
-#define PAGEFRAME_MAP_SIZE 0x400
+#define PAGEFRAME_MAP_SIZE 0x10000
+#define BUDDY_MAX_ORDER 0xA
+#define BUDDY_NO_FRAME 0xFFFFFFFF
+#define BUDDY_NOT_FREE 0xFF
+#define FREE_STACK_HIGH_WATER 0x40
+#define ZEROED_POOL_SIZE 0x40
+#define KERNEL_FRAME_POOL_FRAMES ((KERNEL_FRAME_POOL_END - FRAME_METADATA_END) / PAGE_SIZE)
+#define E820_MAX_ENTRIES 0x20
+#define E820_USABLE 0x1
+#define E820_FALLBACK_MEMORY_SIZE 0x1000000
 #define MAX_FILE_DESCRIPTORS 0xF
 #define MAX_SYSTEM_OPEN_FILES 0x80
 #define MAGIC_ELF 0x464C457F
 #define ELF_PROGRAM_HEADER_SIZE 0x20
+#define ELF_PT_LOAD 0x1
+#define MAX_EXEC_SEGMENTS 0x4
+#define EXEC_MAPPING_SIZE 0x100
+#define TASK_EXEC_MAPPING_OFFSET 0x100
+#define TASK_VIRTUAL_AREAS_OFFSET 0x200
+#define MAX_VIRTUAL_AREAS 0x80
+#define PAGE_FAULT_PRESENT 0x1
+#define PAGE_FAULT_WRITE 0x2
+#define ELF_PF_WRITE 0x2
+#define MAX_SHARED_PAGES 0x100
+#define EXEC_CACHE_ENTRY_SIZE 0x200
+#define MAX_EXEC_CACHE_ENTRIES 0x7
+#define FLAT_MAGIC 0x54414C46
+#define EXEC_CACHE_NAME_LENGTH 0x20
 #define INODE_SIZE 0x80
 #define EXT2_SECTOR_START 0x100
 #define EXT2_SUPERBLOCK_SECTOR_START (EXT2_SECTOR_START + 2)
@@ -141,7 +368,15 @@ typedef unsigned char uint8_t;
 #define PG_KERNEL_PRESENT_RW 0x3
 #define PG_USER_PRESENT_RO 0x5
 #define PG_USER_PRESENT_RW 0x7
+#define PG_COPY_ON_WRITE 0x200
+#define PG_RESERVED 0x400
+#define PG_MMAP_PAGE 0x800
+#define MMAP_PROT_READ 0x1
+#define MMAP_PROT_WRITE 0x2
+#define MMAP_POPULATE 0x1
 #define PAGEFRAME_AVAILABLE 0x00
+#define PAGEFRAME_SHARED 0xFE
+#define PAGEFRAME_RESERVED 0xFD
 #define KERNEL_OWNED 0xFF
 #define RDONLY 0x1
 #define RDWRITE 0x2
@@ -170,3 +405,8 @@ typedef unsigned char uint8_t;
 #define SYS_CREATE 0x14
 #define SYS_DELETE 0x15
 #define SYS_OPEN_EMPTY 0x16
+#define SYS_FORK 0x17
+#define SYS_BRK 0x18
+#define SYS_MMAP_RANGE 0x19
+#define SYS_MUNMAP 0x1A
+#define SYS_IDLE 0x1B
@@ -3,8 +3,12 @@
 
 
 #include "vm.h"
+#include "frame-allocator.h"
 #include "constants.h"
 #include "simpleOSlibc.h"
+#include "exceptions.h"
+#include "kernel.h"
+#include "x86.h"
 
 void createPageFrameMap(uint8_t *pageFrameMap, uint32_t numberOfFrames)
 {
@@ -26,11 +30,115 @@ void freeFrame(uint32_t frameNumber)
 {
     while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
     
-    *(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) = (uint8_t)0x0;
+    uint8_t *referenceCount = (uint8_t *)(PAGEFRAME_REFCOUNT_BASE + frameNumber);
+
+    if (*(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) == PAGEFRAME_SHARED && *referenceCount > 1)
+    {
+        *referenceCount = *referenceCount - 1;
+    }
+    else
+    {
+        if (*(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) == PAGEFRAME_SHARED)
+        {
+            removeSharedPage(frameNumber);
+        }
+
+        *referenceCount = 0;
+
+        if (*(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) != PAGEFRAME_AVAILABLE)
+        {
+            setFrameOwner(frameNumber, PAGEFRAME_AVAILABLE);
+            pushFreeFrame(frameNumber);
+        }
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+}
+
+void referenceFrame(uint32_t frameNumber)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    setFrameOwner(frameNumber, PAGEFRAME_SHARED);
+    *(uint8_t *)(PAGEFRAME_REFCOUNT_BASE + frameNumber) = *(uint8_t *)(PAGEFRAME_REFCOUNT_BASE + frameNumber) + 1;
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+}
+
+uint32_t frameReferences(uint32_t frameNumber)
+{
+    if (*(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) != PAGEFRAME_SHARED)
+    {
+        return 0;
+    }
+
+    return *(uint8_t *)(PAGEFRAME_REFCOUNT_BASE + frameNumber);
+}
+
+void claimSharedFrame(uint32_t pid, uint32_t frameNumber)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    removeSharedPage(frameNumber);
+    *(uint8_t *)(PAGEFRAME_REFCOUNT_BASE + frameNumber) = 0;
+    setFrameOwner(frameNumber, (uint8_t)pid);
 
     while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
 }
 
+uint32_t findSharedPage(uint32_t inodeNumber, uint32_t modifiedTime, uint32_t virtualAddress)
+{
+    struct sharedPage *SharedPage = (struct sharedPage*)SHARED_PAGE_TABLE;
+
+    for (uint32_t entry = 0; entry < MAX_SHARED_PAGES; entry++)
+    {
+        if (SharedPage->inodeNumber == inodeNumber && SharedPage->modifiedTime == modifiedTime && SharedPage->virtualAddress == virtualAddress)
+        {
+            return SharedPage->frameNumber;
+        }
+
+        SharedPage++;
+    }
+
+    return 0;
+}
+
+bool insertSharedPage(uint32_t inodeNumber, uint32_t modifiedTime, uint32_t virtualAddress, uint32_t frameNumber)
+{
+    struct sharedPage *SharedPage = (struct sharedPage*)SHARED_PAGE_TABLE;
+
+    for (uint32_t entry = 0; entry < MAX_SHARED_PAGES; entry++)
+    {
+        if (SharedPage->inodeNumber == 0)
+        {
+            SharedPage->inodeNumber = inodeNumber;
+            SharedPage->modifiedTime = modifiedTime;
+            SharedPage->virtualAddress = virtualAddress;
+            SharedPage->frameNumber = frameNumber;
+            return true;
+        }
+
+        SharedPage++;
+    }
+
+    return false;
+}
+
+void removeSharedPage(uint32_t frameNumber)
+{
+    struct sharedPage *SharedPage = (struct sharedPage*)SHARED_PAGE_TABLE;
+
+    for (uint32_t entry = 0; entry < MAX_SHARED_PAGES; entry++)
+    {
+        if (SharedPage->inodeNumber != 0 && SharedPage->frameNumber == frameNumber)
+        {
+            fillMemory((uint8_t *)SharedPage, 0x0, sizeof(struct sharedPage));
+        }
+
+        SharedPage++;
+    }
+}
+
 
 void freeAllFrames(uint32_t pid, uint8_t *pageFrameMap)
 {
@@ -40,39 +148,610 @@ void freeAllFrames(uint32_t pid, uint8_t *pageFrameMap)
 
 uint32_t processFramesUsed(uint32_t pid, uint8_t *pageFrameMap)
 {
-    uint8_t lastUsedFrame = PAGEFRAME_AVAILABLE;
-    uint32_t framesUsed = 0;
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
 
-    for (uint32_t frameNumber = 0; frameNumber < (KERNEL_BASE / PAGE_SIZE); frameNumber++)
+    if (pid == 0 || pid > MAX_PROCESSES)
     {
-        lastUsedFrame = *(uint8_t *)(pageFrameMap + frameNumber);
+        return 0;
+    }
 
-        if (lastUsedFrame == pid)
+    return FrameAllocatorState->processFrames[pid];
+}
+
+uint32_t totalFramesUsed(uint8_t *pageFrameMap)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+
+    return FrameAllocatorState->framesUsed;
+}
+
+void initializeFrameAllocator(uint8_t *pageFrameMap)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+
+    for (uint32_t frameNumber = (FRAME_METADATA_BASE / PAGE_SIZE); frameNumber < (FRAME_METADATA_END / PAGE_SIZE); frameNumber++)
+    {
+        if (!physicalFrameUsable(frameNumber))
         {
-            framesUsed++;      
+            panic((uint8_t *)"frame-allocator.cpp:initializeFrameAllocator() -> no RAM for the frame metadata");
         }
+    }
+
+    fillMemory((uint8_t *)FrameAllocatorState, 0x0, sizeof(struct frameAllocatorState));
+    fillMemory((uint8_t *)BuddyAllocatorState, 0x0, sizeof(struct buddyAllocatorState));
+
+    FrameAllocatorState->totalFrames = physicalFrames();
 
+    // Every list starts empty (BUDDY_NO_FRAME) and no frame heads a free block (BUDDY_NOT_FREE)
+    fillMemory((uint8_t *)BuddyAllocatorState->freeListHead, 0xFF, sizeof(BuddyAllocatorState->freeListHead));
+    fillMemory((uint8_t *)BuddyAllocatorState->freeOrder, 0xFF, sizeof(BuddyAllocatorState->freeOrder));
+
+    // The free frame stack starts empty. Freeing the frames one at a time merges them into the largest blocks they can form.
+    for (uint32_t frameNumber = 1; frameNumber < PAGEFRAME_MAP_SIZE; frameNumber++)
+    {
+        uint32_t physicalAddress = frameNumber * PAGE_SIZE;
+        uint8_t owner = *(uint8_t *)(pageFrameMap + frameNumber);
+        bool reserved = (frameNumber >= FrameAllocatorState->totalFrames || !physicalFrameUsable(frameNumber));
+
+        reserved = reserved || (physicalAddress >= VIDEO_AND_BIOS_RESERVED_START && physicalAddress <= VIDEO_AND_BIOS_RESERVED_END);
+        reserved = reserved || (physicalAddress >= FRAME_METADATA_BASE && physicalAddress < FRAME_METADATA_END);
+        reserved = reserved || (KernelConfiguration->blockDevice == BLOCK_DEVICE_RAMDISK && physicalAddress >= RAMDISK_BASE && physicalAddress < (RAMDISK_BASE + RAMDISK_MAX_SIZE));
+
+        if (reserved)
+        {
+            *(uint8_t *)(pageFrameMap + frameNumber) = PAGEFRAME_RESERVED;
+        }
+        else if (physicalAddress >= FRAME_METADATA_END && physicalAddress < KERNEL_FRAME_POOL_END)
+        {
+            *(uint8_t *)(pageFrameMap + frameNumber) = PAGEFRAME_AVAILABLE;
+            FrameAllocatorState->kernelFreeStack[FrameAllocatorState->kernelFreeFrames] = (uint16_t)frameNumber;
+            FrameAllocatorState->kernelFreeFrames++;
+        }
+        else if (owner == PAGEFRAME_AVAILABLE)
+        {
+            buddyFree(frameNumber, 0);
+        }
+        else
+        {
+            *(uint8_t *)(pageFrameMap + frameNumber) = PAGEFRAME_AVAILABLE;
+            setFrameOwner(frameNumber, owner);
+        }
     }
-    return (unsigned int)framesUsed;
+}
 
+void setFrameOwner(uint32_t frameNumber, uint8_t owner)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    uint8_t previousOwner = *(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber);
+
+    if (previousOwner == PAGEFRAME_AVAILABLE && owner != PAGEFRAME_AVAILABLE)
+    {
+        FrameAllocatorState->framesUsed++;
+    }
+    else if (previousOwner != PAGEFRAME_AVAILABLE && owner == PAGEFRAME_AVAILABLE)
+    {
+        FrameAllocatorState->framesUsed--;
+    }
+
+    if (previousOwner != PAGEFRAME_AVAILABLE && previousOwner <= MAX_PROCESSES)
+    {
+        FrameAllocatorState->processFrames[previousOwner]--;
+    }
+
+    if (owner != PAGEFRAME_AVAILABLE && owner <= MAX_PROCESSES)
+    {
+        FrameAllocatorState->processFrames[owner]++;
+    }
+
+    *(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) = owner;
 }
 
-uint32_t totalFramesUsed(uint8_t *pageFrameMap)
+void pushFreeFrame(uint32_t frameNumber)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+
+    if (frameNumber == 0)
+    {
+        panic((uint8_t *)"frame-allocator.cpp:pushFreeFrame() -> frame 0 cannot be freed");
+    }
+
+    // Past the high water mark frames go back to the buddy lists, where they can merge into contiguous blocks again
+    if (FrameAllocatorState->freeFrames >= FREE_STACK_HIGH_WATER)
+    {
+        buddyFree(frameNumber, 0);
+        return;
+    }
+
+    FrameAllocatorState->freeStack[FrameAllocatorState->freeFrames] = (uint16_t)frameNumber;
+    FrameAllocatorState->freeFrames++;
+}
+
+uint32_t popFreeFrame()
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+
+    if (FrameAllocatorState->freeFrames == 0)
+    {
+        uint32_t frameNumber = buddyAllocate(0);
+
+        // Zeroed frames are still free, and are only worth keeping while anything else is left
+        if (frameNumber == 0 && FrameAllocatorState->zeroedFrames > 0)
+        {
+            FrameAllocatorState->zeroedFrames--;
+            frameNumber = FrameAllocatorState->zeroedStack[FrameAllocatorState->zeroedFrames];
+        }
+
+        return frameNumber;
+    }
+
+    FrameAllocatorState->freeFrames--;
+
+    return FrameAllocatorState->freeStack[FrameAllocatorState->freeFrames];
+}
+
+void buddyListInsert(uint32_t frameNumber, uint32_t order)
+{
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+    uint32_t head = BuddyAllocatorState->freeListHead[order];
+
+    BuddyAllocatorState->next[frameNumber] = head;
+    BuddyAllocatorState->previous[frameNumber] = BUDDY_NO_FRAME;
+
+    if (head != BUDDY_NO_FRAME)
+    {
+        BuddyAllocatorState->previous[head] = frameNumber;
+    }
+
+    BuddyAllocatorState->freeListHead[order] = frameNumber;
+    BuddyAllocatorState->freeOrder[frameNumber] = (uint8_t)order;
+    BuddyAllocatorState->freeBlocks[order]++;
+}
+
+void buddyListRemove(uint32_t frameNumber)
+{
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+    uint32_t order = BuddyAllocatorState->freeOrder[frameNumber];
+    uint32_t next = BuddyAllocatorState->next[frameNumber];
+    uint32_t previous = BuddyAllocatorState->previous[frameNumber];
+
+    if (previous != BUDDY_NO_FRAME)
+    {
+        BuddyAllocatorState->next[previous] = next;
+    }
+    else
+    {
+        BuddyAllocatorState->freeListHead[order] = next;
+    }
+
+    if (next != BUDDY_NO_FRAME)
+    {
+        BuddyAllocatorState->previous[next] = previous;
+    }
+
+    BuddyAllocatorState->freeOrder[frameNumber] = BUDDY_NOT_FREE;
+    BuddyAllocatorState->freeBlocks[order]--;
+}
+
+uint32_t buddyAllocate(uint32_t order)
 {
-    uint8_t lastUsedFrame = PAGEFRAME_AVAILABLE;
-    uint32_t framesUsed = 0;
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+    uint32_t blockOrder = order;
+
+    while (blockOrder <= BUDDY_MAX_ORDER && BuddyAllocatorState->freeListHead[blockOrder] == BUDDY_NO_FRAME)
+    {
+        blockOrder++;
+    }
 
-    for (uint32_t frameNumber = 0; frameNumber < PAGEFRAME_MAP_SIZE; frameNumber++)
+    if (blockOrder > BUDDY_MAX_ORDER)
     {
-        lastUsedFrame = *(uint8_t *)(pageFrameMap + frameNumber);
+        return 0;
+    }
 
-        if (lastUsedFrame != PAGEFRAME_AVAILABLE)
+    uint32_t frameNumber = BuddyAllocatorState->freeListHead[blockOrder];
+    buddyListRemove(frameNumber);
+
+    // The low half is kept and the high half goes back on the next list down, until the block is the size asked for
+    while (blockOrder > order)
+    {
+        blockOrder--;
+        buddyListInsert(frameNumber + (1 << blockOrder), blockOrder);
+        BuddyAllocatorState->splits++;
+    }
+
+    return frameNumber;
+}
+
+void buddyFree(uint32_t frameNumber, uint32_t order)
+{
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+
+    while (order < BUDDY_MAX_ORDER)
+    {
+        uint32_t buddyFrame = frameNumber ^ (1 << order);
+
+        if (buddyFrame >= PAGEFRAME_MAP_SIZE || BuddyAllocatorState->freeOrder[buddyFrame] != order)
         {
-            framesUsed++;
-            
+            break;
         }
 
+        buddyListRemove(buddyFrame);
+        frameNumber = frameNumber & buddyFrame;
+        order++;
+        BuddyAllocatorState->merges++;
     }
-    return (uint32_t)framesUsed;
 
-}
\ No newline at end of file
+    buddyListInsert(frameNumber, order);
+}
+
+uint32_t allocateContiguousFrames(uint32_t pid, uint32_t order)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+
+    if (order > BUDDY_MAX_ORDER)
+    {
+        return 0;
+    }
+
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    uint32_t frameNumber = buddyAllocate(order);
+
+    // Frames parked on the free frame stack or the zeroed frame pool may be the missing buddies
+    if (frameNumber == 0 && order > 0 && (FrameAllocatorState->freeFrames > 0 || FrameAllocatorState->zeroedFrames > 0))
+    {
+        while (FrameAllocatorState->freeFrames > 0)
+        {
+            FrameAllocatorState->freeFrames--;
+            buddyFree(FrameAllocatorState->freeStack[FrameAllocatorState->freeFrames], 0);
+        }
+
+        while (FrameAllocatorState->zeroedFrames > 0)
+        {
+            FrameAllocatorState->zeroedFrames--;
+            buddyFree(FrameAllocatorState->zeroedStack[FrameAllocatorState->zeroedFrames], 0);
+        }
+
+        frameNumber = buddyAllocate(order);
+    }
+
+    for (uint32_t frame = 0; frameNumber != 0 && frame < (uint32_t)(1 << order); frame++)
+    {
+        setFrameOwner(frameNumber + frame, (uint8_t)pid);
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    return frameNumber;
+}
+
+void freeContiguousFrames(uint32_t frameNumber, uint32_t order)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    for (uint32_t frame = 0; frame < (uint32_t)(1 << order); frame++)
+    {
+        setFrameOwner(frameNumber + frame, PAGEFRAME_AVAILABLE);
+    }
+
+    buddyFree(frameNumber, order);
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+}
+
+uint32_t unusableFreeIndex(uint32_t order)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    struct buddyAllocatorState *BuddyAllocatorState = (struct buddyAllocatorState*)BUDDY_ALLOCATOR_STATE;
+    uint32_t freeFrames = FrameAllocatorState->freeFrames + FrameAllocatorState->zeroedFrames;
+    uint32_t usableFrames = 0;
+
+    for (uint32_t blockOrder = 0; blockOrder <= BUDDY_MAX_ORDER; blockOrder++)
+    {
+        freeFrames = freeFrames + (BuddyAllocatorState->freeBlocks[blockOrder] << blockOrder);
+
+        if (blockOrder >= order)
+        {
+            usableFrames = usableFrames + (BuddyAllocatorState->freeBlocks[blockOrder] << blockOrder);
+        }
+    }
+
+    if (freeFrames == 0)
+    {
+        return 0;
+    }
+
+    return ((freeFrames - usableFrames) * 100) / freeFrames;
+}
+
+uint32_t physicalFrames()
+{
+    struct e820Map *E820Map = (struct e820Map*)E820_MAP_LOC;
+    uint32_t totalFrames = 0;
+
+    if (E820Map->entries == 0 || E820Map->entries > E820_MAX_ENTRIES)
+    {
+        return E820_FALLBACK_MEMORY_SIZE / PAGE_SIZE;
+    }
+
+    for (uint32_t entry = 0; entry < E820Map->entries; entry++)
+    {
+        struct e820Entry *E820Entry = &E820Map->entry[entry];
+
+        // Memory above 4 GiB cannot be mapped without PAE
+        if (E820Entry->type != E820_USABLE || E820Entry->baseHigh != 0)
+        {
+            continue;
+        }
+
+        uint32_t endFrame = (E820Entry->baseLow / PAGE_SIZE) + (E820Entry->lengthLow / PAGE_SIZE);
+
+        if (E820Entry->lengthHigh != 0)
+        {
+            endFrame = PAGEFRAME_MAP_SIZE;
+        }
+
+        if (endFrame > totalFrames)
+        {
+            totalFrames = endFrame;
+        }
+    }
+
+    if (totalFrames > PAGEFRAME_MAP_SIZE)
+    {
+        totalFrames = PAGEFRAME_MAP_SIZE;
+    }
+
+    return totalFrames;
+}
+
+bool physicalFrameUsable(uint32_t frameNumber)
+{
+    struct e820Map *E820Map = (struct e820Map*)E820_MAP_LOC;
+    uint32_t frameStart = frameNumber * PAGE_SIZE;
+    bool usable = false;
+
+    if (E820Map->entries == 0 || E820Map->entries > E820_MAX_ENTRIES)
+    {
+        return frameNumber < (E820_FALLBACK_MEMORY_SIZE / PAGE_SIZE);
+    }
+
+    for (uint32_t entry = 0; entry < E820Map->entries; entry++)
+    {
+        struct e820Entry *E820Entry = &E820Map->entry[entry];
+
+        if (E820Entry->baseHigh != 0 || (E820Entry->lengthLow == 0 && E820Entry->lengthHigh == 0))
+        {
+            continue;
+        }
+
+        // The last byte, so a range ending at 4 GiB does not wrap
+        uint32_t rangeEnd = E820Entry->baseLow + (E820Entry->lengthLow - 1);
+
+        if (E820Entry->lengthHigh != 0 || rangeEnd < E820Entry->baseLow)
+        {
+            rangeEnd = 0xFFFFFFFF;
+        }
+
+        if (E820Entry->type == E820_USABLE && E820Entry->baseLow <= frameStart && rangeEnd >= (frameStart + PAGE_SIZE - 1))
+        {
+            usable = true;
+        }
+
+        // Ranges can overlap, and a reserved range wins over usable RAM
+        if (E820Entry->type != E820_USABLE && E820Entry->baseLow <= (frameStart + PAGE_SIZE - 1) && rangeEnd >= frameStart)
+        {
+            return false;
+        }
+    }
+
+    return usable;
+}
+
+uint32_t allocateKernelFrame()
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    uint32_t frameNumber = 0;
+
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    if (FrameAllocatorState->kernelFreeFrames > 0)
+    {
+        FrameAllocatorState->kernelFreeFrames--;
+        frameNumber = FrameAllocatorState->kernelFreeStack[FrameAllocatorState->kernelFreeFrames];
+        setFrameOwner(frameNumber, KERNEL_OWNED);
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    if (frameNumber != 0)
+    {
+        fillMemory((uint8_t *)(frameNumber * PAGE_SIZE), 0x0, PAGE_SIZE);
+    }
+
+    return frameNumber;
+}
+
+void freeKernelFrame(uint32_t frameNumber)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+
+    if ((frameNumber * PAGE_SIZE) < FRAME_METADATA_END || (frameNumber * PAGE_SIZE) >= KERNEL_FRAME_POOL_END)
+    {
+        panic((uint8_t *)"frame-allocator.cpp:freeKernelFrame() -> frame is not from the kernel frame pool");
+    }
+
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    setFrameOwner(frameNumber, PAGEFRAME_AVAILABLE);
+    FrameAllocatorState->kernelFreeStack[FrameAllocatorState->kernelFreeFrames] = (uint16_t)frameNumber;
+    FrameAllocatorState->kernelFreeFrames++;
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+}
+
+uint32_t allocateKernelFrames(uint32_t numberOfFrames)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    uint32_t firstFrame = 0;
+    uint32_t runLength = 0;
+
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    // The pool is small, so a first-fit scan of the page frame map finds the run
+    for (uint32_t frameNumber = (FRAME_METADATA_END / PAGE_SIZE); numberOfFrames != 0 && runLength < numberOfFrames && frameNumber < (KERNEL_FRAME_POOL_END / PAGE_SIZE); frameNumber++)
+    {
+        if (*(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber) != PAGEFRAME_AVAILABLE)
+        {
+            runLength = 0;
+            continue;
+        }
+
+        if (runLength == 0)
+        {
+            firstFrame = frameNumber;
+        }
+
+        runLength++;
+    }
+
+    if (numberOfFrames == 0 || runLength < numberOfFrames)
+    {
+        while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+        return 0;
+    }
+
+    // The run's frames can sit anywhere on the free stack, so the stack is compacted around them
+    uint32_t keptFrames = 0;
+
+    for (uint32_t stackEntry = 0; stackEntry < FrameAllocatorState->kernelFreeFrames; stackEntry++)
+    {
+        uint32_t frameNumber = FrameAllocatorState->kernelFreeStack[stackEntry];
+
+        if (frameNumber < firstFrame || frameNumber >= (firstFrame + numberOfFrames))
+        {
+            FrameAllocatorState->kernelFreeStack[keptFrames] = (uint16_t)frameNumber;
+            keptFrames++;
+        }
+    }
+
+    FrameAllocatorState->kernelFreeFrames = keptFrames;
+
+    for (uint32_t frame = 0; frame < numberOfFrames; frame++)
+    {
+        setFrameOwner(firstFrame + frame, KERNEL_OWNED);
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    fillMemory((uint8_t *)(firstFrame * PAGE_SIZE), 0x0, numberOfFrames * PAGE_SIZE);
+
+    return firstFrame;
+}
+
+void freeKernelFrames(uint32_t frameNumber, uint32_t numberOfFrames)
+{
+    for (uint32_t frame = 0; frame < numberOfFrames; frame++)
+    {
+        freeKernelFrame(frameNumber + frame);
+    }
+}
+
+void frameMetadataMapWindow(uint32_t *pageDirectory)
+{
+    // Only the kernel touches the metadata, and only through this identity mapped window once paging is on
+    installKernelLargePage(pageDirectory, FRAME_METADATA_BASE, 0);
+}
+
+void zeroFrame(uint32_t frameNumber)
+{
+    if (!(readCR0() & CR0_PAGING))
+    {
+        fillMemory((uint8_t *)(frameNumber * PAGE_SIZE), 0x0, PAGE_SIZE);
+        return;
+    }
+
+    // The kernel windows are 4 MB pages, so the window is a kernel page in the first page table of the loaded directory
+    uint32_t *pageDirectory = (uint32_t *)(readCR3() & PAGE_FRAME_MASK);
+    uint32_t *pageTable = (uint32_t *)(pageDirectory[0] & PAGE_FRAME_MASK);
+    uint32_t windowEntry = ZERO_FRAME_WINDOW / PAGE_SIZE;
+    uint32_t savedEntry = pageTable[windowEntry];
+
+    // The kernel never switches tasks in the middle of a system call, so one window is enough
+    pageTable[windowEntry] = (frameNumber * PAGE_SIZE) | PG_KERNEL_PRESENT_RW;
+    invalidatePage(ZERO_FRAME_WINDOW);
+
+    fillMemory((uint8_t *)ZERO_FRAME_WINDOW, 0x0, PAGE_SIZE);
+
+    pageTable[windowEntry] = savedEntry;
+    invalidatePage(ZERO_FRAME_WINDOW);
+}
+
+uint32_t refillZeroedFrames(uint32_t numberOfFrames)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    uint32_t framesAdded = 0;
+
+    while (framesAdded < numberOfFrames && FrameAllocatorState->zeroedFrames < ZEROED_POOL_SIZE)
+    {
+        while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+        // Taken straight from the free frame stack or the buddy lists, never from the pool being filled
+        uint32_t frameNumber = FrameAllocatorState->freeFrames > 0 ? popFreeFrame() : buddyAllocate(0);
+
+        while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+        if (frameNumber == 0)
+        {
+            break;
+        }
+
+        // The frame is off every list and still PAGEFRAME_AVAILABLE, so nothing else can hand it out while it is zeroed
+        zeroFrame(frameNumber);
+
+        while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+        FrameAllocatorState->zeroedStack[FrameAllocatorState->zeroedFrames] = (uint16_t)frameNumber;
+        FrameAllocatorState->zeroedFrames++;
+
+        while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+        framesAdded++;
+    }
+
+    return framesAdded;
+}
+
+uint32_t allocateZeroedFrame(uint32_t pid)
+{
+    struct frameAllocatorState *FrameAllocatorState = (struct frameAllocatorState*)FRAME_ALLOCATOR_STATE;
+    uint32_t frameNumber = 0;
+
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    if (FrameAllocatorState->zeroedFrames > 0)
+    {
+        FrameAllocatorState->zeroedFrames--;
+        frameNumber = FrameAllocatorState->zeroedStack[FrameAllocatorState->zeroedFrames];
+        setFrameOwner(frameNumber, (uint8_t)pid);
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PAGEFRAME_MAP_BASE)) {}
+
+    if (frameNumber != 0)
+    {
+        return frameNumber;
+    }
+
+    // An empty pool costs the same as before: a frame and a fillMemory()
+    frameNumber = allocateFrame(pid, (uint8_t *)PAGEFRAME_MAP_BASE);
+
+    if (frameNumber != 0)
+    {
+        zeroFrame(frameNumber);
+    }
+
+    return frameNumber;
+}
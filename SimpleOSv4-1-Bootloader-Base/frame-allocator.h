@@ -2,36 +2,246 @@
 // This file is licensed under the MIT License. See LICENSE for details.
 
 
-/** Creates the initial structure of the page frame map.
+#include "constants.h"
+/** One entry of the shared page table. It names the frame that holds a clean page of an executable, so other processes running the same file can map it instead of loading their own copy. */
+struct sharedPage
+{
+    /** The inode number of the executable. 0 marks a free entry. */
+    uint32_t inodeNumber;
+    /** The i_mtime of the executable when the page was loaded, so a rewritten file is never matched. */
+    uint32_t modifiedTime;
+    /** The virtual address of the page. */
+    uint32_t virtualAddress;
+    /** The frame holding the page. */
+    uint32_t frameNumber;
+};
+
+/** One range of the BIOS E820 memory map. */
+struct e820Entry
+{
+    uint32_t baseLow;
+    uint32_t baseHigh;
+    uint32_t lengthLow;
+    uint32_t lengthHigh;
+    /** E820_USABLE for RAM the OS may use. Every other type is reserved. */
+    uint32_t type;
+    uint32_t extendedAttributes;
+};
+
+/** The E820 memory map that bootloader stage 1 collects at E820_MAP_LOC before it leaves real mode. */
+struct e820Map
+{
+    /** The number of entries the BIOS returned. 0 if it does not support E820. */
+    uint32_t entries;
+    struct e820Entry entry[E820_MAX_ENTRIES];
+};
+
+/** The bookkeeping that makes frame allocation and the frame statistics constant time. It lives at FRAME_ALLOCATOR_STATE, and the owner of each frame stays in the byte map at PAGEFRAME_MAP_BASE. */
+struct frameAllocatorState
+{
+    /** The number of frames the page frame map covers, from physicalFrames(). */
+    uint32_t totalFrames;
+    /** The number of frames on freeStack[]. */
+    uint32_t freeFrames;
+    /** The number of frames whose owner is not PAGEFRAME_AVAILABLE. */
+    uint32_t framesUsed;
+    /** The number of private frames each pid owns. Index 0 is unused. */
+    uint32_t processFrames[MAX_PROCESSES + 1];
+    /** The available frames. The next frame handed out is freeStack[freeFrames - 1]. */
+    uint16_t freeStack[FREE_STACK_HIGH_WATER];
+    /** The number of frames on zeroedStack[]. */
+    uint32_t zeroedFrames;
+    /** Available frames that already read as zero, filled by refillZeroedFrames() while the system waits. They stay PAGEFRAME_AVAILABLE, so they count as free. */
+    uint16_t zeroedStack[ZEROED_POOL_SIZE];
+    /** The number of frames on kernelFreeStack[]. */
+    uint32_t kernelFreeFrames;
+    /** The available frames between FRAME_METADATA_END and KERNEL_FRAME_POOL_END. The kernel can always reach them, so page directories, page tables and task structures come from here. */
+    uint16_t kernelFreeStack[KERNEL_FRAME_POOL_FRAMES];
+};
+
+/** The binary buddy allocator behind the free frame stack. Free blocks of 2^order frames, order 0 to BUDDY_MAX_ORDER, sit on doubly linked lists threaded through the per-frame arrays. It lives at BUDDY_ALLOCATOR_STATE. */
+struct buddyAllocatorState
+{
+    /** The first frame of each order's free list, or BUDDY_NO_FRAME. */
+    uint32_t freeListHead[BUDDY_MAX_ORDER + 1];
+    /** The number of free blocks of each order. */
+    uint32_t freeBlocks[BUDDY_MAX_ORDER + 1];
+    /** How many times a block was split to serve a smaller order. */
+    uint32_t splits;
+    /** How many times a freed block merged with its buddy. */
+    uint32_t merges;
+    /** The next block on the same list, for frames that head a free block. */
+    uint32_t next[PAGEFRAME_MAP_SIZE];
+    /** The previous block on the same list, for frames that head a free block. */
+    uint32_t previous[PAGEFRAME_MAP_SIZE];
+    /** The order of the free block a frame heads, or BUDDY_NOT_FREE. */
+    uint8_t freeOrder[PAGEFRAME_MAP_SIZE];
+};
+
+/** Creates the initial structure of the page frame map. initializeFrameAllocator() builds the free frame stack from it afterwards.
  * \param pageFrameMap The pointer to the beginning of the map.
- * \param numberOfFrame How many frames to create. 
+ * \param numberOfFrame How many frames to create. kInit() passes physicalFrames().
  */
 void createPageFrameMap(uint8_t *pageFrameMap, uint32_t numberOfFrames);
 
-/** Allocates a frame in the page frame map and returns the frame number.
+/** Allocates a frame in the page frame map and returns the frame number. popFreeFrame() and setFrameOwner() do this in constant time.
  * \param pid The pid who is requesting the frame.
  * \param pageFrameMap The pointer to the beginning of the map.
  */
 uint32_t allocateFrame(uint32_t pid, uint8_t *pageFrameMap);
 
-/** Frees a frame in the page frame map.
+/** Frees a frame in the page frame map. A shared frame only loses one reference, and is freed when the last one is gone.
  * \param frameNumber The frame to free.
  */
 void freeFrame(uint32_t frameNumber);
 
-/** Frees all frames for a particular pid.
+/** Frees all frames for a particular pid. Each frame goes through setFrameOwner() and pushFreeFrame() like in freeFrame().
  * \param pid The pid associated with the frames we are want freed.
  * \param pageFrameMap The pointer to the beginning of the map.
  */
 void freeAllFrames(uint32_t pid, uint8_t *pageFrameMap);
 
-/** Counts the number of frames used by a particular process. Returns the number of frames used by that pid.
+/** Counts the number of frames used by a particular process. Returns the number of frames used by that pid. The count is kept by setFrameOwner(), so no frames are walked.
  * \param pid The pid you are interested in.
  * \param pageFrameMap The pointer to the beginning of the map.
  */
 uint32_t processFramesUsed(uint32_t pid, uint8_t *pageFrameMap);
 
-/** Counts the total frames used in the system. Returns that value.
+/** Counts the total frames used in the system. Returns that value. The count is kept by setFrameOwner(), so no frames are walked.
+ * \param pageFrameMap The pointer to the beginning of the map.
+ */
+uint32_t totalFramesUsed(uint8_t *pageFrameMap);
+
+/** Adds a page table reference to a frame and marks it PAGEFRAME_SHARED, so freeAllFrames() leaves it alone and freeFrame() only drops a reference.
+ * \param frameNumber The frame being mapped into another page table.
+ */
+void referenceFrame(uint32_t frameNumber);
+
+/** Returns the number of page tables that map a shared frame. Private frames return 0. */
+uint32_t frameReferences(uint32_t frameNumber);
+
+/** Turns a shared frame with a single reference back into a private frame of the pid, and drops it from the shared page table. Used when the last sharer writes to a copy-on-write page.
+ * \param pid The pid that now owns the frame.
+ * \param frameNumber The frame.
+ */
+void claimSharedFrame(uint32_t pid, uint32_t frameNumber);
+
+/** Returns the frame holding a page of an executable, or 0 if no process has it loaded.
+ * \param inodeNumber The inode number of the executable.
+ * \param modifiedTime The i_mtime of the executable.
+ * \param virtualAddress The virtual address of the page.
+ */
+uint32_t findSharedPage(uint32_t inodeNumber, uint32_t modifiedTime, uint32_t virtualAddress);
+
+/** Records a clean page of an executable in the shared page table. Returns false if the table is full, in which case the page stays private.
+ * \param inodeNumber The inode number of the executable.
+ * \param modifiedTime The i_mtime of the executable.
+ * \param virtualAddress The virtual address of the page.
+ * \param frameNumber The frame holding the page.
+ */
+bool insertSharedPage(uint32_t inodeNumber, uint32_t modifiedTime, uint32_t virtualAddress, uint32_t frameNumber);
+
+/** Removes a frame from the shared page table.
+ * \param frameNumber The frame to remove.
+ */
+void removeSharedPage(uint32_t frameNumber);
+
+/** Builds the buddy free lists and the frame counters from the owner bytes that createPageFrameMap() wrote. Frames that are not usable RAM in the E820 map, the video and BIOS area, the RAM disk and the frame metadata itself are marked PAGEFRAME_RESERVED and never counted. Called once by kInit(), before paging is on. Frame 0 is never handed out, since 0 means no frame.
  * \param pageFrameMap The pointer to the beginning of the map.
  */
-uint32_t totalFramesUsed(uint8_t *pageFrameMap);
\ No newline at end of file
+void initializeFrameAllocator(uint8_t *pageFrameMap);
+
+/** Changes the owner of a frame and keeps the used frame counters in step. Every owner change goes through here. Call it with the PAGEFRAME_MAP_BASE lock held.
+ * \param frameNumber The frame.
+ * \param owner A pid, PAGEFRAME_SHARED, KERNEL_OWNED or PAGEFRAME_AVAILABLE.
+ */
+void setFrameOwner(uint32_t frameNumber, uint8_t owner);
+
+/** Puts an available frame on the free frame stack, or back on the buddy lists once the stack holds FREE_STACK_HIGH_WATER frames. Call it with the PAGEFRAME_MAP_BASE lock held.
+ * \param frameNumber The frame.
+ */
+void pushFreeFrame(uint32_t frameNumber);
+
+/** Takes a frame off the free frame stack, or splits one off the buddy lists when the stack is empty, or takes a zeroed frame when both are empty. Returns 0 if no frame is available. The frame is still PAGEFRAME_AVAILABLE until setFrameOwner() is called. Call it with the PAGEFRAME_MAP_BASE lock held. */
+uint32_t popFreeFrame();
+
+/** Takes a free block of exactly 2^order frames off the buddy lists, splitting a larger block if needed. Returns its first frame, or 0. Call it with the PAGEFRAME_MAP_BASE lock held.
+ * \param order The block size as a power of two, up to BUDDY_MAX_ORDER.
+ */
+uint32_t buddyAllocate(uint32_t order);
+
+/** Returns a block to the buddy lists, merging it with its buddy for as long as the buddy is free too. Call it with the PAGEFRAME_MAP_BASE lock held.
+ * \param frameNumber The first frame of the block, aligned to 2^order frames.
+ * \param order The block size as a power of two.
+ */
+void buddyFree(uint32_t frameNumber, uint32_t order);
+
+/** Adds a free block to the front of its order's list. */
+void buddyListInsert(uint32_t frameNumber, uint32_t order);
+
+/** Takes a free block off its order's list. */
+void buddyListRemove(uint32_t frameNumber);
+
+/** Allocates 2^order physically contiguous frames aligned to their size, for DMA buffers and large mappings. Returns the first frame, or 0 if no block that large is free. Order 0 callers should keep using allocateFrame().
+ * \param pid The pid that owns the frames.
+ * \param order The block size as a power of two, up to BUDDY_MAX_ORDER.
+ */
+uint32_t allocateContiguousFrames(uint32_t pid, uint32_t order);
+
+/** Frees a block from allocateContiguousFrames().
+ * \param frameNumber The first frame of the block.
+ * \param order The order it was allocated with.
+ */
+void freeContiguousFrames(uint32_t frameNumber, uint32_t order);
+
+/** Returns the percentage of free frames that cannot serve an allocation of the order, because they sit in smaller blocks. 0 means no fragmentation at that order.
+ * \param order The block size as a power of two.
+ */
+uint32_t unusableFreeIndex(uint32_t order);
+
+/** Returns how many frames the page frame map covers: up to the end of the highest usable E820 range, at most PAGEFRAME_MAP_SIZE. Without an E820 map it assumes E820_FALLBACK_MEMORY_SIZE. */
+uint32_t physicalFrames();
+
+/** Returns true if the E820 map lists the whole frame as usable RAM and no reserved range overlaps it.
+ * \param frameNumber The frame to check.
+ */
+bool physicalFrameUsable(uint32_t frameNumber);
+
+/** Takes a frame from the kernel frame pool, zeroes it and records it as KERNEL_OWNED. Its physical address is also its kernel address. Returns 0 if the pool is empty. */
+uint32_t allocateKernelFrame();
+
+/** Returns a frame from allocateKernelFrame() to the kernel frame pool.
+ * \param frameNumber The frame.
+ */
+void freeKernelFrame(uint32_t frameNumber);
+
+/** Takes a run of physically contiguous frames from the kernel frame pool, zeroes them and records them as KERNEL_OWNED, for kernel objects larger than a page. Returns the first frame, or 0 if no run that long is free.
+ * \param numberOfFrames The number of frames.
+ */
+uint32_t allocateKernelFrames(uint32_t numberOfFrames);
+
+/** Returns a run from allocateKernelFrames() to the kernel frame pool.
+ * \param frameNumber The first frame of the run.
+ * \param numberOfFrames The number of frames it was allocated with.
+ */
+void freeKernelFrames(uint32_t frameNumber, uint32_t numberOfFrames);
+
+/** Adds the 4 MB page that identity maps the frame metadata and the kernel frame pool (FRAME_METADATA_BASE to KERNEL_FRAME_POOL_END) to a page directory. createPageDirectory() calls it, so the frame allocator works in every address space.
+ * \param pageDirectory The page directory to add the window to.
+ */
+void frameMetadataMapWindow(uint32_t *pageDirectory);
+
+/** Zeroes a frame through the ZERO_FRAME_WINDOW page of the kernel region, since frames outside the kernel windows have no kernel address. Before paging is on the physical address is written directly.
+ * \param frameNumber The frame.
+ */
+void zeroFrame(uint32_t frameNumber);
+
+/** Moves free frames onto the zeroed frame pool, zeroing each one, until the pool holds ZEROED_POOL_SIZE frames. Called where the kernel would otherwise spin, so the zeroing is off the allocation path. Returns the number of frames added.
+ * \param numberOfFrames The most frames to zero in this call.
+ */
+uint32_t refillZeroedFrames(uint32_t numberOfFrames);
+
+/** Allocates a frame that already reads as zero, so the caller skips its own fillMemory(). Takes it from the zeroed frame pool, or zeroes a frame from allocateFrame() when the pool is empty. Returns 0 if no frame is available.
+ * \param pid The pid who is requesting the frame.
+ */
+uint32_t allocateZeroedFrame(uint32_t pid);
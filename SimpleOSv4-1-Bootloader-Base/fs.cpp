@@ -8,14 +8,306 @@
 #include "constants.h"
 #include "x86.h"
 #include "vm.h"
+#include "kernel.h"
 #include "file.h"
+#include "block-device.h"
+#include "exceptions.h"
+#include "frame-allocator.h"
 
-void diskStatusCheck()
+uint16_t diskBasePort(uint32_t drive)
+{
+    // Drives 0 and 1 are the primary channel, drives 2 and 3 the secondary channel
+    if (drive >= ATA_SECONDARY_MASTER)
+    {
+        return SECONDARY_ATA_BASE_PORT;
+    }
+
+    return PRIMARY_ATA_BASE_PORT;
+}
+
+void diskSelectDrive(uint32_t drive, uint8_t driveHeadValue)
+{
+    uint16_t basePort = diskBasePort(drive);
+
+    outputIOPort(basePort + ATA_DRIVE_HEAD_OFFSET, (driveHeadValue | ((drive & 1) ? ATA_DRIVE_SLAVE : 0)));
+
+    // Each status read takes about 100ns, and the drive needs 400ns to respond to a new selection
+    for (uint32_t delay = 0; delay < 4; delay++)
+    {
+        inputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET);
+    }
+}
+
+void diskChannelIdleCheck(uint32_t drive)
+{
+    // The drive/head register must not change while either drive on the channel is still busy with a command
+    while (inputIOPort(diskBasePort(drive) + ATA_COMMAND_STATUS_OFFSET) & ATA_STATUS_BUSY) {}
+}
+
+void diskStatusCheck(uint32_t drive)
 {
     //checks disk status and loops if not ready
-    while ( ((inputIOPort(PRIMARY_ATA_COMMAND_STATUS_REGISTER) & 0xC0) != 0x40) ) {}   
+    while ( ((inputIOPort(diskBasePort(drive) + ATA_COMMAND_STATUS_OFFSET) & (ATA_STATUS_BUSY | ATA_STATUS_READY)) != ATA_STATUS_READY) ) {}   
+}
+
+bool diskDataRequestCheck(uint32_t drive)
+{
+    uint8_t status;
+
+    //loops until the drive is no longer busy and is ready to move a sector of data, or has given up on the command
+    while (((status = inputIOPort(diskBasePort(drive) + ATA_COMMAND_STATUS_OFFSET)) & (ATA_STATUS_BUSY | ATA_STATUS_DATA_REQUEST)) != ATA_STATUS_DATA_REQUEST)
+    {
+        if (!(status & ATA_STATUS_BUSY) && (status & (ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool diskSupportsLba48(uint32_t drive)
+{
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    // The first transfer to a drive identifies it, and diskIdentify() records the answer
+    if (KernelConfiguration->ataAddressing[drive] == ATA_ADDRESSING_UNKNOWN)
+    {
+        uint16_t identifyData[SECTOR_SIZE / 2];
+        diskIdentify(drive, identifyData);
+    }
+
+    return KernelConfiguration->ataAddressing[drive] == ATA_ADDRESSING_LBA48;
+}
+
+void diskIssueCommand(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t lba28Command, uint8_t lba48Command)
+{
+    uint16_t basePort = diskBasePort(drive);
+
+    // LBA28 covers the first 128 GB and up to 256 sectors per command. Anything beyond either limit needs LBA48, which the callers only ask of drives that have it.
+    bool useLba28 = ((sectorNumber + numberOfSectors) <= ATA_LBA28_MAX_SECTORS && numberOfSectors <= ATA_LBA28_MAX_SECTORS_PER_COMMAND) || !diskSupportsLba48(drive);
+
+    // The drive/head register is shared by both drives on a channel. The channel must be idle before the selection, and the selected drive ready after it.
+    diskChannelIdleCheck(drive);
+
+    if (useLba28)
+    {
+        diskSelectDrive(drive, (ATA_DRIVE_MASTER_LBA28 | ((sectorNumber >> 24) & 0x0F)));
+    }
+    else
+    {
+        diskSelectDrive(drive, ATA_DRIVE_MASTER_LBA48);
+    }
+
+    diskStatusCheck(drive);
+
+    if (useLba28)
+    {
+        outputIOPort(basePort + ATA_SECTOR_COUNT_OFFSET, (uint8_t)numberOfSectors); // 0 means 256 sectors
+        outputIOPort(basePort + ATA_LBA_LOW_OFFSET, (uint8_t)sectorNumber);
+        outputIOPort(basePort + ATA_LBA_MID_OFFSET, (uint8_t)(sectorNumber >> 8));
+        outputIOPort(basePort + ATA_LBA_HIGH_OFFSET, (uint8_t)(sectorNumber >> 16));
+        outputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET, lba28Command);
+    }
+    else
+    {
+        // LBA48 registers are two bytes deep. The high order bytes are written first, then the low order bytes.
+        // Bits 32-47 of the LBA are always zero since the sector number is 32 bits.
+        outputIOPort(basePort + ATA_SECTOR_COUNT_OFFSET, (uint8_t)(numberOfSectors >> 8)); // 0 means 65536 sectors
+        outputIOPort(basePort + ATA_LBA_LOW_OFFSET, (uint8_t)(sectorNumber >> 24));
+        outputIOPort(basePort + ATA_LBA_MID_OFFSET, 0);
+        outputIOPort(basePort + ATA_LBA_HIGH_OFFSET, 0);
+        outputIOPort(basePort + ATA_SECTOR_COUNT_OFFSET, (uint8_t)numberOfSectors);
+        outputIOPort(basePort + ATA_LBA_LOW_OFFSET, (uint8_t)sectorNumber);
+        outputIOPort(basePort + ATA_LBA_MID_OFFSET, (uint8_t)(sectorNumber >> 8));
+        outputIOPort(basePort + ATA_LBA_HIGH_OFFSET, (uint8_t)(sectorNumber >> 16));
+        outputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET, lba48Command);
+    }
+}
+
+bool diskReadData(uint32_t drive, uint32_t numberOfSectors, uint8_t *destinationMemory)
+{
+    for (uint32_t sector = 0; sector < numberOfSectors; sector++)
+    {
+        if (!diskDataRequestCheck(drive))
+        {
+            return false;
+        }
+
+        ioPortWordToMem(diskBasePort(drive) + ATA_DATA_OFFSET, destinationMemory, SECTOR_SIZE / 2);
+        destinationMemory = destinationMemory + SECTOR_SIZE;
+    }
+
+    return true;
+}
+
+bool diskWriteData(uint32_t drive, uint32_t numberOfSectors, uint8_t *sourceMemory)
+{
+    for (uint32_t sector = 0; sector < numberOfSectors; sector++)
+    {
+        if (!diskDataRequestCheck(drive))
+        {
+            return false;
+        }
+
+        memToIoPortWord(diskBasePort(drive) + ATA_DATA_OFFSET, sourceMemory, SECTOR_SIZE / 2);
+        sourceMemory = sourceMemory + SECTOR_SIZE;
+    }
+
+    return true;
+}
+
+bool diskReadSectors(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *destinationMemory)
+{
+    // Drives without LBA48 take at most 256 sectors per LBA28 command
+    uint32_t maxSectorsPerCommand = ATA_LBA28_MAX_SECTORS_PER_COMMAND;
+
+    if (diskSupportsLba48(drive))
+    {
+        maxSectorsPerCommand = ATA_LBA48_MAX_SECTORS_PER_COMMAND;
+    }
+
+    while (numberOfSectors > 0)
+    {
+        uint32_t sectorsThisCommand = numberOfSectors;
+
+        if (sectorsThisCommand > maxSectorsPerCommand)
+        {
+            sectorsThisCommand = maxSectorsPerCommand;
+        }
+
+        diskIssueCommand(drive, sectorNumber, sectorsThisCommand, ATA_READ, ATA_READ_EXT);
+
+        if (!diskReadData(drive, sectorsThisCommand, destinationMemory))
+        {
+            return false;
+        }
+
+        destinationMemory = destinationMemory + (sectorsThisCommand * SECTOR_SIZE);
+        sectorNumber = sectorNumber + sectorsThisCommand;
+        numberOfSectors = numberOfSectors - sectorsThisCommand;
+    }
+
+    return true;
 }
 
+bool diskWriteSectors(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *sourceMemory)
+{
+    // Drives without LBA48 take at most 256 sectors per LBA28 command
+    uint32_t maxSectorsPerCommand = ATA_LBA28_MAX_SECTORS_PER_COMMAND;
+
+    if (diskSupportsLba48(drive))
+    {
+        maxSectorsPerCommand = ATA_LBA48_MAX_SECTORS_PER_COMMAND;
+    }
+
+    while (numberOfSectors > 0)
+    {
+        uint32_t sectorsThisCommand = numberOfSectors;
+
+        if (sectorsThisCommand > maxSectorsPerCommand)
+        {
+            sectorsThisCommand = maxSectorsPerCommand;
+        }
+
+        diskIssueCommand(drive, sectorNumber, sectorsThisCommand, ATA_WRITE, ATA_WRITE_EXT);
+
+        if (!diskWriteData(drive, sectorsThisCommand, sourceMemory))
+        {
+            return false;
+        }
+
+        sourceMemory = sourceMemory + (sectorsThisCommand * SECTOR_SIZE);
+        sectorNumber = sectorNumber + sectorsThisCommand;
+        numberOfSectors = numberOfSectors - sectorsThisCommand;
+    }
+
+    // Make sure the data leaves the drive's write cache before we report success
+    diskFlushCache(drive);
+
+    return true;
+}
+
+void diskFlushCache(uint32_t drive)
+{
+    diskChannelIdleCheck(drive);
+    diskSelectDrive(drive, ATA_DRIVE_MASTER_LBA28);
+    diskStatusCheck(drive);
+    outputIOPort(diskBasePort(drive) + ATA_COMMAND_STATUS_OFFSET, ATA_CACHE_FLUSH);
+    diskStatusCheck(drive);
+}
+
+bool diskIdentify(uint32_t drive, uint16_t *identifyData)
+{
+    uint16_t basePort = diskBasePort(drive);
+
+    diskSelectDrive(drive, ATA_DRIVE_MASTER_LBA28);
+
+    // A floating bus reads 0xFF and an empty position reads 0
+    uint8_t status = inputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET);
+
+    if (status == 0x00 || status == 0xFF)
+    {
+        return false;
+    }
+
+    outputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET, ATA_IDENTIFY);
+
+    while ((status = inputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET)) & ATA_STATUS_BUSY) {}
+
+    // ATAPI and SATA packet devices abort IDENTIFY DEVICE and leave a signature in the LBA registers
+    if (status == 0x00 || inputIOPort(basePort + ATA_LBA_MID_OFFSET) != 0 || inputIOPort(basePort + ATA_LBA_HIGH_OFFSET) != 0)
+    {
+        return false;
+    }
+
+    while (!((status = inputIOPort(basePort + ATA_COMMAND_STATUS_OFFSET)) & (ATA_STATUS_DATA_REQUEST | ATA_STATUS_ERROR))) {}
+
+    if (status & ATA_STATUS_ERROR)
+    {
+        return false;
+    }
+
+    ioPortWordToMem(basePort + ATA_DATA_OFFSET, (uint8_t *)identifyData, SECTOR_SIZE / 2);
+
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+    KernelConfiguration->ataAddressing[drive] = ATA_ADDRESSING_LBA28;
+
+    if (identifyData[ATA_IDENTIFY_COMMAND_SETS] & ATA_IDENTIFY_LBA48_SUPPORTED)
+    {
+        KernelConfiguration->ataAddressing[drive] = ATA_ADDRESSING_LBA48;
+    }
+
+    return true;
+}
+
+uint32_t diskTotalSectors(uint32_t drive)
+{
+    uint16_t identifyData[SECTOR_SIZE / 2];
+
+    if (!diskIdentify(drive, identifyData))
+    {
+        return 0;
+    }
+
+    return identifyTotalSectors(identifyData);
+}
+
+uint32_t identifyTotalSectors(uint16_t *identifyData)
+{
+    if (!(identifyData[ATA_IDENTIFY_COMMAND_SETS] & ATA_IDENTIFY_LBA48_SUPPORTED))
+    {
+        return identifyData[ATA_IDENTIFY_LBA28_SECTORS] | (identifyData[ATA_IDENTIFY_LBA28_SECTORS + 1] << 16);
+    }
+
+    // Our sector numbers are 32 bits, so anything past 2 TB is out of reach
+    if (identifyData[ATA_IDENTIFY_LBA48_SECTORS + 2] != 0 || identifyData[ATA_IDENTIFY_LBA48_SECTORS + 3] != 0)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    return identifyData[ATA_IDENTIFY_LBA48_SECTORS] | (identifyData[ATA_IDENTIFY_LBA48_SECTORS + 1] << 16);
+}
 
 void diskReadSector(uint32_t sectorNumber, uint8_t *destinationMemory)
 {
@@ -31,18 +323,24 @@ void diskWriteSector(uint32_t sectorNumber, uint8_t *sourceMemory)
 
 }
 
+void readBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    currentBlockDevice()->readBlocks(blockNumber, numberOfBlocks, destinationMemory);
+}
+
+void writeBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    currentBlockDevice()->writeBlocks(blockNumber, numberOfBlocks, sourceMemory);
+}
+
 void readBlock(uint32_t blockNumber, uint8_t *destinationMemory)
 {
-    uint32_t sectorStart = (blockNumber * 2) + EXT2_SECTOR_START;
-    diskReadSector(sectorStart, destinationMemory);
-    diskReadSector(sectorStart + 1, destinationMemory + SECTOR_SIZE);
+    readBlocks(blockNumber, 1, destinationMemory);
 }
 
 void writeBlock(uint32_t blockNumber, uint8_t *sourceMemory)
 {
-    uint32_t sectorStart = (blockNumber * 2) + EXT2_SECTOR_START;
-    diskWriteSector(sectorStart, sourceMemory);
-    diskWriteSector(sectorStart + 1, sourceMemory + SECTOR_SIZE);
+    writeBlocks(blockNumber, 1, sourceMemory);
 }
 
 uint32_t allocateFreeBlock()
@@ -198,21 +496,16 @@ void deleteFile(uint8_t *fileName, uint32_t currentPid)
         // File not found
         return;
     }
+    execCacheInvalidate(returnInodeofFileName(fileName));
     freeAllBlocks((struct inode *)inodePage);
 
     // Load all inodes of a directory up to max number of files per directory. This requires 16KB of memory.
-    for (uint32_t blocksOfInodes=0; blocksOfInodes < (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK); blocksOfInodes++)
-    {
-        readBlock(BlockGroupDescriptor->bgd_starting_block_of_inode_table + blocksOfInodes, (uint8_t *)(uint32_t)EXT2_TEMP_INODE_STRUCTS + (BLOCK_SIZE * blocksOfInodes));
-    }
+    readBlocks(BlockGroupDescriptor->bgd_starting_block_of_inode_table, (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK), (uint8_t *)EXT2_TEMP_INODE_STRUCTS);
 
     // Zero out the inode
     fillMemory((EXT2_TEMP_INODE_STRUCTS + ((returnInodeofFileName(fileName)-1) * INODE_SIZE)), 0x0, INODE_SIZE);
 
-    for (uint32_t blocksOfInodes=0; blocksOfInodes < (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK); blocksOfInodes++)
-    {
-        writeBlock(BlockGroupDescriptor->bgd_starting_block_of_inode_table + blocksOfInodes, (uint8_t *)(uint32_t)EXT2_TEMP_INODE_STRUCTS + (BLOCK_SIZE * blocksOfInodes));
-    }
+    writeBlocks(BlockGroupDescriptor->bgd_starting_block_of_inode_table, (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK), (uint8_t *)EXT2_TEMP_INODE_STRUCTS);
 
     deleteDirectoryEntry(fileName);
     freePage(currentPid, inodePage);
@@ -311,13 +604,13 @@ void deleteDirectoryEntry(uint8_t *fileName)
             if (DirectoryEntry->recLength > 255)
             {
                 fillMemory(savedDirectoryEntry, 0x0, savedDirectoryEntryRecLength);
-                memoryCopy((uint8_t *)(savedDirectoryEntry + savedDirectoryEntryRecLength), savedDirectoryEntry, (BLOCK_SIZE *3)/2);
+                memoryMove(savedDirectoryEntry, (uint8_t *)(savedDirectoryEntry + savedDirectoryEntryRecLength), ((uint32_t)KERNEL_TEMP_INODE_LOC + BLOCK_SIZE) - ((uint32_t)savedDirectoryEntry + savedDirectoryEntryRecLength));
                 *(uint16_t*)(previousDirectoryEntry + 4) = (uint16_t)0x100; //make it the last entry in the directory
             }
             else
             {
                 fillMemory(savedDirectoryEntry, 0x0, savedDirectoryEntryRecLength);
-                memoryCopy((uint8_t *)(savedDirectoryEntry + savedDirectoryEntryRecLength), savedDirectoryEntry, (BLOCK_SIZE *3)/2);
+                memoryMove(savedDirectoryEntry, (uint8_t *)(savedDirectoryEntry + savedDirectoryEntryRecLength), ((uint32_t)KERNEL_TEMP_INODE_LOC + BLOCK_SIZE) - ((uint32_t)savedDirectoryEntry + savedDirectoryEntryRecLength));
             }
             
             break;
@@ -337,7 +630,7 @@ void deleteDirectoryEntry(uint8_t *fileName)
 
 void createFile(uint8_t *fileName, uint32_t currentPid, uint32_t fileDescriptor)
 {
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t taskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *Task = (struct task*)taskStructLocation;
     
     fillMemory((uint8_t *)KERNEL_TEMP_INODE_LOC, 0x0, PAGE_SIZE);
@@ -376,27 +669,18 @@ void createFile(uint8_t *fileName, uint32_t currentPid, uint32_t fileDescriptor)
 void writeInodeEntry(uint32_t inodeEntry, uint16_t mode, struct openFileTableEntry *openFile)
 {
     struct blockGroupDescriptor *BlockGroupDescriptor = (blockGroupDescriptor*)(BLOCK_GROUP_DESCRIPTOR_TABLE);
-    uint32_t blocksOfInodes = 0;
-
-    while(blocksOfInodes < (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK))
-    {
-        readBlock(BlockGroupDescriptor->bgd_starting_block_of_inode_table + blocksOfInodes, (uint8_t *)(int)EXT2_TEMP_INODE_STRUCTS + (BLOCK_SIZE * blocksOfInodes));
-        blocksOfInodes++;
-    }
+    readBlocks(BlockGroupDescriptor->bgd_starting_block_of_inode_table, (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK), (uint8_t *)EXT2_TEMP_INODE_STRUCTS);
 
     struct inode *Inode = (struct inode*)(EXT2_TEMP_INODE_STRUCTS + (INODE_SIZE * (inodeEntry - 1)));
 
     Inode->i_mode = mode;
 
-    writeBufferToDisk(openFile, inodeEntry);
+    // Running processes keep the pages they have, but the next exec must see the new contents
+    execCacheInvalidate(inodeEntry);
 
-    blocksOfInodes = 0;
+    writeBufferToDisk(openFile, inodeEntry);
 
-    while(blocksOfInodes < (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK))
-    {
-        writeBlock(BlockGroupDescriptor->bgd_starting_block_of_inode_table + blocksOfInodes, (uint8_t *)(int)EXT2_TEMP_INODE_STRUCTS + (BLOCK_SIZE * blocksOfInodes));
-        blocksOfInodes++;
-    }
+    writeBlocks(BlockGroupDescriptor->bgd_starting_block_of_inode_table, (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK), (uint8_t *)EXT2_TEMP_INODE_STRUCTS);
 
 }
 
@@ -453,6 +737,469 @@ void loadElfFile(uint8_t *elfHeaderLocation)
 
 }
 
+uint32_t inodeBlockNumber(struct inode *Inode, uint32_t fileBlock, bool *indirectBlockLoaded)
+{
+    if (fileBlock < EXT2_NUMBER_OF_DIRECT_BLOCKS)
+    {
+        return Inode->i_block[fileBlock];
+    }
+
+    if ((fileBlock - EXT2_NUMBER_OF_DIRECT_BLOCKS) >= (BLOCK_SIZE / sizeof(uint32_t)))
+    {
+        panic((uint8_t *)"fs.cpp:inodeBlockNumber() -> only direct and singly indirect blocks are supported");
+    }
+
+    if (Inode->i_block[EXT2_FIRST_INDIRECT_BLOCK] == 0)
+    {
+        return 0;
+    }
+
+    // The caller keeps the flag so the indirect block is read once per transfer instead of once per block
+    if (!*indirectBlockLoaded)
+    {
+        readBlock(Inode->i_block[EXT2_FIRST_INDIRECT_BLOCK], EXT2_INDIRECT_BLOCK);
+        *indirectBlockLoaded = true;
+    }
+
+    return ((uint32_t *)EXT2_INDIRECT_BLOCK)[fileBlock - EXT2_NUMBER_OF_DIRECT_BLOCKS];
+}
+
+void readFileRange(struct inode *Inode, uint32_t fileOffset, uint32_t numberOfBytes, uint8_t *destinationMemory)
+{
+    bool indirectBlockLoaded = false;
+
+    // Any demand page fault on the destination has to happen now, before the EXT2 scratch blocks are in use
+    touchPages(destinationMemory, numberOfBytes);
+
+    while (numberOfBytes > 0)
+    {
+        uint32_t fileBlock = fileOffset / BLOCK_SIZE;
+        uint32_t offsetInBlock = fileOffset % BLOCK_SIZE;
+        uint32_t diskBlock = inodeBlockNumber(Inode, fileBlock, &indirectBlockLoaded);
+        uint32_t bytesThisPass;
+
+        if (offsetInBlock != 0 || numberOfBytes < BLOCK_SIZE)
+        {
+            // Partial blocks go through a kernel buffer so nothing outside the range is overwritten
+            bytesThisPass = BLOCK_SIZE - offsetInBlock;
+
+            if (bytesThisPass > numberOfBytes)
+            {
+                bytesThisPass = numberOfBytes;
+            }
+
+            if (diskBlock == 0)
+            {
+                fillMemory(destinationMemory, 0x0, bytesThisPass);
+            }
+            else
+            {
+                readBlock(diskBlock, EXT2_PARTIAL_BLOCK_LOC);
+                bytecpy(destinationMemory, (EXT2_PARTIAL_BLOCK_LOC + offsetInBlock), bytesThisPass);
+            }
+        }
+        else if (diskBlock == 0)
+        {
+            // A hole in a sparse file reads back as zeros
+            bytesThisPass = BLOCK_SIZE;
+            fillMemory(destinationMemory, 0x0, BLOCK_SIZE);
+        }
+        else
+        {
+            // Whole blocks that are next to each other on disk go out as one request
+            uint32_t numberOfBlocks = 1;
+
+            while (((numberOfBlocks + 1) * BLOCK_SIZE) <= numberOfBytes && inodeBlockNumber(Inode, fileBlock + numberOfBlocks, &indirectBlockLoaded) == (diskBlock + numberOfBlocks))
+            {
+                numberOfBlocks++;
+            }
+
+            bytesThisPass = numberOfBlocks * BLOCK_SIZE;
+            readBlocks(diskBlock, numberOfBlocks, destinationMemory);
+        }
+
+        destinationMemory = destinationMemory + bytesThisPass;
+        fileOffset = fileOffset + bytesThisPass;
+        numberOfBytes = numberOfBytes - bytesThisPass;
+    }
+}
+
+bool readElfHeaders(struct inode *Inode)
+{
+    struct elfHeader *ELFHeader = (struct elfHeader*)ELF_HEADER_BUFFER;
+
+    if (Inode->i_size < sizeof(struct elfHeader))
+    {
+        return false;
+    }
+
+    // The ELF header and the program headers sit at the start of the file, so the first block has everything we need
+    fillMemory((uint8_t *)ELF_HEADER_BUFFER, 0x0, BLOCK_SIZE);
+    readFileRange(Inode, 0, ((Inode->i_size < BLOCK_SIZE) ? Inode->i_size : BLOCK_SIZE), (uint8_t *)ELF_HEADER_BUFFER);
+
+    if (*(uint32_t *)ELF_HEADER_BUFFER != MAGIC_ELF || (ELFHeader->e_phoff + (ELFHeader->e_phnum * ELF_PROGRAM_HEADER_SIZE)) > BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    // A segment that reads past its own end or past the file would overrun whatever follows it in memory
+    for (uint32_t programHeader = 0; programHeader < ELFHeader->e_phnum; programHeader++)
+    {
+        struct pHeader *ProgramHeader = elfLoadableSegment(programHeader);
+
+        if (ProgramHeader && (ProgramHeader->p_filesz > ProgramHeader->p_memsz || ProgramHeader->p_offset > Inode->i_size || ProgramHeader->p_filesz > (Inode->i_size - ProgramHeader->p_offset) || (ProgramHeader->p_vaddr + ProgramHeader->p_memsz) < ProgramHeader->p_vaddr))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool flatHeaderValid(struct inode *Inode)
+{
+    struct flatHeader *FlatHeader = (struct flatHeader*)ELF_HEADER_BUFFER;
+    uint32_t previousSegmentEnd = 0;
+
+    if (Inode->i_size < PAGE_SIZE || FlatHeader->magic != FLAT_MAGIC || FlatHeader->segments == 0 || FlatHeader->segments > MAX_EXEC_SEGMENTS)
+    {
+        return false;
+    }
+
+    for (uint32_t segment = 0; segment < FlatHeader->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &FlatHeader->segment[segment];
+
+        if ((ExecSegment->virtualAddress & ~PAGE_FRAME_MASK) || (ExecSegment->fileOffset & ~PAGE_FRAME_MASK) || ExecSegment->virtualAddress < previousSegmentEnd || ExecSegment->fileSize > ExecSegment->memorySize)
+        {
+            return false;
+        }
+
+        if (ExecSegment->fileOffset > Inode->i_size || ExecSegment->fileSize > (Inode->i_size - ExecSegment->fileOffset) || ExecSegment->virtualAddress >= KERNEL_BASE || ExecSegment->memorySize > (KERNEL_BASE - ExecSegment->virtualAddress))
+        {
+            return false;
+        }
+
+        previousSegmentEnd = ExecSegment->virtualAddress + ExecSegment->memorySize;
+    }
+
+    return true;
+}
+
+struct pHeader *elfLoadableSegment(uint32_t programHeader)
+{
+    struct elfHeader *ELFHeader = (struct elfHeader*)ELF_HEADER_BUFFER;
+    struct pHeader *ProgramHeader = (struct pHeader*)(ELF_HEADER_BUFFER + ELFHeader->e_phoff + (programHeader * ELF_PROGRAM_HEADER_SIZE));
+    uint32_t programHeadersEnd = ELFHeader->e_phoff + (ELFHeader->e_phnum * ELF_PROGRAM_HEADER_SIZE);
+
+    // The linker puts the headers in a LOAD segment of their own. Nothing at run time reads it.
+    if (ProgramHeader->p_type != ELF_PT_LOAD || ProgramHeader->p_memsz == 0 || (ProgramHeader->p_offset == 0 && ProgramHeader->p_filesz <= programHeadersEnd))
+    {
+        return 0;
+    }
+
+    return ProgramHeader;
+}
+
+uint8_t elfPagePermissions(uint32_t page)
+{
+    struct elfHeader *ELFHeader = (struct elfHeader*)ELF_HEADER_BUFFER;
+
+    for (uint32_t programHeader = 0; programHeader < ELFHeader->e_phnum; programHeader++)
+    {
+        struct pHeader *ProgramHeader = elfLoadableSegment(programHeader);
+
+        // A page shared by text and data has to be treated as data
+        if (ProgramHeader && (ProgramHeader->p_flags & ELF_PF_WRITE) && page < (ProgramHeader->p_vaddr + ProgramHeader->p_memsz) && (page + PAGE_SIZE) > ProgramHeader->p_vaddr)
+        {
+            return PG_USER_PRESENT_RW;
+        }
+    }
+
+    return PG_USER_PRESENT_RO;
+}
+
+uint32_t loadElfSegments(uint8_t *inodeStructMemory, uint32_t pid)
+{
+    struct inode *Inode = (struct inode*)inodeStructMemory;
+    struct elfHeader *ELFHeader = (struct elfHeader*)ELF_HEADER_BUFFER;
+
+    if (!readElfHeaders(Inode))
+    {
+        return 0;
+    }
+
+    uint32_t lastMappedPage = 0;
+
+    for (uint32_t programHeader = 0; programHeader < ELFHeader->e_phnum; programHeader++)
+    {
+        struct pHeader *ProgramHeader = elfLoadableSegment(programHeader);
+
+        if (!ProgramHeader)
+        {
+            continue;
+        }
+
+        if (pid != 0)
+        {
+            for (uint32_t page = (ProgramHeader->p_vaddr & PAGE_FRAME_MASK); page < (ProgramHeader->p_vaddr + ProgramHeader->p_memsz); page = page + PAGE_SIZE)
+            {
+                // Segments are sorted by address, so only the last page of the previous segment can be shared
+                if (page == lastMappedPage)
+                {
+                    continue;
+                }
+
+                if (!requestSpecificPage(pid, (uint8_t *)page, PG_USER_PRESENT_RW))
+                {
+                    panic((uint8_t *)"fs.cpp:loadElfSegments() -> segment page request");
+                }
+
+                lastMappedPage = page;
+            }
+        }
+
+        readFileRange(Inode, ProgramHeader->p_offset, ProgramHeader->p_filesz, (uint8_t *)ProgramHeader->p_vaddr);
+        fillMemory((uint8_t *)(ProgramHeader->p_vaddr + ProgramHeader->p_filesz), 0x0, (ProgramHeader->p_memsz - ProgramHeader->p_filesz));
+    }
+
+    if (pid != 0)
+    {
+        // The pages had to be writable to be filled. Now each one gets the permissions of the segments in it.
+        for (uint32_t programHeader = 0; programHeader < ELFHeader->e_phnum; programHeader++)
+        {
+            struct pHeader *ProgramHeader = elfLoadableSegment(programHeader);
+
+            if (!ProgramHeader)
+            {
+                continue;
+            }
+
+            for (uint32_t page = (ProgramHeader->p_vaddr & PAGE_FRAME_MASK); page < (ProgramHeader->p_vaddr + ProgramHeader->p_memsz); page = page + PAGE_SIZE)
+            {
+                mapPage(pid, page, pageTableEntry(pid, page) / PAGE_SIZE, elfPagePermissions(page));
+            }
+        }
+    }
+
+    return ELFHeader->e_entry;
+}
+
+uint32_t mapElfSegments(struct execCacheEntry *ExecCacheEntry, uint32_t pid)
+{
+    // The cache entry can be evicted while the process runs, so page faults read from the process's own copy
+    execMappingFromCache(processExecMapping(pid), ExecCacheEntry);
+
+    return ExecCacheEntry->entryPoint;
+}
+
+void execMappingFromCache(struct execMapping *ExecMapping, struct execCacheEntry *ExecCacheEntry)
+{
+    fillMemory((uint8_t *)ExecMapping, 0x0, EXEC_MAPPING_SIZE);
+
+    bytecpy((uint8_t *)&ExecMapping->Inode, (uint8_t *)&ExecCacheEntry->Inode, sizeof(struct inode));
+    bytecpy((uint8_t *)ExecMapping->segment, (uint8_t *)ExecCacheEntry->segment, sizeof(ExecCacheEntry->segment));
+    ExecMapping->segments = ExecCacheEntry->segments;
+    ExecMapping->inodeNumber = ExecCacheEntry->inodeNumber;
+    ExecMapping->flatImage = ExecCacheEntry->flatImage;
+}
+
+struct execCacheEntry *execCacheFind(uint8_t *fileName)
+{
+    struct execCacheHeader *ExecCacheHeader = (struct execCacheHeader*)EXEC_CACHE;
+
+    ExecCacheHeader->useClock++;
+
+    for (uint32_t entry = 0; entry < MAX_EXEC_CACHE_ENTRIES; entry++)
+    {
+        struct execCacheEntry *ExecCacheEntry = (struct execCacheEntry*)(EXEC_CACHE + ((entry + 1) * EXEC_CACHE_ENTRY_SIZE));
+
+        if (ExecCacheEntry->inodeNumber != 0 && strcmp(ExecCacheEntry->fileName, fileName) == 0)
+        {
+            ExecCacheEntry->lastUsed = ExecCacheHeader->useClock;
+            ExecCacheHeader->hits++;
+            return ExecCacheEntry;
+        }
+    }
+
+    ExecCacheHeader->misses++;
+
+    return 0;
+}
+
+struct execCacheEntry *execCacheFindInode(uint32_t inodeNumber, uint32_t modifiedTime)
+{
+    for (uint32_t entry = 0; entry < MAX_EXEC_CACHE_ENTRIES; entry++)
+    {
+        struct execCacheEntry *ExecCacheEntry = (struct execCacheEntry*)(EXEC_CACHE + ((entry + 1) * EXEC_CACHE_ENTRY_SIZE));
+
+        if (ExecCacheEntry->inodeNumber == inodeNumber && ExecCacheEntry->Inode.i_mtime == modifiedTime)
+        {
+            return ExecCacheEntry;
+        }
+    }
+
+    return 0;
+}
+
+struct execCacheEntry *execCacheInsert(uint8_t *fileName, uint8_t *inodeStructMemory, uint32_t inodeNumber)
+{
+    struct execCacheHeader *ExecCacheHeader = (struct execCacheHeader*)EXEC_CACHE;
+    struct elfHeader *ELFHeader = (struct elfHeader*)ELF_HEADER_BUFFER;
+    struct inode *Inode = (struct inode*)inodeStructMemory;
+    struct flatHeader *FlatHeader = (struct flatHeader*)ELF_HEADER_BUFFER;
+    struct execCacheEntry *ExecCacheEntry = 0;
+
+    if (strlen(fileName) >= EXEC_CACHE_NAME_LENGTH)
+    {
+        return 0;
+    }
+
+    // Both formats start in the first block, which readElfHeaders() has read even when the file is not ELF
+    bool elfFile = readElfHeaders(Inode);
+
+    if (!elfFile && !flatHeaderValid(Inode))
+    {
+        return 0;
+    }
+
+    // An older copy of the same inode may still hold pages
+    execCacheInvalidate(inodeNumber);
+
+    while (ExecCacheEntry == 0)
+    {
+        for (uint32_t entry = 0; entry < MAX_EXEC_CACHE_ENTRIES && ExecCacheEntry == 0; entry++)
+        {
+            struct execCacheEntry *CandidateEntry = (struct execCacheEntry*)(EXEC_CACHE + ((entry + 1) * EXEC_CACHE_ENTRY_SIZE));
+
+            if (CandidateEntry->inodeNumber == 0)
+            {
+                ExecCacheEntry = CandidateEntry;
+            }
+        }
+
+        if (ExecCacheEntry == 0)
+        {
+            execCacheEvictOldest();
+        }
+    }
+
+    fillMemory((uint8_t *)ExecCacheEntry, 0x0, EXEC_CACHE_ENTRY_SIZE);
+    strcpy(ExecCacheEntry->fileName, fileName);
+    bytecpy((uint8_t *)&ExecCacheEntry->Inode, inodeStructMemory, sizeof(struct inode));
+
+    // A flat header already holds the segment list in the cache's own layout
+    if (!elfFile)
+    {
+        bytecpy((uint8_t *)ExecCacheEntry->segment, (uint8_t *)FlatHeader->segment, sizeof(FlatHeader->segment));
+        ExecCacheEntry->segments = FlatHeader->segments;
+        ExecCacheEntry->flatImage = true;
+    }
+
+    for (uint32_t programHeader = 0; elfFile && programHeader < ELFHeader->e_phnum; programHeader++)
+    {
+        struct pHeader *ProgramHeader = elfLoadableSegment(programHeader);
+
+        if (!ProgramHeader)
+        {
+            continue;
+        }
+
+        // The entry is only in use once it has an inode number, so a rejected file leaves it free
+        if (ExecCacheEntry->segments == MAX_EXEC_SEGMENTS || ProgramHeader->p_vaddr >= KERNEL_BASE || ProgramHeader->p_memsz > (KERNEL_BASE - ProgramHeader->p_vaddr))
+        {
+            return 0;
+        }
+
+        struct execSegment *ExecSegment = &ExecCacheEntry->segment[ExecCacheEntry->segments];
+        ExecSegment->virtualAddress = ProgramHeader->p_vaddr;
+        ExecSegment->memorySize = ProgramHeader->p_memsz;
+        ExecSegment->fileOffset = ProgramHeader->p_offset;
+        ExecSegment->fileSize = ProgramHeader->p_filesz;
+        ExecSegment->flags = ProgramHeader->p_flags;
+        ExecCacheEntry->segments++;
+    }
+
+    ExecCacheEntry->entryPoint = elfFile ? ELFHeader->e_entry : FlatHeader->entryPoint;
+    ExecCacheEntry->lastUsed = ExecCacheHeader->useClock;
+    ExecCacheEntry->inodeNumber = inodeNumber;
+
+    return ExecCacheEntry;
+}
+
+void execCacheEvict(struct execCacheEntry *ExecCacheEntry)
+{
+    struct execCacheHeader *ExecCacheHeader = (struct execCacheHeader*)EXEC_CACHE;
+    struct sharedPage *SharedPage = (struct sharedPage*)SHARED_PAGE_TABLE;
+
+    for (uint32_t entry = 0; entry < MAX_SHARED_PAGES; entry++)
+    {
+        if (SharedPage->inodeNumber == ExecCacheEntry->inodeNumber && SharedPage->modifiedTime == ExecCacheEntry->Inode.i_mtime)
+        {
+            uint32_t frameNumber = SharedPage->frameNumber;
+
+            // Processes still mapping the frame keep it, but nobody new can find it
+            removeSharedPage(frameNumber);
+            freeFrame(frameNumber);
+        }
+
+        SharedPage++;
+    }
+
+    fillMemory((uint8_t *)ExecCacheEntry, 0x0, EXEC_CACHE_ENTRY_SIZE);
+    ExecCacheHeader->evictions++;
+}
+
+bool execCacheEvictOldest()
+{
+    struct execCacheEntry *OldestEntry = 0;
+
+    for (uint32_t entry = 0; entry < MAX_EXEC_CACHE_ENTRIES; entry++)
+    {
+        struct execCacheEntry *ExecCacheEntry = (struct execCacheEntry*)(EXEC_CACHE + ((entry + 1) * EXEC_CACHE_ENTRY_SIZE));
+
+        if (ExecCacheEntry->inodeNumber != 0 && !ExecCacheEntry->pinned && (OldestEntry == 0 || ExecCacheEntry->lastUsed < OldestEntry->lastUsed))
+        {
+            OldestEntry = ExecCacheEntry;
+        }
+    }
+
+    if (OldestEntry == 0)
+    {
+        return false;
+    }
+
+    execCacheEvict(OldestEntry);
+
+    return true;
+}
+
+void execCacheInvalidate(uint32_t inodeNumber)
+{
+    for (uint32_t entry = 0; entry < MAX_EXEC_CACHE_ENTRIES; entry++)
+    {
+        struct execCacheEntry *ExecCacheEntry = (struct execCacheEntry*)(EXEC_CACHE + ((entry + 1) * EXEC_CACHE_ENTRY_SIZE));
+
+        if (inodeNumber != 0 && ExecCacheEntry->inodeNumber == inodeNumber)
+        {
+            execCacheEvict(ExecCacheEntry);
+        }
+    }
+}
+
+uint32_t execCacheAllocateFrame(uint32_t pid)
+{
+    uint32_t frameNumber = allocateFrame(pid, (uint8_t *)PAGEFRAME_MAP_BASE);
+
+    // Cached pages nobody maps are the first memory to give back
+    while (frameNumber == 0 && execCacheEvictOldest())
+    {
+        frameNumber = allocateFrame(pid, (uint8_t *)PAGEFRAME_MAP_BASE);
+    }
+
+    return frameNumber;
+}
+
 void loadFileFromInodeStruct(uint8_t *inodeStructMemory, uint8_t *fileBuffer)
 {
     
@@ -474,11 +1221,8 @@ bool fsFindFile(uint8_t *fileName, uint8_t *destinationMemory)
         if (strcmp((uint8_t *)(&DirectoryEntry->fileName), fileName) == '\0')
         {      
             // Load all inodes of a directory up to max number of files per directory. This requires 16KB of memory.
-            for (uint32_t blocksOfInodes=0; blocksOfInodes < (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK); blocksOfInodes++)
-            {
-                readBlock(BlockGroupDescriptor->bgd_starting_block_of_inode_table + blocksOfInodes, (uint8_t *)(int)EXT2_TEMP_INODE_STRUCTS + (BLOCK_SIZE * blocksOfInodes));
-            }
-            memoryCopy( (uint8_t *)((int)EXT2_TEMP_INODE_STRUCTS + ((DirectoryEntry->directoryInode -1) * INODE_SIZE)), destinationMemory, INODE_SIZE/2);
+            readBlocks(BlockGroupDescriptor->bgd_starting_block_of_inode_table, (MAX_FILES_PER_DIRECTORY / INODES_PER_BLOCK), (uint8_t *)EXT2_TEMP_INODE_STRUCTS);
+            memoryCopy( (uint8_t *)((int)EXT2_TEMP_INODE_STRUCTS + ((DirectoryEntry->directoryInode -1) * INODE_SIZE)), destinationMemory, INODE_SIZE);
             
             return true;
         }
@@ -134,6 +134,79 @@ struct inode {
   uint32_t i_osd2[3];
 };
 
+/**
+ * One PT_LOAD segment of a demand paged executable.
+ */
+struct execSegment {
+  uint32_t virtualAddress;
+  uint32_t memorySize;
+  uint32_t fileOffset;
+  uint32_t fileSize;
+  /** The ELF p_flags. Pages of segments with ELF_PF_WRITE are copy-on-write. */
+  uint32_t flags;
+};
+
+/**
+ * The header of a flat executable, written by mkflat from a linked ELF file. It fills the first page of the file, and each segment follows in whole pages at a page aligned file offset, so the file is laid out exactly like memory.
+ */
+struct flatHeader {
+  /** FLAT_MAGIC. */
+  uint32_t magic;
+  uint32_t entryPoint;
+  /** The number of entries used in segment[]. */
+  uint32_t segments;
+  /** The segments in address order. Each one starts on its own page. */
+  struct execSegment segment[MAX_EXEC_SEGMENTS];
+};
+
+/**
+ * The segment-to-file mapping of a demand paged process. There is one per pid at EXEC_MAPPING_BASE, and one more at RUNTIME_LIBRARY_MAPPING for the library every process shares. Each must fit in EXEC_MAPPING_SIZE bytes.
+ */
+struct execMapping {
+  /** The number of entries used in segment[]. 0 if the process was not started by mapElfSegments(). */
+  uint32_t segments;
+  /** The number of pages loaded from the file by page faults so far. */
+  uint32_t pagesLoaded;
+  /** The number of pages mapped from another process running the same file. */
+  uint32_t pagesShared;
+  /** The inode number of the executable. Shared pages are found by it. */
+  uint32_t inodeNumber;
+  struct execSegment segment[MAX_EXEC_SEGMENTS];
+  /** A copy of the executable's inode. */
+  struct inode Inode;
+  /** Set for a flat executable, whose segments can be read many pages at a time. */
+  uint32_t flatImage;
+};
+
+/**
+ * The exec cache bookkeeping at the start of EXEC_CACHE. The entries follow it, each EXEC_CACHE_ENTRY_SIZE bytes.
+ */
+struct execCacheHeader {
+  /** Bumped on every lookup. Entries keep the value of their last use, and the smallest one is evicted first. */
+  uint32_t useClock;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+};
+
+/**
+ * A cached executable. The parsed program headers live here, and its clean pages are held in the shared page table, which keeps one frame reference per page for as long as the entry exists.
+ */
+struct execCacheEntry {
+  /** The inode number of the executable. 0 marks a free entry. */
+  uint32_t inodeNumber;
+  uint32_t lastUsed;
+  uint32_t entryPoint;
+  uint32_t segments;
+  struct execSegment segment[MAX_EXEC_SEGMENTS];
+  uint8_t fileName[EXEC_CACHE_NAME_LENGTH];
+  struct inode Inode;
+  /** Set for the runtime library, which every process maps, so execCacheEvictOldest() never picks it. */
+  uint32_t pinned;
+  /** Set if the file is a flat executable and not an ELF file. */
+  uint32_t flatImage;
+};
+
 /**
  * The Directory Entry structure.
  */
@@ -145,13 +218,114 @@ struct directoryEntry {
   uint8_t *fileName;
 };
 
+/**
+ * Returns the base I/O port of the ATA channel the drive is attached to.
+ * \param drive The ATA drive number, from ATA_PRIMARY_MASTER to ATA_SECONDARY_SLAVE.
+ */
+uint16_t diskBasePort(uint32_t drive);
+
+/**
+ * Selects the master or slave drive on a channel and waits the 400ns the drive needs before its status is valid. Call diskChannelIdleCheck() first unless the channel is being probed.
+ * \param drive The ATA drive number.
+ * \param driveHeadValue The drive/head register value for a master drive. The slave bit is added for slave drives.
+ */
+void diskSelectDrive(uint32_t drive, uint8_t driveHeadValue);
+
+/**
+ * Loops until the channel of a drive is not busy, so the drive/head register can be written. Not for probing, since a floating bus always reads busy.
+ * \param drive The ATA drive number.
+ */
+void diskChannelIdleCheck(uint32_t drive);
+
 /**
  * Checks hard disk status and loops again if not ready.
+ * \param drive The ATA drive number.
+ */
+void diskStatusCheck(uint32_t drive);
+
+/**
+ * Loops until the drive is not busy and is requesting a sector of data to be transferred. Returns false if the drive ends the command with ERR or DF set instead.
+ * \param drive The ATA drive number.
+ */
+bool diskDataRequestCheck(uint32_t drive);
+
+/**
+ * Returns true if a drive takes LBA48 commands. The answer comes from the kernelConfiguration structure, and a drive not identified yet is identified first.
+ * \param drive The ATA drive number.
+ */
+bool diskSupportsLba48(uint32_t drive);
+
+/**
+ * Waits for the channel to go idle, selects the drive, waits for it to be ready, loads the ATA task-file registers and issues a command. LBA28 is used when the request fits in it or the drive has no LBA48, otherwise the command uses LBA48.
+ * \param drive The ATA drive number.
+ * \param sectorNumber The first sector of the transfer in LBA format.
+ * \param numberOfSectors The number of sectors in the transfer. Up to 65536 sectors.
+ * \param lba28Command The command to issue when using LBA28 addressing.
+ * \param lba48Command The EXT command to issue when using LBA48 addressing.
+ */
+void diskIssueCommand(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t lba28Command, uint8_t lba48Command);
+
+/**
+ * Moves the sectors of a read command already issued with diskIssueCommand() from the drive into memory. Returns false if the drive reports an error.
+ * \param drive The ATA drive number.
+ * \param numberOfSectors The number of sectors the command transfers.
+ * \param destinationMemory The pointer to the destination memory to write the sectors.
+ */
+bool diskReadData(uint32_t drive, uint32_t numberOfSectors, uint8_t *destinationMemory);
+
+/**
+ * Moves the sectors of a write command already issued with diskIssueCommand() from memory to the drive. The drive cache is not flushed. Returns false if the drive reports an error.
+ * \param drive The ATA drive number.
+ * \param numberOfSectors The number of sectors the command transfers.
+ * \param sourceMemory The starting memory address of the sectors to write.
+ */
+bool diskWriteData(uint32_t drive, uint32_t numberOfSectors, uint8_t *sourceMemory);
+
+/**
+ * Reads consecutive 512-byte sectors using as few commands as possible and writes them to the destination memory. Returns false if the drive reports an error.
+ * \param drive The ATA drive number.
+ * \param sectorNumber The first sector to read in LBA format.
+ * \param numberOfSectors The number of sectors to read.
+ * \param destinationMemory The pointer to the destination memory to write the sectors.
+ */
+bool diskReadSectors(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *destinationMemory);
+
+/**
+ * Writes consecutive 512-byte sectors using as few commands as possible and flushes the drive cache. The opposite of diskReadSectors(). Returns false if the drive reports an error, and the cache is not flushed then.
+ * \param drive The ATA drive number.
+ * \param sectorNumber The first sector to write in LBA format.
+ * \param numberOfSectors The number of sectors to write.
+ * \param sourceMemory The starting memory address of the sectors to write.
+ */
+bool diskWriteSectors(uint32_t drive, uint32_t sectorNumber, uint32_t numberOfSectors, uint8_t *sourceMemory);
+
+/**
+ * Flushes the drive's write cache to the media.
+ * \param drive The ATA drive number.
+ */
+void diskFlushCache(uint32_t drive);
+
+/**
+ * Issues IDENTIFY DEVICE and copies the 512 bytes it returns. Also records whether the drive has LBA48 in the kernelConfiguration structure. Returns false if no ATA drive is attached at that position, including ATAPI drives.
+ * \param drive The ATA drive number.
+ * \param identifyData The 512-byte buffer that receives the IDENTIFY DEVICE data.
+ */
+bool diskIdentify(uint32_t drive, uint16_t *identifyData);
+
+/**
+ * Issues IDENTIFY DEVICE and returns the number of addressable sectors on the drive, using the LBA48 count when the drive supports it. Returns 0 if the drive is absent.
+ * \param drive The ATA drive number.
+ */
+uint32_t diskTotalSectors(uint32_t drive);
+
+/**
+ * Returns the number of addressable sectors from 512 bytes of IDENTIFY DEVICE data, using the LBA48 count when the drive supports it.
+ * \param identifyData The IDENTIFY DEVICE data returned by the drive.
  */
-void diskStatusCheck();
+uint32_t identifyTotalSectors(uint16_t *identifyData);
 
 /**
- * Reads a 512-byte sector using LBA format and writes it to the destination memory.
+ * Reads a 512-byte sector using LBA format and writes it to the destination memory. The block device backends use diskReadSectors() instead.
  * \param sectorNumber The sector to read in LBA format.
  * \param destinationMemory The pointer to the destination memory to write the sector.
  */
@@ -178,6 +352,22 @@ void readBlock(uint32_t blockNumber, uint8_t *destinationMemory);
  */
 void writeBlock(uint32_t blockNumber, uint8_t *sourceMemory);
 
+/**
+ * Reads consecutive EXT2 blocks from the block device selected in the kernelConfiguration structure.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of 1024-byte blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks.
+ */
+void readBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/**
+ * Writes consecutive EXT2 blocks to the block device selected in the kernelConfiguration structure. The opposite of readBlocks().
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of 1024-byte blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write.
+ */
+void writeBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
 /** Finds a free block and returns the block number. */
 uint32_t allocateFreeBlock();
 
@@ -249,10 +439,117 @@ uint32_t returnInodeofFileName(uint8_t *fileName);
 
 /**
  * Parses an ELF header at a given address and loads the text and data sections to their preferred loading locations based on the ELF header and parsing the program headers.
+ * Nothing calls it now. Stage 2 and sysForkExec() read only the segments they need with loadElfSegments() and mapElfSegments(), so this is kept as the assignment entry point.
  * \param elfHeaderLocation The pointer to the ELF header.
  */
 void loadElfFile(uint8_t *elfHeaderLocation);
 
+/**
+ * Returns the disk block that holds a block of a file, or 0 if the block is a hole. Direct and singly indirect blocks are supported.
+ * \param Inode The inode of the file.
+ * \param fileBlock The block number within the file.
+ * \param indirectBlockLoaded Set to false before the first call of a transfer. The indirect block is read into EXT2_INDIRECT_BLOCK the first time it is needed and reused after that.
+ */
+uint32_t inodeBlockNumber(struct inode *Inode, uint32_t fileBlock, bool *indirectBlockLoaded);
+
+/**
+ * Reads a byte range of a file straight to its destination. Runs of whole blocks that are consecutive on disk are read with one readBlocks() call, and only partial blocks are copied through EXT2_PARTIAL_BLOCK_LOC.
+ * \param Inode The inode of the file.
+ * \param fileOffset The byte offset in the file to start reading from.
+ * \param numberOfBytes The number of bytes to read.
+ * \param destinationMemory Where the bytes go. Nothing outside the range is written.
+ */
+void readFileRange(struct inode *Inode, uint32_t fileOffset, uint32_t numberOfBytes, uint8_t *destinationMemory);
+
+/**
+ * Reads the first block of an ELF file into ELF_HEADER_BUFFER. Returns false if the file is not an ELF file, its program headers do not fit in the first block, or a loadable segment has more file bytes than memory bytes or runs past the end of the file.
+ * \param Inode The inode of the file.
+ */
+bool readElfHeaders(struct inode *Inode);
+
+/**
+ * Checks the flat executable header left in ELF_HEADER_BUFFER by readElfHeaders(). Returns false unless every segment is page aligned, starts after the previous one, stays inside the file and ends below KERNEL_BASE.
+ * \param Inode The inode of the file.
+ */
+bool flatHeaderValid(struct inode *Inode);
+
+/**
+ * Returns a program header from ELF_HEADER_BUFFER if it is a PT_LOAD segment that has to be in memory, or 0 otherwise. The LOAD segment the linker makes for the headers alone is skipped.
+ * \param programHeader The index of the program header.
+ */
+struct pHeader *elfLoadableSegment(uint32_t programHeader);
+
+/**
+ * Returns PG_USER_PRESENT_RW if any loadable segment in ELF_HEADER_BUFFER with ELF_PF_WRITE touches the page, or PG_USER_PRESENT_RO otherwise. x86 without PAE has no execute bit, so only the write flag matters.
+ * \param page The page aligned virtual address.
+ */
+uint8_t elfPagePermissions(uint32_t page);
+
+/**
+ * Reads the program headers of an ELF file and streams each PT_LOAD segment from the file into its virtual address, then zero fills the rest of the segment (BSS). The file is never copied whole into memory. With a pid, pages that hold no writable segment are made read-only afterwards. Returns the entry point, or 0 if the file is not an ELF file.
+ * \param inodeStructMemory The pointer to the Inode structure of the ELF file.
+ * \param pid The process whose pages receive the segments. The pages are requested here. Use 0 before paging is enabled, when the segments are written to physical memory.
+ */
+uint32_t loadElfSegments(uint8_t *inodeStructMemory, uint32_t pid);
+
+/**
+ * Sets up a process to run a cached executable by copying its segment list into the process's execMapping. No pages are mapped. pageFault() maps each page the first time it is touched, from the shared page table when the page is already in memory. Returns the entry point.
+ * \param ExecCacheEntry The exec cache entry of the executable.
+ * \param pid The process that will run the executable.
+ */
+uint32_t mapElfSegments(struct execCacheEntry *ExecCacheEntry, uint32_t pid);
+
+/**
+ * Copies the segment list and inode of a cached executable into an execMapping, which page faults read from after the cache entry is gone.
+ * \param ExecMapping The mapping to fill in.
+ * \param ExecCacheEntry The exec cache entry of the executable.
+ */
+void execMappingFromCache(struct execMapping *ExecMapping, struct execCacheEntry *ExecCacheEntry);
+
+/**
+ * Returns the exec cache entry for a file name, or 0 on a miss. A hit needs no disk I/O at all.
+ * \param fileName The file name in the root directory.
+ */
+struct execCacheEntry *execCacheFind(uint8_t *fileName);
+
+/**
+ * Returns the exec cache entry that matches an inode number and modification time, or 0 if there is none.
+ * \param inodeNumber The inode number of the executable.
+ * \param modifiedTime The i_mtime of the executable.
+ */
+struct execCacheEntry *execCacheFindInode(uint32_t inodeNumber, uint32_t modifiedTime);
+
+/**
+ * Reads the program headers of an ELF file, or the header of a flat executable, and adds it to the exec cache, evicting the least recently used entry if the cache is full. Returns the new entry, or 0 if the file is neither, has more than MAX_EXEC_SEGMENTS loadable segments, or has a segment that reaches into the kernel at KERNEL_BASE.
+ * \param fileName The file name in the root directory.
+ * \param inodeStructMemory The pointer to the Inode structure of the file. It is copied.
+ * \param inodeNumber The inode number of the file.
+ */
+struct execCacheEntry *execCacheInsert(uint8_t *fileName, uint8_t *inodeStructMemory, uint32_t inodeNumber);
+
+/**
+ * Removes an entry from the exec cache and drops the cache's reference on each of its shared pages. Frames that no process maps are freed.
+ * \param ExecCacheEntry The entry to remove.
+ */
+void execCacheEvict(struct execCacheEntry *ExecCacheEntry);
+
+/**
+ * Evicts the least recently used exec cache entry. Returns false if the cache is empty.
+ */
+bool execCacheEvictOldest();
+
+/**
+ * Evicts the exec cache entry of an inode, if there is one. Called whenever the file is written or deleted.
+ * \param inodeNumber The inode number of the file.
+ */
+void execCacheInvalidate(uint32_t inodeNumber);
+
+/**
+ * Allocates a frame for a page of an executable. When memory runs out, exec cache entries are evicted from the oldest until a frame is free. Returns 0 if there is still no frame.
+ * \param pid The pid requesting the frame.
+ */
+uint32_t execCacheAllocateFrame(uint32_t pid);
+
 /**
  * Given a pointer to an Inode structure, load all the EXT2 blocks associated with that file to the fileBuffer parameter.
  * \param inodeStructMemory The pointer to the Inode structure. This value is typically USER_TEMP_INODE_LOC.
@@ -7,11 +7,23 @@
 struct kernelConfiguration
 {
     uint32_t runScheduler;
+    /** The block device that readBlock() and writeBlock() use. BLOCK_DEVICE_ATA (0) unless bootloader stage 2 finds a virtio-blk or AHCI disk or kInit() switches to BOOT_BLOCK_DEVICE. */
+    uint32_t blockDevice;
+    /** ATA_ADDRESSING_LBA28 or ATA_ADDRESSING_LBA48 for each ATA drive, recorded by diskIdentify(). ATA_ADDRESSING_UNKNOWN (0) until the drive is identified. */
+    uint8_t ataAddressing[MAX_ATA_DRIVES];
 };
 
 void kInit();
 
 /** Prompts the user to enter the root password. This is normally commented out to save time for the student. The root password is "passw0rd". It compares the password entered to a simple hashed value in the mpass file. See stringHash(). */
 void logonPrompt();
-void loadShell();
-void launchShell();
\ No newline at end of file
+/** Adds the runtime library (libsimpleos) to the exec cache for good and fills in RUNTIME_LIBRARY_MAPPING. User programs are linked against its fixed addresses, and pageFault() maps its pages into every process on first touch. */
+void loadRuntimeLibrary();
+
+/** Maps the stack, heap and inode pages of PID 1 and streams the shell's ELF segments into place. Returns the shell's entry point. */
+uint32_t loadShell();
+
+/** Starts the system timer and enters the shell in ring 3.
+ * \param entryPoint The entry point returned by loadShell().
+ */
+void launchShell(uint32_t entryPoint);
\ No newline at end of file
@@ -0,0 +1,117 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+// Build host tool, not part of the OS. Converts a linked user program into the flat executable
+// format described by struct flatHeader in fs.h:
+//
+//     mkflat <ELF input> <flat output>
+//
+// The header fills the first page, and each PT_LOAD segment follows in whole pages, so the kernel
+// reads a segment with one multi-block transfer and never parses ELF for the file.
+
+#include <stdio.h>
+#include "fs.h"
+
+uint8_t inputFile[0x100000];
+uint8_t outputFile[0x100000];
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: mkflat <ELF input> <flat output>\n");
+        return 1;
+    }
+
+    FILE *input = fopen(argv[1], "rb");
+
+    if (!input)
+    {
+        fprintf(stderr, "mkflat: cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t inputSize = fread(inputFile, 1, sizeof(inputFile), input);
+    fclose(input);
+
+    struct elfHeader *ELFHeader = (struct elfHeader*)inputFile;
+    struct flatHeader *FlatHeader = (struct flatHeader*)outputFile;
+
+    if (inputSize < sizeof(struct elfHeader) || *(uint32_t *)inputFile != MAGIC_ELF || (ELFHeader->e_phoff + (ELFHeader->e_phnum * ELF_PROGRAM_HEADER_SIZE)) > inputSize)
+    {
+        fprintf(stderr, "mkflat: %s is not an ELF file\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t programHeadersEnd = ELFHeader->e_phoff + (ELFHeader->e_phnum * ELF_PROGRAM_HEADER_SIZE);
+    uint32_t outputSize = PAGE_SIZE;
+
+    FlatHeader->magic = FLAT_MAGIC;
+    FlatHeader->entryPoint = ELFHeader->e_entry;
+
+    for (uint32_t programHeader = 0; programHeader < ELFHeader->e_phnum; programHeader++)
+    {
+        struct pHeader *ProgramHeader = (struct pHeader*)(inputFile + ELFHeader->e_phoff + (programHeader * ELF_PROGRAM_HEADER_SIZE));
+
+        // Same rule as elfLoadableSegment(): the LOAD segment holding only the headers is not needed
+        if (ProgramHeader->p_type != ELF_PT_LOAD || ProgramHeader->p_memsz == 0 || (ProgramHeader->p_offset == 0 && ProgramHeader->p_filesz <= programHeadersEnd))
+        {
+            continue;
+        }
+
+        if (FlatHeader->segments == MAX_EXEC_SEGMENTS || ProgramHeader->p_filesz > ProgramHeader->p_memsz || (ProgramHeader->p_offset + ProgramHeader->p_filesz) > inputSize)
+        {
+            fprintf(stderr, "mkflat: %s has a segment that cannot be converted\n", argv[1]);
+            return 1;
+        }
+
+        // The segment is moved down to its page boundary, and the bytes in front of it read as zero
+        uint32_t pageOffset = ProgramHeader->p_vaddr & ~PAGE_FRAME_MASK;
+        struct execSegment *ExecSegment = &FlatHeader->segment[FlatHeader->segments];
+
+        ExecSegment->virtualAddress = ProgramHeader->p_vaddr & PAGE_FRAME_MASK;
+        ExecSegment->memorySize = ProgramHeader->p_memsz + pageOffset;
+        ExecSegment->fileOffset = outputSize;
+        ExecSegment->fileSize = ProgramHeader->p_filesz + pageOffset;
+        ExecSegment->flags = ProgramHeader->p_flags;
+
+        if (FlatHeader->segments != 0 && ExecSegment->virtualAddress < (FlatHeader->segment[FlatHeader->segments - 1].virtualAddress + FlatHeader->segment[FlatHeader->segments - 1].memorySize))
+        {
+            fprintf(stderr, "mkflat: %s has two segments in one page, link it with page aligned segments\n", argv[1]);
+            return 1;
+        }
+
+        if ((outputSize + ExecSegment->fileSize + PAGE_SIZE) > sizeof(outputFile))
+        {
+            fprintf(stderr, "mkflat: %s is too large\n", argv[1]);
+            return 1;
+        }
+
+        for (uint32_t byte = 0; byte < ProgramHeader->p_filesz; byte++)
+        {
+            outputFile[outputSize + pageOffset + byte] = inputFile[ProgramHeader->p_offset + byte];
+        }
+
+        outputSize = outputSize + (((ExecSegment->fileSize + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE);
+        FlatHeader->segments++;
+    }
+
+    if (FlatHeader->segments == 0)
+    {
+        fprintf(stderr, "mkflat: %s has no loadable segments\n", argv[1]);
+        return 1;
+    }
+
+    FILE *output = fopen(argv[2], "wb");
+
+    if (!output || fwrite(outputFile, 1, outputSize, output) != outputSize)
+    {
+        fprintf(stderr, "mkflat: cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    fclose(output);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "pci.h"
+#include "x86.h"
+#include "constants.h"
+
+// https://wiki.osdev.org/PCI#Configuration_Space_Access_Mechanism_.231
+
+uint32_t pciConfigRead(struct pciDevice *PciDevice, uint32_t offset)
+{
+    outputIOPortLong(PCI_CONFIG_ADDRESS_PORT, (PCI_CONFIG_ENABLE | (PciDevice->bus << 16) | (PciDevice->device << 11) | (PciDevice->function << 8) | (offset & 0xFC)));
+    return inputIOPortLong(PCI_CONFIG_DATA_PORT);
+}
+
+void pciConfigWrite(struct pciDevice *PciDevice, uint32_t offset, uint32_t value)
+{
+    outputIOPortLong(PCI_CONFIG_ADDRESS_PORT, (PCI_CONFIG_ENABLE | (PciDevice->bus << 16) | (PciDevice->device << 11) | (PciDevice->function << 8) | (offset & 0xFC)));
+    outputIOPortLong(PCI_CONFIG_DATA_PORT, value);
+}
+
+bool pciScan(uint32_t offset, uint32_t mask, uint32_t value, struct pciDevice *PciDevice)
+{
+    for (PciDevice->bus = 0; PciDevice->bus < PCI_MAX_BUSES; PciDevice->bus++)
+    {
+        for (PciDevice->device = 0; PciDevice->device < PCI_DEVICES_PER_BUS; PciDevice->device++)
+        {
+            for (PciDevice->function = 0; PciDevice->function < PCI_FUNCTIONS_PER_DEVICE; PciDevice->function++)
+            {
+                uint32_t vendorAndDevice = pciConfigRead(PciDevice, 0);
+
+                if ((vendorAndDevice & 0xFFFF) == PCI_VENDOR_NONE)
+                {
+                    if (PciDevice->function == 0) { break; } // No device in this slot
+                    continue;
+                }
+
+                if ((pciConfigRead(PciDevice, offset) & mask) == value)
+                {
+                    return true;
+                }
+
+                // Only multifunction devices have anything past function 0
+                if (PciDevice->function == 0 && !(pciConfigRead(PciDevice, PCI_CONFIG_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION))
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool pciFindDevice(uint16_t vendorId, uint16_t deviceId, struct pciDevice *PciDevice)
+{
+    return pciScan(0, PCI_VENDOR_AND_DEVICE_MASK, (((uint32_t)deviceId << 16) | vendorId), PciDevice);
+}
+
+bool pciFindClass(uint32_t classCode, struct pciDevice *PciDevice)
+{
+    return pciScan(PCI_CONFIG_CLASS, PCI_CLASS_MASK, classCode, PciDevice);
+}
+
+void pciEnableDevice(struct pciDevice *PciDevice)
+{
+    uint32_t command = pciConfigRead(PciDevice, PCI_CONFIG_COMMAND);
+    // The upper half is the status register, where writing a 1 clears a bit
+    pciConfigWrite(PciDevice, PCI_CONFIG_COMMAND, ((command & 0xFFFF) | PCI_COMMAND_IO_SPACE | PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER));
+}
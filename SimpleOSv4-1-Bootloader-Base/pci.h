@@ -0,0 +1,53 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "constants.h"
+/**
+ * The location of a function on the PCI bus.
+ */
+struct pciDevice
+{
+    uint32_t bus;
+    uint32_t device;
+    uint32_t function;
+};
+
+/** Reads and returns a 32-bit value from PCI configuration space using configuration mechanism #1.
+ * \param PciDevice The PCI function to read.
+ * \param offset The byte offset in the configuration space. Must be 4-byte aligned.
+ */
+uint32_t pciConfigRead(struct pciDevice *PciDevice, uint32_t offset);
+
+/** Writes a 32-bit value to PCI configuration space.
+ * \param PciDevice The PCI function to write.
+ * \param offset The byte offset in the configuration space. Must be 4-byte aligned.
+ * \param value The value to write.
+ */
+void pciConfigWrite(struct pciDevice *PciDevice, uint32_t offset, uint32_t value);
+
+/** Scans every bus, device and function for one whose configuration register matches a value. Returns true and fills in PciDevice when found.
+ * \param offset The configuration register to compare.
+ * \param mask The bits of the register that must match.
+ * \param value The value the masked register must equal.
+ * \param PciDevice The structure to fill in with the location of the device.
+ */
+bool pciScan(uint32_t offset, uint32_t mask, uint32_t value, struct pciDevice *PciDevice);
+
+/** Finds a function by vendor and device ID. Returns true and fills in PciDevice when found.
+ * \param vendorId The PCI vendor ID to look for.
+ * \param deviceId The PCI device ID to look for.
+ * \param PciDevice The structure to fill in with the location of the device.
+ */
+bool pciFindDevice(uint16_t vendorId, uint16_t deviceId, struct pciDevice *PciDevice);
+
+/** Finds a function by class code, subclass and programming interface, such as PCI_CLASS_AHCI. Returns true and fills in PciDevice when found.
+ * \param classCode The class, subclass and programming interface in the layout of the PCI_CONFIG_CLASS register.
+ * \param PciDevice The structure to fill in with the location of the device.
+ */
+bool pciFindClass(uint32_t classCode, struct pciDevice *PciDevice);
+
+/** Turns on the address decoding and bus mastering bits in the PCI command register so the device can do I/O and DMA.
+ * \param PciDevice The PCI function to enable.
+ */
+void pciEnableDevice(struct pciDevice *PciDevice);
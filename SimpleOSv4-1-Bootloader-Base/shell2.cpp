@@ -32,6 +32,80 @@ void printPrompt(uint8_t myPid)
 }
 
 
+void printBenchmarkRow(uint8_t myPid, uint32_t row, uint8_t *label, uint32_t cycles)
+{
+    uint8_t *cycleCount = malloc(myPid, 12);
+
+    itoa(cycles, cycleCount);
+    printString(COLOR_WHITE, row, 3, label);
+    printString(COLOR_LIGHT_BLUE, row, 30, cycleCount);
+
+    free(cycleCount);
+}
+
+void memoryBenchmark(uint8_t myPid)
+{
+    uint32_t benchmarkBytes = 0x10000;
+    uint32_t startCycles;
+
+    // Populated up front, so no page fault lands inside a timing
+    uint8_t *source = systemMMapRange(0, benchmarkBytes, MMAP_PROT_READ | MMAP_PROT_WRITE, MMAP_POPULATE);
+    uint8_t *destination = systemMMapRange(0, benchmarkBytes, MMAP_PROT_READ | MMAP_PROT_WRITE, MMAP_POPULATE);
+
+    if (source == 0 || destination == 0)
+    {
+        printString(COLOR_RED, 1, 3, (uint8_t *)"Not enough memory for the benchmark...");
+        return;
+    }
+
+    printString(COLOR_LIGHT_BLUE, 1, 3, (uint8_t *)"CPU cycles to fill or copy 64 KB:");
+
+    startCycles = readTimeStampCounter();
+    for (uint32_t byte = 0; byte < benchmarkBytes; byte++)
+    {
+        destination[byte] = 0x0;
+    }
+    printBenchmarkRow(myPid, 3, (uint8_t *)"fill, byte loop", readTimeStampCounter() - startCycles);
+
+    startCycles = readTimeStampCounter();
+    fillMemory(destination, 0x0, benchmarkBytes);
+    printBenchmarkRow(myPid, 4, (uint8_t *)"fillMemory()", readTimeStampCounter() - startCycles);
+
+    // The same bytes as 64 byte fills, which stay on the rep stosl path
+    startCycles = readTimeStampCounter();
+    for (uint32_t offset = 0; offset < benchmarkBytes; offset = offset + 64)
+    {
+        fillMemory(destination + offset, 0x0, 64);
+    }
+    printBenchmarkRow(myPid, 5, (uint8_t *)"fillMemory(), 64 bytes", readTimeStampCounter() - startCycles);
+
+    startCycles = readTimeStampCounter();
+    for (uint32_t byte = 0; byte < benchmarkBytes; byte++)
+    {
+        destination[byte] = source[byte];
+    }
+    printBenchmarkRow(myPid, 7, (uint8_t *)"copy, byte loop", readTimeStampCounter() - startCycles);
+
+    startCycles = readTimeStampCounter();
+    bytecpy(destination, source, benchmarkBytes);
+    printBenchmarkRow(myPid, 8, (uint8_t *)"bytecpy()", readTimeStampCounter() - startCycles);
+
+    startCycles = readTimeStampCounter();
+    memoryMove(destination + 1, destination, benchmarkBytes - 1);
+    printBenchmarkRow(myPid, 9, (uint8_t *)"memoryMove(), overlapping", readTimeStampCounter() - startCycles);
+
+    if (readValueFromMemLoc(CPU_FEATURES_LOC) & CPUID_SSE2)
+    {
+        printString(COLOR_GREEN, 11, 3, (uint8_t *)"SSE2 found, fills of a page or more use movnti");
+    }
+    else
+    {
+        printString(COLOR_RED, 11, 3, (uint8_t *)"No SSE2, every fill uses rep stosl");
+    }
+
+    systemMUnmap(source, benchmarkBytes);
+    systemMUnmap(destination, benchmarkBytes);
+}
 
 void main()
 {
@@ -58,6 +132,8 @@ void main()
         
         fillMemory((uint8_t *)KEYBOARD_BUFFER, (uint8_t)0x0, (KEYBOARD_BUFFER_SIZE * 2));
 
+        // The time spent typing a command is the shell's idle time
+        systemIdle();
         printPrompt(myPid);     
         readCommand(bufferMem, cursorMemory);
 
@@ -85,6 +161,7 @@ void main()
         uint8_t *parentCommand = (uint8_t *)"parent\n";
         uint8_t *dirCommand = (uint8_t *)"ls\n";
         uint8_t *schedCommand = (uint8_t *)"sched\n";
+        uint8_t *benchCommand = (uint8_t *)"bench\n";
 
         if (strcmp(command, clearScreenCommand) == 0)
         {
@@ -148,8 +225,15 @@ void main()
             printString(COLOR_WHITE, 6, 47, (uint8_t *)"sched = Toggle kernel scheduler");
             printString(COLOR_WHITE, 7, 47, (uint8_t *)"rm = delete a file");
             printString(COLOR_WHITE, 8, 47, (uint8_t *)"new = create a new empty file");
+            printString(COLOR_WHITE, 9, 47, (uint8_t *)"bench = Time memory fills and copies");
             
         }
+        else if (strcmp(command, benchCommand) == 0)
+        {
+            clearScreen();
+            memoryBenchmark(myPid);
+            myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+        }
         else if (strcmp(command, freeCommand) == 0)
         {
             clearScreen();
@@ -10,6 +10,8 @@
 #include "file.h"
 #include "screen.h"
 #include "keyboard.h"
+#include "frame-allocator.h"
+#include "exceptions.h"
 
 void wait(uint32_t timeToWait)
 {
@@ -105,11 +107,19 @@ void strcpyRemoveNewline(uint8_t *destinationString, uint8_t *sourceString)
 
 void bytecpy(uint8_t *destinationMemory, uint8_t *sourceMemory, uint32_t numberOfBytes)
 {
-    for (uint32_t x = 0; x < numberOfBytes; x++)
+    memoryCopy(sourceMemory, destinationMemory, numberOfBytes);
+}
+
+void memoryMove(uint8_t *destinationMemory, uint8_t *sourceMemory, uint32_t numberOfBytes)
+{
+    // Front to back would overwrite the end of the source before reading it
+    if (destinationMemory > sourceMemory && destinationMemory < (sourceMemory + numberOfBytes))
     {
-        *destinationMemory = *sourceMemory;
-        destinationMemory++;
-        sourceMemory++;
+        memoryCopyBackward(sourceMemory, destinationMemory, numberOfBytes);
+    }
+    else
+    {
+        memoryCopy(sourceMemory, destinationMemory, numberOfBytes);
     }
 }
 
@@ -164,107 +174,523 @@ uint32_t ceiling(uint32_t number, uint32_t base)
 }
 
 uint8_t *malloc(uint32_t currentPid, uint32_t objectSize)
-{  
-    // Heap entries take up 16 bytes each, but 1 byte is the PID that owns it.
-    // So, heap items cannot exceed 15 bytes (including null byte for strings)
-    // If you need more than this, use mmap to get 4,096 bytes
-    uint8_t heapObjectNumber = 0;
-    struct heapObject *HeapObject = (struct heapObject*)USER_HEAP;
+{
+    struct userHeapState *UserHeapState = userHeap();
+    struct heapChunk *Chunk = 0;
 
-    if (objectSize > HEAP_OBJ_USABLE_SIZE)
+    if (objectSize >= (USER_BRK_LIMIT - USER_BRK_BASE))
     {
         return 0;
     }
 
-    while (heapObjectNumber < MAX_HEAP_OBJECTS)
+    // One byte more than asked for, so strings copied in with their strlen() are still terminated
+    uint32_t chunkSize = ceiling(objectSize + 1 + USER_HEAP_CHUNK_HEADER, USER_HEAP_MIN_CHUNK) * USER_HEAP_MIN_CHUNK;
+
+    if (chunkSize <= USER_HEAP_SMALL_MAX_CHUNK)
     {
-        if (HeapObject->pid == 0)
+        uint32_t sizeClass = 0;
+
+        while ((uint32_t)(USER_HEAP_MIN_CHUNK << sizeClass) < chunkSize)
         {
-            HeapObject->pid = (uint8_t)currentPid;
-            return &HeapObject->heapUseable[0];    
+            sizeClass++;
         }
-        heapObjectNumber++;
-        HeapObject++;
+
+        chunkSize = USER_HEAP_MIN_CHUNK << sizeClass;
+        Chunk = UserHeapState->smallBin[sizeClass];
+
+        if (Chunk != 0)
+        {
+            UserHeapState->smallBin[sizeClass] = Chunk->next;
+        }
+        else
+        {
+            Chunk = heapTakeChunk(UserHeapState, chunkSize);
+        }
+
+        if (Chunk != 0)
+        {
+            Chunk->size = chunkSize | USER_HEAP_SMALL | USER_HEAP_IN_USE;
+        }
+    }
+    else
+    {
+        Chunk = heapTakeChunk(UserHeapState, chunkSize);
+    }
+
+    if (Chunk == 0)
+    {
+        return 0;
     }
-    // return null pointer if unable to find object
-    return 0;    
+
+    UserHeapState->objectsInUse++;
+    fillMemory((uint8_t *)Chunk + USER_HEAP_CHUNK_HEADER, 0x0, (Chunk->size & ~USER_HEAP_FLAGS) - USER_HEAP_CHUNK_HEADER);
+
+    return (uint8_t *)Chunk + USER_HEAP_CHUNK_HEADER;
 }
 
 void free(uint8_t *heapObject)
 {
-    fillMemory((heapObject - 1), 0x0, HEAP_OBJ_SIZE); // minus 1 to remove the entire entry, including pid
-}
+    struct userHeapState *UserHeapState = userHeap();
+
+    if ((uint32_t)heapObject < (USER_BRK_BASE + USER_HEAP_CHUNK_HEADER) || (uint32_t)heapObject >= UserHeapState->top)
+    {
+        return;
+    }
+
+    struct heapChunk *Chunk = (struct heapChunk*)(heapObject - USER_HEAP_CHUNK_HEADER);
+    uint32_t chunkSize = Chunk->size & ~USER_HEAP_FLAGS;
 
+    if (!(Chunk->size & USER_HEAP_IN_USE))
+    {
+        return;
+    }
+
+    UserHeapState->objectsInUse--;
+
+    // A small chunk keeps USER_HEAP_SMALL in its bin, so it is never merged into a neighbour
+    if (Chunk->size & USER_HEAP_SMALL)
+    {
+        uint32_t sizeClass = 0;
+
+        while ((uint32_t)(USER_HEAP_MIN_CHUNK << sizeClass) < chunkSize)
+        {
+            sizeClass++;
+        }
+
+        Chunk->size = chunkSize | USER_HEAP_SMALL;
+        Chunk->next = UserHeapState->smallBin[sizeClass];
+        UserHeapState->smallBin[sizeClass] = Chunk;
+
+        return;
+    }
+
+    struct heapChunk *NextChunk = (struct heapChunk*)((uint32_t)Chunk + chunkSize);
+
+    if ((uint32_t)NextChunk != UserHeapState->top && !(NextChunk->size & (USER_HEAP_IN_USE | USER_HEAP_SMALL)))
+    {
+        heapListRemove(UserHeapState, NextChunk);
+        chunkSize = chunkSize + NextChunk->size;
+    }
+
+    if (Chunk->previousSize != 0)
+    {
+        struct heapChunk *PreviousChunk = (struct heapChunk*)((uint32_t)Chunk - Chunk->previousSize);
+
+        if (!(PreviousChunk->size & (USER_HEAP_IN_USE | USER_HEAP_SMALL)))
+        {
+            heapListRemove(UserHeapState, PreviousChunk);
+            chunkSize = chunkSize + PreviousChunk->size;
+            Chunk = PreviousChunk;
+        }
+    }
+
+    if (((uint32_t)Chunk + chunkSize) != UserHeapState->top)
+    {
+        Chunk->size = chunkSize;
+        heapChunkResized(UserHeapState, Chunk);
+        heapListInsert(UserHeapState, Chunk);
+
+        return;
+    }
+
+    UserHeapState->top = (uint32_t)Chunk;
+    UserHeapState->lastChunkSize = Chunk->previousSize;
+
+    // Keeping USER_HEAP_GROWTH mapped above the top stops a program that frees and allocates in a loop from making a syscall each time
+    if ((UserHeapState->heapEnd - UserHeapState->top) > (2 * USER_HEAP_GROWTH))
+    {
+        UserHeapState->heapEnd = systemBrk(ceiling(UserHeapState->top + USER_HEAP_GROWTH, PAGE_SIZE) * PAGE_SIZE);
+    }
+}
 
 void freeAll(uint32_t currentPid)
 {
-    uint32_t heapObjectNumber = 0;
-    uint32_t heapObjectPid = 0;
+    struct userHeapState *UserHeapState = userHeap();
 
-    while (heapObjectNumber < MAX_HEAP_OBJECTS)
+    for (uint32_t sizeClass = 0; sizeClass < USER_HEAP_SMALL_CLASSES; sizeClass++)
     {
+        UserHeapState->smallBin[sizeClass] = 0;
+    }
+
+    UserHeapState->freeList = 0;
+    UserHeapState->objectsInUse = 0;
+    UserHeapState->top = USER_BRK_BASE;
+    UserHeapState->lastChunkSize = 0;
+}
+
+struct userHeapState *userHeap()
+{
+    struct userHeapState *UserHeapState = (struct userHeapState*)USER_HEAP;
+
+    if (UserHeapState->magic != USER_HEAP_MAGIC)
+    {
+        fillMemory((uint8_t *)UserHeapState, 0x0, sizeof(struct userHeapState));
+        UserHeapState->magic = USER_HEAP_MAGIC;
+        UserHeapState->top = USER_BRK_BASE;
+        UserHeapState->heapEnd = systemBrk(0);
+    }
+
+    return UserHeapState;
+}
+
+struct heapChunk *heapTakeChunk(struct userHeapState *UserHeapState, uint32_t chunkSize)
+{
+    // Large objects skip the free list, so they end up at the top, where freeing them gives the pages back
+    if (chunkSize >= USER_HEAP_LARGE_OBJECT)
+    {
+        return heapTakeFromTop(UserHeapState, chunkSize);
+    }
+
+    for (struct heapChunk *Chunk = UserHeapState->freeList; Chunk != 0; Chunk = Chunk->next)
+    {
+        if (Chunk->size < chunkSize)
+        {
+            continue;
+        }
+
+        heapListRemove(UserHeapState, Chunk);
+
+        if ((Chunk->size - chunkSize) >= USER_HEAP_MIN_CHUNK)
+        {
+            struct heapChunk *Remainder = (struct heapChunk*)((uint32_t)Chunk + chunkSize);
+
+            Remainder->size = Chunk->size - chunkSize;
+            Remainder->previousSize = chunkSize;
+            heapChunkResized(UserHeapState, Remainder);
+            heapListInsert(UserHeapState, Remainder);
+
+            Chunk->size = chunkSize;
+        }
+
+        Chunk->size = Chunk->size | USER_HEAP_IN_USE;
+
+        return Chunk;
+    }
+
+    return heapTakeFromTop(UserHeapState, chunkSize);
+}
+
+struct heapChunk *heapTakeFromTop(struct userHeapState *UserHeapState, uint32_t chunkSize)
+{
+    uint32_t available = UserHeapState->heapEnd - UserHeapState->top;
+
+    if (available < chunkSize)
+    {
+        uint32_t growth = chunkSize - available;
 
-        heapObjectPid = *(uint32_t *)(USER_HEAP + (HEAP_OBJ_SIZE * heapObjectNumber));
+        // Small and medium objects grow the heap USER_HEAP_GROWTH at a time, so most of them need no syscall. A large object maps only its own pages.
+        if (chunkSize < USER_HEAP_LARGE_OBJECT && growth < USER_HEAP_GROWTH)
+        {
+            growth = USER_HEAP_GROWTH;
+        }
 
-        if (heapObjectPid == currentPid)
+        if (growth > (USER_BRK_LIMIT - UserHeapState->heapEnd))
         {
-            fillMemory((uint8_t *)(USER_HEAP + (HEAP_OBJ_SIZE * heapObjectNumber)), 0x0, HEAP_OBJ_SIZE);
+            return 0;
         }
 
-        heapObjectNumber++;
+        uint32_t newBreak = ceiling(UserHeapState->heapEnd + growth, PAGE_SIZE) * PAGE_SIZE;
+        UserHeapState->heapEnd = systemBrk(newBreak);
+
+        if (UserHeapState->heapEnd != newBreak)
+        {
+            return 0;
+        }
+    }
+
+    struct heapChunk *Chunk = (struct heapChunk*)UserHeapState->top;
+
+    Chunk->size = chunkSize | USER_HEAP_IN_USE;
+    Chunk->previousSize = UserHeapState->lastChunkSize;
+    UserHeapState->lastChunkSize = chunkSize;
+    UserHeapState->top = UserHeapState->top + chunkSize;
+
+    return Chunk;
+}
+
+void heapChunkResized(struct userHeapState *UserHeapState, struct heapChunk *Chunk)
+{
+    uint32_t nextChunk = (uint32_t)Chunk + (Chunk->size & ~USER_HEAP_FLAGS);
+
+    if (nextChunk == UserHeapState->top)
+    {
+        UserHeapState->lastChunkSize = Chunk->size & ~USER_HEAP_FLAGS;
+    }
+    else
+    {
+        ((struct heapChunk*)nextChunk)->previousSize = Chunk->size & ~USER_HEAP_FLAGS;
+    }
+}
+
+void heapListInsert(struct userHeapState *UserHeapState, struct heapChunk *Chunk)
+{
+    Chunk->previous = 0;
+    Chunk->next = UserHeapState->freeList;
+
+    if (Chunk->next != 0)
+    {
+        Chunk->next->previous = Chunk;
+    }
+
+    UserHeapState->freeList = Chunk;
+}
+
+void heapListRemove(struct userHeapState *UserHeapState, struct heapChunk *Chunk)
+{
+    if (Chunk->previous != 0)
+    {
+        Chunk->previous->next = Chunk->next;
+    }
+    else
+    {
+        UserHeapState->freeList = Chunk->next;
+    }
+
+    if (Chunk->next != 0)
+    {
+        Chunk->next->previous = Chunk->previous;
     }
 }
 
 
+void initializeKernelHeap()
+{
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+
+    // Every list empty (KMALLOC_NO_SLAB) and every frame KMALLOC_NOT_HEAP
+    fillMemory((uint8_t *)KernelHeapState, 0xFF, sizeof(struct kernelHeapState));
+    fillMemory((uint8_t *)KernelHeapState->heapFrames, 0x0, sizeof(KernelHeapState->heapFrames));
+    KernelHeapState->objectsInUse = 0;
+}
+
 uint8_t *kMalloc(uint32_t currentPid, uint32_t objectSize)
 {
-    // Heap entries take up 16 bytes each, but 1 byte is the PID that owns it.
-    // So, heap items cannot exceed 15 bytes (including null byte for strings)
-    // If you need more than this, use mmap to get 4,096 bytes
-    uint8_t heapObjectNumber = 0;
-    struct heapObject *HeapObject = (struct heapObject*)KERNEL_HEAP;
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+    uint8_t owner = (uint8_t)currentPid;
+    uint32_t sizeClass = 0;
 
-    if (objectSize > HEAP_OBJ_USABLE_SIZE)
+    // One byte more than asked for, so strings copied in with their strlen() are still terminated
+    if (objectSize >= (KMALLOC_MAX_FRAMES_PER_PID * PAGE_SIZE))
     {
         return 0;
     }
 
-    while (heapObjectNumber < MAX_HEAP_OBJECTS)
+    // Large objects take a run of contiguous frames. Only the first frame's descriptor is used, and it holds the length of the run.
+    if ((objectSize + 1) > KMALLOC_MAX_OBJECT_SIZE)
     {
-        if (HeapObject->pid == 0)
+        uint32_t numberOfFrames = ceiling(objectSize + 1, PAGE_SIZE);
+
+        if ((KernelHeapState->heapFrames[owner] + numberOfFrames) > KMALLOC_MAX_FRAMES_PER_PID)
         {
-            HeapObject->pid = (uint8_t)currentPid;
-            return &HeapObject->heapUseable[0];    
+            return 0;
         }
-        heapObjectNumber++;
-        HeapObject++;
+
+        uint32_t frameNumber = allocateKernelFrames(numberOfFrames);
+
+        if (frameNumber == 0)
+        {
+            return 0;
+        }
+
+        struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[frameNumber - (FRAME_METADATA_END / PAGE_SIZE)];
+        SlabDescriptor->sizeClass = KMALLOC_LARGE_OBJECT;
+        SlabDescriptor->owner = owner;
+        SlabDescriptor->freeObjects = (uint16_t)numberOfFrames;
+        KernelHeapState->heapFrames[owner] = KernelHeapState->heapFrames[owner] + numberOfFrames;
+        KernelHeapState->objectsInUse++;
+
+        return (uint8_t *)(frameNumber * PAGE_SIZE);
     }
-    // return null pointer if unable to find object
-    return 0;
+
+    while ((uint32_t)(KMALLOC_MIN_OBJECT_SIZE << sizeClass) < (objectSize + 1))
+    {
+        sizeClass++;
+    }
+
+    uint32_t objectBytes = KMALLOC_MIN_OBJECT_SIZE << sizeClass;
+    uint32_t slabIndex = KernelHeapState->partialSlab[owner][sizeClass];
+
+    if (slabIndex == KMALLOC_NO_SLAB)
+    {
+        // Slabs belong to one pid, so one pid spread over every size class could otherwise drain the kernel frame pool
+        if (KernelHeapState->heapFrames[owner] >= KMALLOC_MAX_FRAMES_PER_PID)
+        {
+            return 0;
+        }
+
+        uint32_t frameNumber = allocateKernelFrame();
+
+        if (frameNumber == 0)
+        {
+            return 0;
+        }
+
+        slabIndex = frameNumber - (FRAME_METADATA_END / PAGE_SIZE);
+
+        struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+        SlabDescriptor->sizeClass = (uint8_t)sizeClass;
+        SlabDescriptor->owner = owner;
+        SlabDescriptor->freeObject = 0;
+        SlabDescriptor->freeObjects = (uint16_t)(PAGE_SIZE / objectBytes);
+
+        // Threading the free list is the only pass over a slab, and it happens once per frame
+        for (uint32_t object = 0; object < SlabDescriptor->freeObjects; object++)
+        {
+            *(uint16_t *)((frameNumber * PAGE_SIZE) + (object * objectBytes)) = (uint16_t)(object + 1);
+        }
+
+        KernelHeapState->heapFrames[owner]++;
+        slabListInsert(slabIndex);
+    }
+
+    struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+    uint8_t *heapObject = (uint8_t *)(((slabIndex + (FRAME_METADATA_END / PAGE_SIZE)) * PAGE_SIZE) + (SlabDescriptor->freeObject * objectBytes));
+
+    SlabDescriptor->freeObject = *(uint16_t *)heapObject;
+    SlabDescriptor->freeObjects--;
+
+    if (SlabDescriptor->freeObjects == 0)
+    {
+        slabListRemove(slabIndex);
+    }
+
+    KernelHeapState->objectsInUse++;
+    fillMemory(heapObject, 0x0, objectBytes);
+
+    return heapObject;
 }
 
 void kFree(uint8_t *heapObject)
 {
-    fillMemory((heapObject - 1), 0x0, HEAP_OBJ_SIZE); // minus 4 to remove the entire entry, including pid
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+
+    if ((uint32_t)heapObject < FRAME_METADATA_END || (uint32_t)heapObject >= KERNEL_FRAME_POOL_END)
+    {
+        panic((uint8_t *)"simpleOSlibc.cpp:kFree() -> not a kernel heap object");
+    }
+
+    uint32_t frameNumber = (uint32_t)heapObject / PAGE_SIZE;
+    uint32_t slabIndex = frameNumber - (FRAME_METADATA_END / PAGE_SIZE);
+    struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+
+    if (SlabDescriptor->sizeClass == KMALLOC_NOT_HEAP)
+    {
+        panic((uint8_t *)"simpleOSlibc.cpp:kFree() -> not a kernel heap object");
+    }
+
+    KernelHeapState->objectsInUse--;
+
+    if (SlabDescriptor->sizeClass == KMALLOC_LARGE_OBJECT)
+    {
+        KernelHeapState->heapFrames[SlabDescriptor->owner] = KernelHeapState->heapFrames[SlabDescriptor->owner] - SlabDescriptor->freeObjects;
+        SlabDescriptor->sizeClass = KMALLOC_NOT_HEAP;
+        freeKernelFrames(frameNumber, SlabDescriptor->freeObjects);
+        return;
+    }
+
+    uint32_t objectBytes = KMALLOC_MIN_OBJECT_SIZE << SlabDescriptor->sizeClass;
+
+    *(uint16_t *)heapObject = SlabDescriptor->freeObject;
+    SlabDescriptor->freeObject = (uint16_t)(((uint32_t)heapObject % PAGE_SIZE) / objectBytes);
+    SlabDescriptor->freeObjects++;
+
+    if (SlabDescriptor->freeObjects == 1)
+    {
+        slabListInsert(slabIndex);
+    }
+
+    // An empty slab goes back to the pool, unless it is the only one left, so a kMalloc()/kFree() pair does not cost a frame each time
+    if (SlabDescriptor->freeObjects == (PAGE_SIZE / objectBytes) && (SlabDescriptor->nextSlab != KMALLOC_NO_SLAB || SlabDescriptor->previousSlab != KMALLOC_NO_SLAB))
+    {
+        slabListRemove(slabIndex);
+        KernelHeapState->heapFrames[SlabDescriptor->owner]--;
+        SlabDescriptor->sizeClass = KMALLOC_NOT_HEAP;
+        freeKernelFrame(frameNumber);
+    }
 }
 
 void kFreeAll(uint32_t currentPid)
 {
-    uint32_t heapObjectNumber = 0;
-    uint32_t heapObjectPid = 0;
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
 
-    while (heapObjectNumber < MAX_HEAP_OBJECTS)
+    for (uint32_t slabIndex = 0; slabIndex < KERNEL_FRAME_POOL_FRAMES; slabIndex++)
     {
+        struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+
+        if (SlabDescriptor->sizeClass == KMALLOC_NOT_HEAP || SlabDescriptor->owner != (uint8_t)currentPid)
+        {
+            continue;
+        }
 
-        heapObjectPid = *(uint32_t *)(KERNEL_HEAP + (HEAP_OBJ_SIZE * heapObjectNumber));
+        uint32_t numberOfFrames = 1;
 
-        if (heapObjectPid == currentPid)
+        if (SlabDescriptor->sizeClass == KMALLOC_LARGE_OBJECT)
+        {
+            KernelHeapState->objectsInUse--;
+            numberOfFrames = SlabDescriptor->freeObjects;
+        }
+        else
         {
-            fillMemory((uint8_t *)(KERNEL_HEAP + (HEAP_OBJ_SIZE * heapObjectNumber)), 0x0, HEAP_OBJ_SIZE);
+            KernelHeapState->objectsInUse = KernelHeapState->objectsInUse - ((PAGE_SIZE / (KMALLOC_MIN_OBJECT_SIZE << SlabDescriptor->sizeClass)) - SlabDescriptor->freeObjects);
+
+            if (SlabDescriptor->freeObjects != 0)
+            {
+                slabListRemove(slabIndex);
+            }
         }
 
-        heapObjectNumber++;
+        SlabDescriptor->sizeClass = KMALLOC_NOT_HEAP;
+        freeKernelFrames(slabIndex + (FRAME_METADATA_END / PAGE_SIZE), numberOfFrames);
     }
+
+    KernelHeapState->heapFrames[(uint8_t)currentPid] = 0;
+}
+
+uint32_t kernelHeapObjects()
+{
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+
+    return KernelHeapState->objectsInUse;
+}
+
+void slabListInsert(uint32_t slabIndex)
+{
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+    struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+    uint16_t *head = &KernelHeapState->partialSlab[SlabDescriptor->owner][SlabDescriptor->sizeClass];
+
+    SlabDescriptor->nextSlab = *head;
+    SlabDescriptor->previousSlab = KMALLOC_NO_SLAB;
+
+    if (*head != KMALLOC_NO_SLAB)
+    {
+        KernelHeapState->slab[*head].previousSlab = (uint16_t)slabIndex;
+    }
+
+    *head = (uint16_t)slabIndex;
+}
+
+void slabListRemove(uint32_t slabIndex)
+{
+    struct kernelHeapState *KernelHeapState = (struct kernelHeapState*)KERNEL_HEAP_STATE;
+    struct slabDescriptor *SlabDescriptor = &KernelHeapState->slab[slabIndex];
+
+    if (SlabDescriptor->previousSlab != KMALLOC_NO_SLAB)
+    {
+        KernelHeapState->slab[SlabDescriptor->previousSlab].nextSlab = SlabDescriptor->nextSlab;
+    }
+    else
+    {
+        KernelHeapState->partialSlab[SlabDescriptor->owner][SlabDescriptor->sizeClass] = SlabDescriptor->nextSlab;
+    }
+
+    if (SlabDescriptor->nextSlab != KMALLOC_NO_SLAB)
+    {
+        KernelHeapState->slab[SlabDescriptor->nextSlab].previousSlab = SlabDescriptor->previousSlab;
+    }
+
+    SlabDescriptor->nextSlab = KMALLOC_NO_SLAB;
+    SlabDescriptor->previousSlab = KMALLOC_NO_SLAB;
 }
 
 uint32_t stringHash(uint8_t *messagetoHash)
@@ -318,13 +744,53 @@ void systemFree()
 
 uint8_t *systemMMap()
 {
-    uint32_t returnedPage;
     uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
-    sysCall(SYS_MMAP, 0x0, myPid);
-    returnedPage = readValueFromMemLoc(RETURNED_MMAP_PAGE_LOC);
-    myPid = readValueFromMemLoc(RUNNING_PID_LOC);
 
-    return (uint8_t *)returnedPage;
+    return (uint8_t *)sysCall(SYS_MMAP, 0x0, myPid);
+}
+
+uint32_t systemBrk(uint32_t newBreak)
+{
+    uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    return sysCall(SYS_BRK, newBreak, myPid);
+}
+
+uint8_t *systemMMapRange(uint8_t *address, uint32_t length, uint32_t protection, uint32_t flags)
+{
+    uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    struct mmapParameter *MmapParameter = (struct mmapParameter *)(malloc(myPid, sizeof(mmapParameter)));
+    MmapParameter->address = (uint32_t)address;
+    MmapParameter->length = length;
+    MmapParameter->protection = protection;
+    MmapParameter->flags = flags;
+    uint8_t *returnedRange = (uint8_t *)sysCall(SYS_MMAP_RANGE, (uint32_t)MmapParameter, myPid);
+
+    free((uint8_t *)MmapParameter);
+
+    return returnedRange;
+}
+
+bool systemMUnmap(uint8_t *address, uint32_t length)
+{
+    uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    struct mmapParameter *MmapParameter = (struct mmapParameter *)(malloc(myPid, sizeof(mmapParameter)));
+    MmapParameter->address = (uint32_t)address;
+    MmapParameter->length = length;
+    bool unmapped = (sysCall(SYS_MUNMAP, (uint32_t)MmapParameter, myPid) != 0);
+
+    free((uint8_t *)MmapParameter);
+
+    return unmapped;
+}
+
+void systemIdle()
+{
+    uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    sysCall(SYS_IDLE, 0x0, myPid);
 }
 
 void systemSwitchToParent()
@@ -382,6 +848,18 @@ void systemForkExec(uint8_t *fileName, uint32_t requestedRunPriority)
     free((uint8_t *)FileParameter);
 }
 
+uint32_t systemFork()
+{
+    uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    // The kernel writes the result here in both processes, so it has to live in memory and not in a register
+    volatile uint32_t forkedPid = 0;
+    sysCall(SYS_FORK, (uint32_t)&forkedPid, myPid);
+    myPid = readValueFromMemLoc(RUNNING_PID_LOC);
+
+    return forkedPid;
+}
+
 void systemKill(uint8_t *pidToKill)
 {
     uint32_t myPid = readValueFromMemLoc(RUNNING_PID_LOC);
@@ -528,24 +1006,14 @@ uint8_t *directoryEntryTypeTranslation(uint8_t type)
 
 uint32_t countHeapObjects(uint8_t *heapLoc)
 {
-    uint32_t heapObjectNumber = 0;
-    uint8_t lastUsedObj = *(uint8_t *)(heapLoc + (HEAP_OBJ_SIZE * heapObjectNumber));
-    uint32_t objectCount = 0;
+    struct userHeapState *UserHeapState = (struct userHeapState*)heapLoc;
 
-    while (heapObjectNumber < MAX_HEAP_OBJECTS)
-    {      
-        lastUsedObj = *(uint8_t *)(heapLoc + (HEAP_OBJ_SIZE * heapObjectNumber));
-
-        if ((uint8_t)lastUsedObj != 0)
-        {
-            objectCount++;
-            
-        }
-        heapObjectNumber++;
-
-    } 
+    if (UserHeapState->magic != USER_HEAP_MAGIC)
+    {
+        return 0;
+    }
 
-    return objectCount;
+    return UserHeapState->objectsInUse;
 }
 
 uint32_t convertToUnixTime(struct time* Time)
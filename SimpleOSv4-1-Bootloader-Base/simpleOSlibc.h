@@ -5,16 +5,73 @@
 #include "constants.h"
 
 /**
- * This is the heap object. It is used for both user heap objects and kernel heap objects.
+ * The header of a chunk of the user heap. Chunks lie back to back from USER_BRK_BASE to the top, so the next chunk starts size bytes on and the previous one previousSize bytes back.
  */
-struct heapObject
+struct heapChunk
 {
-    /** The PID is stored and used as a non-zero indicator to allow the heap allocator to know if that heap object position is used. This is done for user and kernel heap objects alike. */
-    uint8_t pid; 
-    /** The size of the heap object. If you need more use systemMMap() instead. */
-    uint8_t heapUseable[HEAP_OBJ_USABLE_SIZE];
-    /** Always left null to accommodate string null bytes */
-    uint8_t nullByte; 
+    /** The size of the chunk, header included, a multiple of USER_HEAP_MIN_CHUNK. The low bits hold USER_HEAP_IN_USE and USER_HEAP_SMALL. */
+    uint32_t size;
+    /** The size of the chunk in front of this one, or 0 for the first chunk. */
+    uint32_t previousSize;
+    /** The next chunk on the free list or small bin. Only there while the chunk is free, as the object starts here. */
+    struct heapChunk *next;
+    /** The previous chunk on the free list. Not used by the small bins. */
+    struct heapChunk *previous;
+};
+
+/**
+ * The user heap of a process, kept in its USER_HEAP page. The chunks come from the program break region, which the heap grows and shrinks with systemBrk().
+ */
+struct userHeapState
+{
+    /** USER_HEAP_MAGIC once the heap is set up. The kernel hands out the USER_HEAP page zeroed. */
+    uint32_t magic;
+    /** The number of objects handed out and not freed yet. */
+    uint32_t objectsInUse;
+    /** Where the next chunk is cut from the unused end of the heap. */
+    uint32_t top;
+    /** The size of the chunk in front of the top, or 0 if the heap is empty. */
+    uint32_t lastChunkSize;
+    /** The program break. Memory from top to here is mapped and unused. */
+    uint32_t heapEnd;
+    /** Freed small chunks of size USER_HEAP_MIN_CHUNK << sizeClass, which keep their size and are never merged. */
+    struct heapChunk *smallBin[USER_HEAP_SMALL_CLASSES];
+    /** Freed medium and large chunks, merged with any free neighbour. */
+    struct heapChunk *freeList;
+};
+
+/**
+ * What the kernel heap knows about one frame of the kernel frame pool. A slab is one frame cut into objects of one size class, all owned by one pid.
+ */
+struct slabDescriptor
+{
+    /** The next slab with free objects of the same owner and size class, or KMALLOC_NO_SLAB. */
+    uint16_t nextSlab;
+    /** The previous slab on the same list, or KMALLOC_NO_SLAB. */
+    uint16_t previousSlab;
+    /** The index of the first free object. Each free object holds the index of the next one in its first two bytes. */
+    uint16_t freeObject;
+    /** The number of free objects in the slab, or the number of frames of a large object. */
+    uint16_t freeObjects;
+    /** The object size is KMALLOC_MIN_OBJECT_SIZE << sizeClass. KMALLOC_LARGE_OBJECT for the first frame of an object of one or more whole pages, KMALLOC_NOT_HEAP if the frame is not the heap's or is the tail of a large object. */
+    uint8_t sizeClass;
+    /** The pid the objects belong to, so kFreeAll() can drop its slabs. */
+    uint8_t owner;
+};
+
+/**
+ * The kernel heap at KERNEL_HEAP_STATE. Slabs come from the kernel frame pool, so a slab's descriptor is found from an object's address in constant time.
+ */
+struct kernelHeapState
+{
+    /** The number of objects handed out and not freed yet. */
+    uint32_t objectsInUse;
+    /** The number of kernel frame pool frames each pid's slabs and large objects hold, capped at KMALLOC_MAX_FRAMES_PER_PID. */
+    uint16_t heapFrames[0x100];
+    /** The first slab with free objects for each owner and size class, or KMALLOC_NO_SLAB. */
+    uint16_t partialSlab[0x100][KMALLOC_SIZE_CLASSES];
+    /** One descriptor per kernel frame pool frame, in frame order. */
+    struct slabDescriptor slab[KERNEL_FRAME_POOL_FRAMES];
 };
 
 /**
@@ -71,13 +128,21 @@ void strcpy(uint8_t *destinationString, uint8_t *sourceString);
 void strcpyRemoveNewline(uint8_t *destinationString, uint8_t *sourceString);
 
 /**
- * Copy bytes from one location to another in memory.
+ * Copy bytes from one location to another in memory, with memoryCopy(). The ranges must not overlap, see memoryMove().
  * \param destinationMemory The target location in memory.
  * \param sourceMemory The source location in memory.
  * \param numberOfBytes How many bytes to copy from source to target.
  */
 void bytecpy(uint8_t *destinationMemory, uint8_t *sourceMemory, uint32_t numberOfBytes);
 
+/**
+ * Copy bytes from one location to another in memory, where the ranges may overlap. Copies back to front with memoryCopyBackward() when the target starts inside the source.
+ * \param destinationMemory The target location in memory.
+ * \param sourceMemory The source location in memory.
+ * \param numberOfBytes How many bytes to copy from source to target.
+ */
+void memoryMove(uint8_t *destinationMemory, uint8_t *sourceMemory, uint32_t numberOfBytes);
+
 /**
  * Convert an integer to an ASCII-equivalent string value of that integer.
  * \param number The integer to convert.
@@ -99,28 +164,73 @@ uint32_t atoi(uint8_t *sourceString);
 uint32_t ceiling(uint32_t number, uint32_t base);
 
 /**
- * Allocate a user heap object.
- * \param currentPid The current pid. This is needed to show whether or not the heap object is allocated even though all objects in the same PID will have the same value.
- * \param objectSize The size of the object requested. If this requested size is larger than the heap object, a null pointer is returned. Be sure to check for that. If you need a larger object, use systemMMap().
+ * Allocate a user heap object. Objects that fit a small chunk, up to USER_HEAP_SMALL_MAX_CHUNK with the header and a null byte, come from a size class bin. Bigger ones are cut first-fit from the free list, and large ones, from USER_HEAP_LARGE_OBJECT, straight from the top so that freeing them can give the pages back. The heap grows with systemBrk() only when none of these has room. The object is zeroed. Returns a pointer to the object, or 0 if memory runs out. Be sure to check for that.
+ * \param currentPid The current pid. Unused, as every process has its own heap.
+ * \param objectSize The size of the object requested.
  */
 uint8_t *malloc(uint32_t currentPid, uint32_t objectSize);
 
 /**
- * Free a heap object. See malloc().
+ * Free a heap object. See malloc(). A small object goes back to its bin, and any other merges with its free neighbours. When the free memory at the top of the heap passes twice USER_HEAP_GROWTH, the heap shrinks. Null pointers, pointers outside the heap and objects already freed are ignored.
  * \param heapObject The pointer to the heap object you want to free.
  */
 void free(uint8_t *heapObject);
 
 /**
- * Free all heap objects for a certain PID. Be very careful with this as it can lead to many memory problems, such as use-after-free (UAF) bugs.
- * \param currentPid The current PID.
+ * Free all heap objects of the process. Be very careful with this as it can lead to many memory problems, such as use-after-free (UAF) bugs. The heap pages stay mapped, so stale pointers do not fault, they just share memory with the next objects.
+ * \param currentPid The current PID. Unused, as every process has its own heap.
  */
 void freeAll(uint32_t currentPid);
 
 /**
- * The kernel equivalent of malloc(). See kFree() also. The object size and parameters are the same as the userspace heap but the objects exist in kernel space and are for kernel use. Returns a pointer in kernel space if successful.
+ * Returns the user heap of the running process, setting it up on first use.
+ */
+struct userHeapState *userHeap();
+
+/**
+ * Returns a chunk of the user heap that is marked in use, from the free list or the top. Returns 0 if memory runs out.
+ * \param UserHeapState The user heap.
+ * \param chunkSize The chunk size, header included, a multiple of USER_HEAP_MIN_CHUNK.
+ */
+struct heapChunk *heapTakeChunk(struct userHeapState *UserHeapState, uint32_t chunkSize);
+
+/**
+ * Cuts a chunk from the top of the user heap, moving the program break up if the mapped memory is too small. Returns 0 if memory runs out.
+ * \param UserHeapState The user heap.
+ * \param chunkSize The chunk size, header included, a multiple of USER_HEAP_MIN_CHUNK.
+ */
+struct heapChunk *heapTakeFromTop(struct userHeapState *UserHeapState, uint32_t chunkSize);
+
+/**
+ * Records a chunk's new size in the chunk after it, or in the heap state if the top follows it.
+ * \param UserHeapState The user heap.
+ * \param Chunk The chunk that changed size.
+ */
+void heapChunkResized(struct userHeapState *UserHeapState, struct heapChunk *Chunk);
+
+/**
+ * Adds a chunk to the front of the user heap free list.
+ * \param UserHeapState The user heap.
+ * \param Chunk The free chunk.
+ */
+void heapListInsert(struct userHeapState *UserHeapState, struct heapChunk *Chunk);
+
+/**
+ * Takes a chunk off the user heap free list.
+ * \param UserHeapState The user heap.
+ * \param Chunk The free chunk.
+ */
+void heapListRemove(struct userHeapState *UserHeapState, struct heapChunk *Chunk);
+
+/**
+ * Empties the kernel heap. Called once by kInit(), after the frame allocator is up.
+ */
+void initializeKernelHeap();
+
+/**
+ * The kernel equivalent of malloc(). See kFree() also. Objects come from the smallest power of two size class, 16 bytes to 2 KB, that holds objectSize plus a null byte, so a string of strlen() bytes stays terminated. Larger objects get a run of contiguous pages. A pid holds at most KMALLOC_MAX_FRAMES_PER_PID frames of the kernel frame pool. The object is zeroed. Returns a pointer in kernel space if successful, or 0.
  * \param currentPid The pid associated with the object. This is important as you want to free all kernel heap objects associated with a killed/zombie/exited process.
- * \param objectSize The requested size of the heap object. Same as malloc().
+ * \param objectSize The requested size of the heap object.
  */
 uint8_t *kMalloc(uint32_t currentPid, uint32_t objectSize);
 
@@ -136,6 +246,23 @@ void kFree(uint8_t *heapObject);
  */
 void kFreeAll(uint32_t currentPid);
 
+/**
+ * Returns the number of kernel heap objects in use.
+ */
+uint32_t kernelHeapObjects();
+
+/**
+ * Adds a slab to the front of its owner's list for its size class.
+ * \param slabIndex The slab's index in kernelHeapState.slab[].
+ */
+void slabListInsert(uint32_t slabIndex);
+
+/**
+ * Takes a slab off its owner's list for its size class.
+ * \param slabIndex The slab's index in kernelHeapState.slab[].
+ */
+void slabListRemove(uint32_t slabIndex);
+
 /**
  * Generates a simple hash based on an input string. Not cryptographically secure.
  * \param messageToHash The input string.
@@ -169,6 +296,33 @@ void systemFree();
  */
 uint8_t *systemMMap();
 
+/**
+ * The LibC wrapper for the SYS_BRK sysCall(). Moves the program break, the end of the region from USER_BRK_BASE that malloc() takes its memory from. Returns the resulting break, which stays where it was if memory runs out.
+ * \param newBreak The requested break, up to USER_BRK_LIMIT. 0 only returns the current break.
+ */
+uint32_t systemBrk(uint32_t newBreak);
+
+/**
+ * The LibC wrapper for the SYS_MMAP_RANGE sysCall(). Returns a pointer to a range of new pages of user space memory, or 0 if there is no room. The pages read as zero.
+ * \param address 0 to let the kernel place the range, where it fits best, or the page aligned address the range must start at.
+ * \param length The length of the range in bytes, rounded up to whole pages.
+ * \param protection MMAP_PROT_READ, optionally with MMAP_PROT_WRITE.
+ * \param flags MMAP_POPULATE to map every page now. With 0 the pages are mapped one at a time as they are first touched, so untouched pages cost nothing.
+ */
+uint8_t *systemMMapRange(uint8_t *address, uint32_t length, uint32_t protection, uint32_t flags);
+
+/**
+ * The LibC wrapper for the SYS_MUNMAP sysCall(). Unmaps a range from systemMMapRange() or systemMMap(), or part of one. Returns false if the range is not page aligned or not in user space.
+ * \param address The start of the range.
+ * \param length The length of the range in bytes, rounded up to whole pages.
+ */
+bool systemMUnmap(uint8_t *address, uint32_t length);
+
+/**
+ * The LibC wrapper for the SYS_IDLE sysCall(). Lets the kernel zero free frames ahead of time. Call it before waiting for input.
+ */
+void systemIdle();
+
 /**
  * The LibC wrapper for the SYS_SWITCH_TASK_TO_PARENT sysCall(). This will switch to the parent, putting the child to sleep without terminating the child process.
  */
@@ -201,6 +355,11 @@ void systemSchedulerToggle();
  */
 void systemForkExec(uint8_t *fileName, uint32_t requestedRunPriority);
 
+/**
+ * The LibC wrapper for the SYS_FORK sysCall(). This will clone the running process, sharing its memory copy-on-write. Returns 0 in the child and the child's pid in the parent. The child runs first, like with systemForkExec().
+ */
+uint32_t systemFork();
+
 /**
  * The LibC wrapper for the SYS_KILL sysCall(). This will kill a process. You cannot kill yourself and you cannot kill PID=1.
  * \param pidToKill The PID to kill.
@@ -268,7 +427,7 @@ uint8_t *directoryEntryTypeTranslation(uint8_t type);
 
 /**
  * Counts the number of active heap objects. Returns the count.
- * \param heapLoc The pointer to the heap location.
+ * \param heapLoc The pointer to the user heap state, USER_HEAP.
  */
 uint32_t countHeapObjects(uint8_t *heapLoc);
 
@@ -0,0 +1,172 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "stripe.h"
+#include "fs.h"
+#include "vm.h"
+#include "constants.h"
+#include "exceptions.h"
+
+bool stripeInitialize()
+{
+    struct stripeVolume *StripeVolume = (struct stripeVolume*)STRIPE_STATE;
+    struct ext2SuperBlock *SuperBlock = (struct ext2SuperBlock*)(STRIPE_STATE + BLOCK_SIZE);
+
+    fillMemory((uint8_t *)STRIPE_STATE, 0x0, PAGE_SIZE);
+
+    // The boot disk is the primary master, so the members are whichever of the other three positions have a drive
+    for (uint32_t drive = STRIPE_FIRST_MEMBER; drive < MAX_ATA_DRIVES && StripeVolume->members < STRIPE_MAX_MEMBERS; drive++)
+    {
+        uint32_t memberBlocks = diskTotalSectors(drive) / SECTORS_PER_BLOCK;
+
+        memberBlocks = memberBlocks - (memberBlocks % STRIPE_CHUNK_BLOCKS);
+
+        if (memberBlocks == 0)
+        {
+            continue;
+        }
+
+        if (StripeVolume->members == 0 || memberBlocks < StripeVolume->memberBlocks)
+        {
+            StripeVolume->memberBlocks = memberBlocks;
+        }
+
+        StripeVolume->memberDrive[StripeVolume->members] = drive;
+        StripeVolume->members++;
+    }
+
+    if (StripeVolume->members < 2)
+    {
+        return false;
+    }
+
+    // The superblock is volume block 1, so it sits in the first chunk of the first member
+    stripeReadBlocks(1, 1, (uint8_t *)SuperBlock);
+
+    if (SuperBlock->sb_ext2_signature != EXT2_SIGNATURE)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void stripeMapBlock(uint32_t blockNumber, uint32_t *drive, uint32_t *sectorNumber)
+{
+    struct stripeVolume *StripeVolume = (struct stripeVolume*)STRIPE_STATE;
+
+    uint32_t chunk = blockNumber / STRIPE_CHUNK_BLOCKS;
+    uint32_t memberChunk = chunk / StripeVolume->members;
+
+    if (memberChunk >= (StripeVolume->memberBlocks / STRIPE_CHUNK_BLOCKS))
+    {
+        panic((uint8_t *)"stripe.cpp:stripeMapBlock() -> block past end of volume");
+    }
+
+    *drive = StripeVolume->memberDrive[chunk % StripeVolume->members];
+    *sectorNumber = ((memberChunk * STRIPE_CHUNK_BLOCKS) + (blockNumber % STRIPE_CHUNK_BLOCKS)) * SECTORS_PER_BLOCK;
+}
+
+void stripeReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    // One outstanding command per channel, since the master and slave share the channel's registers
+    struct stripePendingTransfer pendingTransfer[2];
+
+    pendingTransfer[0].drive = MAX_ATA_DRIVES;
+    pendingTransfer[1].drive = MAX_ATA_DRIVES;
+
+    while (numberOfBlocks > 0)
+    {
+        uint32_t blocksThisChunk = STRIPE_CHUNK_BLOCKS - (blockNumber % STRIPE_CHUNK_BLOCKS);
+
+        if (blocksThisChunk > numberOfBlocks)
+        {
+            blocksThisChunk = numberOfBlocks;
+        }
+
+        uint32_t drive;
+        uint32_t sectorNumber;
+        stripeMapBlock(blockNumber, &drive, &sectorNumber);
+
+        struct stripePendingTransfer *PendingTransfer = &pendingTransfer[drive / 2];
+
+        if (PendingTransfer->drive != MAX_ATA_DRIVES)
+        {
+            if (!diskReadData(PendingTransfer->drive, PendingTransfer->numberOfSectors, PendingTransfer->memory))
+            {
+                panic((uint8_t *)"stripe.cpp:stripeReadBlocks() -> member drive reported an error");
+            }
+        }
+
+        diskIssueCommand(drive, sectorNumber, blocksThisChunk * SECTORS_PER_BLOCK, ATA_READ, ATA_READ_EXT);
+        PendingTransfer->drive = drive;
+        PendingTransfer->numberOfSectors = blocksThisChunk * SECTORS_PER_BLOCK;
+        PendingTransfer->memory = destinationMemory;
+
+        destinationMemory = destinationMemory + (blocksThisChunk * BLOCK_SIZE);
+        blockNumber = blockNumber + blocksThisChunk;
+        numberOfBlocks = numberOfBlocks - blocksThisChunk;
+    }
+
+    for (uint32_t channel = 0; channel < 2; channel++)
+    {
+        if (pendingTransfer[channel].drive != MAX_ATA_DRIVES)
+        {
+            if (!diskReadData(pendingTransfer[channel].drive, pendingTransfer[channel].numberOfSectors, pendingTransfer[channel].memory))
+            {
+                panic((uint8_t *)"stripe.cpp:stripeReadBlocks() -> member drive reported an error");
+            }
+        }
+    }
+}
+
+void stripeWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    while (numberOfBlocks > 0)
+    {
+        uint32_t blocksThisChunk = STRIPE_CHUNK_BLOCKS - (blockNumber % STRIPE_CHUNK_BLOCKS);
+
+        if (blocksThisChunk > numberOfBlocks)
+        {
+            blocksThisChunk = numberOfBlocks;
+        }
+
+        uint32_t drive;
+        uint32_t sectorNumber;
+        stripeMapBlock(blockNumber, &drive, &sectorNumber);
+
+        // The drive commits this chunk while we feed the next one to the other channel. diskIssueCommand() waits for it if the next chunk is on the same channel.
+        diskIssueCommand(drive, sectorNumber, blocksThisChunk * SECTORS_PER_BLOCK, ATA_WRITE, ATA_WRITE_EXT);
+
+        if (!diskWriteData(drive, blocksThisChunk * SECTORS_PER_BLOCK, sourceMemory))
+        {
+            panic((uint8_t *)"stripe.cpp:stripeWriteBlocks() -> member drive reported an error");
+        }
+
+        sourceMemory = sourceMemory + (blocksThisChunk * BLOCK_SIZE);
+        blockNumber = blockNumber + blocksThisChunk;
+        numberOfBlocks = numberOfBlocks - blocksThisChunk;
+    }
+
+    stripeFlush();
+}
+
+void stripeFlush()
+{
+    struct stripeVolume *StripeVolume = (struct stripeVolume*)STRIPE_STATE;
+
+    for (uint32_t member = 0; member < StripeVolume->members; member++)
+    {
+        diskFlushCache(StripeVolume->memberDrive[member]);
+    }
+}
+
+void stripeGeometry(struct blockDeviceGeometry *Geometry)
+{
+    struct stripeVolume *StripeVolume = (struct stripeVolume*)STRIPE_STATE;
+
+    Geometry->blockSize = BLOCK_SIZE;
+    Geometry->totalBlocks = StripeVolume->memberBlocks * StripeVolume->members;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "constants.h"
+/**
+ * The RAID-0 volume state. This lives at STRIPE_STATE so the kernel can keep using a volume that bootloader stage 2 assembled.
+ * The volume is split into chunks of STRIPE_CHUNK_BLOCKS blocks, and chunk N is stored on member N % members at member chunk N / members.
+ */
+struct stripeVolume
+{
+    /** The number of ATA drives in the volume. */
+    uint32_t members;
+    /** The ATA drive number of each member, in stripe order. */
+    uint32_t memberDrive[STRIPE_MAX_MEMBERS];
+    /** The number of EXT2 blocks used on each member, which is the smallest member rounded down to a whole chunk. */
+    uint32_t memberBlocks;
+};
+
+/**
+ * A chunk transfer that has been issued to a drive but whose data has not been moved yet.
+ */
+struct stripePendingTransfer
+{
+    /** The ATA drive number, or MAX_ATA_DRIVES if nothing is pending on the channel. */
+    uint32_t drive;
+    /** The number of sectors the command transfers. */
+    uint32_t numberOfSectors;
+    /** Where the sectors go. */
+    uint8_t *memory;
+};
+
+/** Probes the ATA drives from STRIPE_FIRST_MEMBER onward and builds a volume from the ones present. Returns false unless there are at least two members holding an EXT2 file system. */
+bool stripeInitialize();
+
+/** Converts a volume block number into the member drive that holds it and the first sector of the block on that drive.
+ * \param blockNumber The EXT2 block number on the volume.
+ * \param drive Receives the ATA drive number of the member.
+ * \param sectorNumber Receives the LBA sector on the member.
+ */
+void stripeMapBlock(uint32_t blockNumber, uint32_t *drive, uint32_t *sectorNumber);
+
+/** Reads consecutive EXT2 blocks from the volume. A chunk read is issued on one ATA channel while the chunk on the other channel is still being read, so the two channels work at the same time.
+ * \param blockNumber The first EXT2 block number on the volume.
+ * \param numberOfBlocks The number of blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks.
+ */
+void stripeReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/** Writes consecutive EXT2 blocks to the volume and flushes every member.
+ * \param blockNumber The first EXT2 block number on the volume.
+ * \param numberOfBlocks The number of blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write.
+ */
+void stripeWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
+/** Flushes the write cache of every member. */
+void stripeFlush();
+
+/** Fills in the geometry of the volume, which is memberBlocks times the number of members.
+ * \param Geometry The geometry structure to fill in.
+ */
+void stripeGeometry(struct blockDeviceGeometry *Geometry);
@@ -17,6 +17,7 @@
 #include "file.h"
 #include "schedule.h"
 #include "sound.h"
+#include "trap.h"
 
 
 uint32_t returnedArgument = 0;
@@ -67,7 +68,7 @@ void sysOpen(struct fileParameter *FileParameter, uint32_t currentPid)
         }
     }
 
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t taskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *Task = (struct task*)taskStructLocation;
 
     if (Task->nextAvailableFileDescriptor >= MAX_FILE_DESCRIPTORS) 
@@ -92,20 +93,25 @@ void sysOpen(struct fileParameter *FileParameter, uint32_t currentPid)
     struct inode *Inode = (struct inode*)inodePage;
     uint32_t pagesNeedForTmpBinary = ceiling(Inode->i_size, PAGE_SIZE);
 
-    uint8_t *requestedBuffer = findBuffer(currentPid, pagesNeedForTmpBinary, PG_USER_PRESENT_RW);
+    uint8_t *requestedBuffer = reserveVirtualRange(currentPid, 0, pagesNeedForTmpBinary);
+
+    if (requestedBuffer == 0)
+    {
+        clearScreen();
+        printString(COLOR_RED, 2, 2, (uint8_t *)"No room for the file buffer");
+        panic((uint8_t *)"syscalls.cpp -> file buffer range request");
+    }
 
     //request block of pages for temporary file storage to load file based on first available page above
     for (uint32_t pageCount = 0; pageCount < pagesNeedForTmpBinary; pageCount++)
     {                
-        if (!requestSpecificPage(currentPid, (uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), PG_USER_PRESENT_RW))
+        // Each page comes zeroed in case its frame has been used previously
+        if (!requestZeroedPage(currentPid, (uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), PG_USER_PRESENT_RW))
         {
             clearScreen();
             printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
             panic((uint8_t *)"syscalls.cpp -> USER_TEMP_FILE_LOC page request");
         }
-
-        // Zero each page in case it has been used previously
-        fillMemory((uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), 0x0, PAGE_SIZE);
     }
 
     loadFileFromInodeStruct((uint8_t *)inodePage, requestedBuffer);
@@ -133,7 +139,7 @@ void sysOpen(struct fileParameter *FileParameter, uint32_t currentPid)
 
 void sysWrite(uint32_t fileDescriptorToPrint, uint32_t currentPid)
 {
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t taskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *Task = (struct task*)taskStructLocation;
 
     if ((uint32_t)Task->fileDescriptor[fileDescriptorToPrint] == 0x0)
@@ -161,7 +167,7 @@ void sysClose(uint32_t fileDescriptor, uint32_t currentPid)
 
 void sysPs(uint32_t currentPid)
 {
-    uint32_t currentTaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t currentTaskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *currentTask = (struct task*)currentTaskStructLocation;
         
     uint32_t lastUsedPid = 0;
@@ -169,8 +175,6 @@ void sysPs(uint32_t currentPid)
     uint32_t cursor = 1;
     uint32_t taskStructNumber = 0;
 
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC; 
-
     if (uint8_t *totalFramesCount = kMalloc(currentPid, sizeof(int)))
     {
         printString(COLOR_GREEN, cursor++, 2, (uint8_t *)"System Frames Used: ");
@@ -254,7 +258,7 @@ void sysPs(uint32_t currentPid)
     if (uint8_t *kernelHeapObjectCount = kMalloc(currentPid, sizeof(int)))
     {
         printString(COLOR_GREEN, cursor++, 38, (uint8_t *)"Kernel Heap Objects: ");
-        itoa(countHeapObjects((uint8_t *)KERNEL_HEAP), kernelHeapObjectCount);
+        itoa(kernelHeapObjects(), kernelHeapObjectCount);
         printString(COLOR_LIGHT_BLUE, cursor-1, 70, kernelHeapObjectCount); 
         kFree(kernelHeapObjectCount);
     }
@@ -291,11 +295,9 @@ void sysPs(uint32_t currentPid)
 
     while (taskStructNumber < MAX_PROCESSES)
     {
-        taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * taskStructNumber);;
-    
-        struct task *Task = (struct task*)taskStructLocation;
+        struct task *Task = taskStruct(taskStructNumber + 1);
         
-        lastUsedPid = *(uint32_t *)(PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * taskStructNumber));
+        lastUsedPid = (Task == 0) ? 0 : Task->pid;
 
         if ((uint32_t)lastUsedPid == 0)
         {
@@ -370,9 +372,36 @@ void sysForkExec(struct fileParameter *FileParameter, uint32_t currentPid)
     uint8_t *newBinaryFilenameLoc = kMalloc(currentPid, strlen(FileParameter->fileName)); 
     strcpyRemoveNewline(newBinaryFilenameLoc, FileParameter->fileName);
 
-    if (!fsFindFile(newBinaryFilenameLoc, USER_TEMP_INODE_LOC))
+    // A warm exec is served entirely from the exec cache, without reading the directory, the inode table or the file
+    struct execCacheEntry *ExecCacheEntry = execCacheFind(newBinaryFilenameLoc);
+
+    if (ExecCacheEntry == 0)
     {
-        printString(COLOR_RED, 2, 5, (uint8_t *)"File not found!");
+        if (!fsFindFile(newBinaryFilenameLoc, USER_TEMP_INODE_LOC))
+        {
+            printString(COLOR_RED, 2, 5, (uint8_t *)"File not found!");
+            sysBeep();
+            sysWait();
+            sysWait();
+            return;
+        }
+
+        ExecCacheEntry = execCacheInsert(newBinaryFilenameLoc, USER_TEMP_INODE_LOC, returnInodeofFileName(newBinaryFilenameLoc));
+
+        if (ExecCacheEntry == 0)
+        {
+            printString(COLOR_RED, 2, 5, (uint8_t *)"File is not an ELF file!");
+            sysBeep();
+            sysWait();
+            sysWait();
+            return;
+        }
+    }
+
+    // The runtime library is an ELF file with nothing to run
+    if (ExecCacheEntry->entryPoint == 0)
+    {
+        printString(COLOR_RED, 2, 5, (uint8_t *)"File is not a program!");
         sysBeep();
         sysWait();
         sysWait();
@@ -383,6 +412,7 @@ void sysForkExec(struct fileParameter *FileParameter, uint32_t currentPid)
 
     newPid = initializeTask(currentPid, PROC_SLEEPING, STACK_START_LOC, newBinaryFilenameLoc, FileParameter->requestedRunPriority);
     initializePageTables(newPid);
+    markKernelPagesGlobal(newPid);
 
     contextSwitch(newPid);
 
@@ -400,7 +430,8 @@ void sysForkExec(struct fileParameter *FileParameter, uint32_t currentPid)
         panic((uint8_t *)"syscalls.cpp -> STACK_PAGE page request");
     }
 
-    if (!requestSpecificPage(newPid, (uint8_t *)(USER_HEAP), PG_USER_PRESENT_RW))
+    // The heap state lives in this page, and malloc() only trusts it when it starts zeroed
+    if (!requestZeroedPage(newPid, (uint8_t *)(USER_HEAP), PG_USER_PRESENT_RW))
     {
         clearScreen();
         printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
@@ -414,73 +445,99 @@ void sysForkExec(struct fileParameter *FileParameter, uint32_t currentPid)
         panic((uint8_t *)"syscalls.cpp -> USER_TEMP_INODE_LOC page request");
     }
    
-    // we do this function twice. First one (above) to make sure the file exists.
-    // this second one (below) is because there was a context switch and a different
-    // userspace.
-    fsFindFile(newBinaryFilenameLoc, USER_TEMP_INODE_LOC);
+    // No segment pages are mapped here. pageFault() maps each page the first time the process touches it.
+    uint32_t entryPoint = mapElfSegments(ExecCacheEntry, newPid);
 
-    struct inode *Inode = (struct inode*)USER_TEMP_INODE_LOC;
+    updateTaskState(currentPid, PROC_SLEEPING);
+    updateTaskState(newPid, PROC_RUNNING);
 
-    uint32_t pagesNeedForTmpBinary = ceiling(Inode->i_size, PAGE_SIZE);
+    // Letting the new process know its pid
+    storeValueAtMemLoc(RUNNING_PID_LOC, newPid);
+
+    enableInterrupts();
+    
+    switchToRing3LaunchBinary((uint8_t *)entryPoint);
+
+}
+
+void sysForkResult(uint32_t *forkedPid, uint32_t result, uint32_t currentPid)
+{
+    // The kernel honors read-only pages too, so a shared page is split first instead of faulting
+    if (pageTableEntry(currentPid, (uint32_t)forkedPid) & PG_COPY_ON_WRITE)
+    {
+        copyOnWritePage(currentPid, (uint32_t)forkedPid);
+    }
+
+    *forkedPid = result;
+}
 
-    //request pages for temporary file storage to load raw ELF file
-    for (uint32_t tempFileLoc = 0; tempFileLoc < (pagesNeedForTmpBinary * PAGE_SIZE); tempFileLoc = tempFileLoc + PAGE_SIZE)
+void sysFork(uint32_t *forkedPid, uint32_t currentPid)
+{
+    if ((uint32_t)forkedPid >= KERNEL_BASE)
     {
-        if (!requestSpecificPage(newPid, (USER_TEMP_FILE_LOC + tempFileLoc), PG_USER_PRESENT_RW))
-        {
-            clearScreen();
-            printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
-            panic((uint8_t *)"syscalls.cpp -> USER_TEMP_FILE_LOC page request");
-        }
+        return;
     }
 
-    loadFileFromInodeStruct(USER_TEMP_INODE_LOC, USER_TEMP_FILE_LOC); 
+    uint32_t resultPage = pageTableEntry(currentPid, (uint32_t)forkedPid);
 
-    if (*(uint32_t *)USER_TEMP_FILE_LOC != MAGIC_ELF)
+    if (!(resultPage & PAGE_PRESENT) || !(resultPage & (PAGE_WRITABLE | PG_COPY_ON_WRITE)))
     {
-        printString(COLOR_RED, 2, 5, (uint8_t *)"File is not an ELF file!");
-        sysBeep();
-        sysWait();
-        sysWait();
-        sysKill(newPid);
-        contextSwitch(currentPid);
         return;
     }
 
-    struct elfHeader *ELFHeader = (struct elfHeader*)USER_TEMP_FILE_LOC;
-    struct pHeader *ProgHeaderTextSegment, *ProgHeaderDataSegment;
-    ProgHeaderTextSegment = (struct pHeader*)((uint8_t *)(uint32_t)ELFHeader + ELFHeader->e_phoff + ELF_PROGRAM_HEADER_SIZE);
-    ProgHeaderDataSegment = (struct pHeader*)((uint8_t *)(uint32_t)ELFHeader + (ELFHeader->e_phoff + (ELF_PROGRAM_HEADER_SIZE *2)));
+    uint32_t parentTaskStructLocation = (uint32_t)taskStruct(currentPid);
+    struct task *ParentTask = (struct task*)parentTaskStructLocation;
+
+    uint8_t *childBinaryName = kMalloc(currentPid, strlen(ParentTask->binaryName));
+    strcpy(childBinaryName, ParentTask->binaryName);
+
+    // The result is written twice, before and after the page is shared. The child's copy keeps the 0 and the parent's copy gets the child's pid.
+    sysForkResult(forkedPid, 0, currentPid);
+
+    uint32_t childPid = initializeTask(currentPid, PROC_SLEEPING, ParentTask->stack, childBinaryName, ParentTask->priority);
+    uint32_t childTaskStructLocation = (uint32_t)taskStruct(childPid);
+    struct task *ChildTask = (struct task*)childTaskStructLocation;
 
-    uint32_t totalTextSegmentPagesNeeded = ceiling(ProgHeaderTextSegment->p_memsz, PAGE_SIZE);
-    uint32_t totalDataSegmentPagesNeeded = ceiling(ProgHeaderDataSegment->p_memsz, PAGE_SIZE);
+    // syscallHandler() saved where the parent returns to, so the child returns to the same place
+    ChildTask->uid = ParentTask->uid;
+    ChildTask->nice = ParentTask->nice;
+    ChildTask->eip = ParentTask->eip;
+    ChildTask->esp = ParentTask->esp;
+    ChildTask->eax = ParentTask->eax;
+    ChildTask->ebp = ParentTask->ebp;
+    ChildTask->cs = ParentTask->cs;
+    ChildTask->ds = ParentTask->ds;
 
-    // request enough pages at the required virtual address to load and run binary
-    for (uint32_t tempFileLoc = 0; tempFileLoc < ((totalTextSegmentPagesNeeded + totalDataSegmentPagesNeeded) * PAGE_SIZE); tempFileLoc = tempFileLoc + PAGE_SIZE)
+    // Pages the parent never touched still demand load from the same executable
+    bytecpy((uint8_t *)processExecMapping(childPid), (uint8_t *)processExecMapping(currentPid), EXEC_MAPPING_SIZE);
+    bytecpy((uint8_t *)processVirtualAreas(childPid), (uint8_t *)processVirtualAreas(currentPid), sizeof(struct virtualAreas));
+
+    duplicatePageTables(currentPid, childPid);
+
+    // The file buffers are at the same addresses in the child. A file stays locked for writing by the parent only.
+    for (uint32_t fileDescriptor = 3; fileDescriptor < ParentTask->nextAvailableFileDescriptor; fileDescriptor++)
     {
-        if (!requestSpecificPage(newPid, (uint8_t *)(ProgHeaderTextSegment->p_vaddr + tempFileLoc), PG_USER_PRESENT_RW))
+        struct openFileTableEntry *OpenFileTableEntry = (openFileTableEntry*)(uint32_t)ParentTask->fileDescriptor[fileDescriptor];
+
+        if (OpenFileTableEntry != 0)
         {
-            clearScreen();
-            printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
-            panic((uint8_t *)"syscalls.cpp -> USERPROG VADDR page requests");
+            ChildTask->fileDescriptor[fileDescriptor] = (openFileTableEntry *)insertOpenFileTableEntry((uint8_t *)OPEN_FILE_TABLE, OpenFileTableEntry->inode, childPid, OpenFileTableEntry->userspaceBuffer, OpenFileTableEntry->numberOfPagesForBuffer, OpenFileTableEntry->fileName, 0, OpenFileTableEntry->offset);
         }
-
     }
-    
-    loadElfFile(USER_TEMP_FILE_LOC);
 
-    struct elfHeader *ELFHeaderLaunch = (struct elfHeader*)USER_TEMP_FILE_LOC;
+    ChildTask->nextAvailableFileDescriptor = ParentTask->nextAvailableFileDescriptor;
+    ChildTask->programBreak = ParentTask->programBreak;
 
+    sysForkResult(forkedPid, childPid, currentPid);
+
+    // Like sysForkExec(), the child runs until it exits or switches back to the parent
     updateTaskState(currentPid, PROC_SLEEPING);
-    updateTaskState(newPid, PROC_RUNNING);
+    updateTaskState(childPid, PROC_RUNNING);
 
     // Letting the new process know its pid
-    storeValueAtMemLoc(RUNNING_PID_LOC, newPid);
-
-    enableInterrupts();
-    
-    switchToRing3LaunchBinary((uint8_t *)ELFHeaderLaunch->e_entry);
+    storeValueAtMemLoc(RUNNING_PID_LOC, childPid);
 
+    contextSwitch(childPid);
 }
 
 void sysExit(uint32_t currentPid)
@@ -490,7 +547,7 @@ void sysExit(uint32_t currentPid)
         return; // PID 1 cannot exit
     }
     
-    uint32_t currentTaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t currentTaskStructLocation = (uint32_t)taskStruct(currentPid);
     
     struct task *currentTask = (struct task*)currentTaskStructLocation;
 
@@ -499,6 +556,9 @@ void sysExit(uint32_t currentPid)
 
     closeAllFiles((uint8_t *)OPEN_FILE_TABLE, currentPid);
 
+    // Shared text and data frames go back as soon as the process is done with them, since other processes may still map them
+    releaseSharedPages(currentPid);
+
     // Letting the new process know its pid
     storeValueAtMemLoc(RUNNING_PID_LOC, (currentTask->ppid));
 
@@ -523,7 +583,114 @@ void sysMmap(uint32_t currentPid)
         panic((uint8_t *)"syscalls.cpp -> MMAP - when requesting available page.");
     }
 
-    storeValueAtMemLoc(RETURNED_MMAP_PAGE_LOC, returnedPage);
+    markMmapPage(currentPid, returnedPage);
+
+    taskStruct(currentPid)->syscallResult = returnedPage;
+}
+
+void sysBrk(uint32_t newBreak, uint32_t currentPid)
+{
+    struct task *Task = taskStruct(currentPid);
+
+    // 0, or a break outside the region, only asks where the break is
+    if (newBreak >= USER_BRK_BASE && newBreak <= USER_BRK_LIMIT)
+    {
+        uint32_t currentEnd = ceiling(Task->programBreak, PAGE_SIZE) * PAGE_SIZE;
+        uint32_t newEnd = ceiling(newBreak, PAGE_SIZE) * PAGE_SIZE;
+
+        for (uint32_t page = currentEnd; page < newEnd; page = page + PAGE_SIZE)
+        {
+            // Out of memory leaves the break where it was, so the caller sees that it did not move
+            if (!requestZeroedPage(currentPid, (uint8_t *)page, PG_USER_PRESENT_RW))
+            {
+                releasePages(currentPid, currentEnd, (page - currentEnd) / PAGE_SIZE);
+                newBreak = Task->programBreak;
+                break;
+            }
+        }
+
+        if (newEnd < currentEnd)
+        {
+            releasePages(currentPid, newEnd, (currentEnd - newEnd) / PAGE_SIZE);
+        }
+
+        Task->programBreak = newBreak;
+    }
+
+    Task->syscallResult = Task->programBreak;
+}
+
+void sysMmapRange(struct mmapParameter *MmapParameter, uint32_t currentPid)
+{
+    uint32_t numberOfPages = ceiling(MmapParameter->length, PAGE_SIZE);
+    uint8_t perms = PG_USER_PRESENT_RO;
+
+    if (MmapParameter->protection & MMAP_PROT_WRITE)
+    {
+        perms = PG_USER_PRESENT_RW;
+    }
+
+    uint8_t *requestedBuffer = reserveVirtualRange(currentPid, MmapParameter->address, numberOfPages);
+
+    if (requestedBuffer == 0)
+    {
+        return;
+    }
+
+    for (uint32_t pageCount = 0; pageCount < numberOfPages; pageCount++)
+    {
+        uint32_t page = (uint32_t)requestedBuffer + (pageCount * PAGE_SIZE);
+
+        // Without MMAP_POPULATE nothing is mapped now, and a page that is never touched never takes a frame
+        if (!(MmapParameter->flags & MMAP_POPULATE))
+        {
+            reservePage(currentPid, page, perms);
+            continue;
+        }
+
+        if (!requestZeroedPage(currentPid, (uint8_t *)page, perms))
+        {
+            releasePages(currentPid, (uint32_t)requestedBuffer, pageCount);
+
+            // The range was just reserved, so it always has room to go back
+            releaseVirtualRange(currentPid, (uint32_t)requestedBuffer, numberOfPages);
+            return;
+        }
+    }
+
+    taskStruct(currentPid)->syscallResult = (uint32_t)requestedBuffer;
+}
+
+void sysMunmap(struct mmapParameter *MmapParameter, uint32_t currentPid)
+{
+    uint32_t numberOfPages = ceiling(MmapParameter->length, PAGE_SIZE);
+
+    if ((MmapParameter->address & ~PAGE_FRAME_MASK) != 0 || numberOfPages == 0)
+    {
+        return;
+    }
+
+    // The mapping region also gets the addresses back. Outside it only single sysMmap() pages can go, never text, stack or the heap page.
+    if (MmapParameter->address >= USER_MMAP_BASE && MmapParameter->address < USER_MMAP_LIMIT && numberOfPages <= ((USER_MMAP_LIMIT - MmapParameter->address) / PAGE_SIZE))
+    {
+        // A full free range table fails the call and leaves the pages mapped
+        if (!releaseVirtualRange(currentPid, MmapParameter->address, numberOfPages))
+        {
+            return;
+        }
+
+        releasePages(currentPid, MmapParameter->address, numberOfPages);
+    }
+    else if (numberOfPages == 1 && (pageTableEntry(currentPid, MmapParameter->address) & PG_MMAP_PAGE))
+    {
+        releasePages(currentPid, MmapParameter->address, numberOfPages);
+    }
+    else
+    {
+        return;
+    }
+
+    taskStruct(currentPid)->syscallResult = 1;
 }
 
 void sysKill(uint32_t pidToKill)
@@ -566,7 +733,7 @@ void sysSwitchToParent(uint32_t currentPid)
 {
     currentPid = readValueFromMemLoc(RUNNING_PID_LOC);
     
-    uint32_t currentTaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t currentTaskStructLocation = (uint32_t)taskStruct(currentPid);
     
     struct task *currentTask = (struct task*)currentTaskStructLocation;
 
@@ -587,9 +754,10 @@ void sysWait()
     
     uint32_t futureSystemTimerInterruptCount = (systemTimerInterruptCount + SYSTEM_INTERRUPTS_PER_SECOND);
     
+    // The time would otherwise be spent spinning, so it zeroes frames for later allocations
     while (systemTimerInterruptCount <= futureSystemTimerInterruptCount)
     {
-
+        refillZeroedFrames(1);
     } 
     disableInterrupts();
 }
@@ -602,22 +770,25 @@ void sysWaitOneInterrupt()
     
     uint32_t futureSystemTimerInterruptCount = (systemTimerInterruptCount + 1);
     
+    // The time would otherwise be spent spinning, so it zeroes frames for later allocations
     while (systemTimerInterruptCount <= futureSystemTimerInterruptCount)
     {
-
+        refillZeroedFrames(1);
     } 
     disableInterrupts();
 }
 
+void sysIdle()
+{
+    refillZeroedFrames(ZEROED_POOL_SIZE);
+}
+
 void sysDirectory(uint32_t currentPid)
 {
     uint32_t cursor = 0;
     
     fillMemory((uint8_t *)KERNEL_TEMP_INODE_LOC, 0x0, (PAGE_SIZE * 2));
-    readBlock(ROOTDIR_BLOCK, (uint8_t *)KERNEL_TEMP_INODE_LOC);
-    readBlock(ROOTDIR_BLOCK +1, (uint8_t *)(KERNEL_TEMP_INODE_LOC + BLOCK_SIZE));
-    readBlock(ROOTDIR_BLOCK +2, (uint8_t *)(KERNEL_TEMP_INODE_LOC + (BLOCK_SIZE *2)));
-    readBlock(ROOTDIR_BLOCK +3, (uint8_t *)(KERNEL_TEMP_INODE_LOC + (BLOCK_SIZE *3)));
+    readBlocks(ROOTDIR_BLOCK, 4, (uint8_t *)KERNEL_TEMP_INODE_LOC);
 
     struct directoryEntry *DirectoryEntry = (directoryEntry*)(KERNEL_TEMP_INODE_LOC);
     struct ext2SuperBlock *Ext2SuperBlock = (ext2SuperBlock*)SUPERBLOCK_LOC;
@@ -674,7 +845,7 @@ void sysDirectory(uint32_t currentPid)
         printString(COLOR_WHITE, (cursor++), 2, psVerticalLine);
         printHexNumber(COLOR_LIGHT_BLUE, (cursor-1), 4, (uint8_t)DirectoryEntry->directoryInode);
 
-        memoryCopy((uint8_t *)&DirectoryEntry->fileName, directoryFilename, 6);
+        memoryCopy((uint8_t *)&DirectoryEntry->fileName, directoryFilename, strlen((uint8_t *)&DirectoryEntry->fileName));
         printString(COLOR_WHITE, (cursor-1), 8, directoryFilename);
             
         fsFindFile(directoryFilename, EXT2_TEMP_INODE_STRUCTS);
@@ -789,7 +960,7 @@ void sysToggleScheduler()
 }
 void sysShowOpenFiles(uint32_t currentPid)
 {
-    uint32_t currentTaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t currentTaskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *currentTask = (struct task*)currentTaskStructLocation;
     
     struct openFileTableEntry *OpenFileTableEntry = (struct openFileTableEntry*)OPEN_FILE_TABLE;
@@ -839,7 +1010,7 @@ void sysOpenEmpty(struct fileParameter *FileParameter, uint32_t currentPid)
     uint8_t *newBinaryFilenameLoc = kMalloc(currentPid, FileParameter->fileNameLength);
     strcpyRemoveNewline(newBinaryFilenameLoc, FileParameter->fileName);
 
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t taskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *Task = (struct task*)taskStructLocation;
 
     if (Task->nextAvailableFileDescriptor >= MAX_FILE_DESCRIPTORS) 
@@ -849,20 +1020,25 @@ void sysOpenEmpty(struct fileParameter *FileParameter, uint32_t currentPid)
 
     uint32_t pagesNeedForTmpBinary = FileParameter->requestedSizeInPages;
 
-    uint8_t *requestedBuffer = findBuffer(currentPid, pagesNeedForTmpBinary, PG_USER_PRESENT_RW);
+    uint8_t *requestedBuffer = reserveVirtualRange(currentPid, 0, pagesNeedForTmpBinary);
+
+    if (requestedBuffer == 0)
+    {
+        clearScreen();
+        printString(COLOR_RED, 2, 2, (uint8_t *)"No room for the file buffer");
+        panic((uint8_t *)"syscalls.cpp -> file buffer range request");
+    }
 
     //request block of pages for temporary file storage to load file based on first available page above
     for (uint32_t pageCount = 0; pageCount < pagesNeedForTmpBinary; pageCount++)
     {                
-        if (!requestSpecificPage(currentPid, (uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), PG_USER_PRESENT_RW))
+        // Each page comes zeroed in case its frame has been used previously
+        if (!requestZeroedPage(currentPid, (uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), PG_USER_PRESENT_RW))
         {
             clearScreen();
             printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
             panic((uint8_t *)"syscalls.cpp -> USER_TEMP_FILE_LOC page request");
         }
-
-        // Zero each page in case it has been used previously
-        fillMemory((uint8_t *)((uint32_t)requestedBuffer + (pageCount * PAGE_SIZE)), 0x0, PAGE_SIZE);
     }
 
     Task->fileDescriptor[Task->nextAvailableFileDescriptor] = (openFileTableEntry *)insertOpenFileTableEntry((uint8_t *)OPEN_FILE_TABLE, (uint32_t)(0xFFFF), currentPid, requestedBuffer, pagesNeedForTmpBinary, newBinaryFilenameLoc, 0, 0);
@@ -883,6 +1059,7 @@ void syscallHandler()
     // This is very sensitive (guru code below).
     // Don't Touch!
     asm volatile ("pusha\n\t");
+    asm volatile ("cld\n\t");
    
     uint32_t syscallNumber;
     uint32_t arg1;
@@ -891,7 +1068,7 @@ void syscallHandler()
     asm volatile ("movl %%ebx, %0\n\t" : "=r" (arg1) : );
     asm volatile ("movl %%ecx, %0\n\t" : "=r" (currentPid) : );
 
-    sysHandlertaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    sysHandlertaskStructLocation = (uint32_t)taskStruct(currentPid);
     SysHandlerTask = (struct task*)sysHandlertaskStructLocation;
 
     // These manually grab from the stack are very sensitive to local variables.
@@ -922,6 +1099,9 @@ void syscallHandler()
     asm volatile ("add $72, %edx\n\t");
     asm volatile ("movl (%edx), %edx\n\t");
     asm volatile ("movl %%edx, %0\n\t" : "=r" ((uint32_t)(SysHandlerTask->esp)) : );
+
+    // A system call that has nothing to return leaves 0 in eax
+    SysHandlerTask->syscallResult = 0;
   
          if ((unsigned int)syscallNumber == SYS_SOUND)                  { sysSound((struct soundParameter *)arg1); }
     else if ((unsigned int)syscallNumber == SYS_OPEN)                   { sysOpen((struct fileParameter *)arg1, currentPid); }
@@ -945,11 +1125,16 @@ void syscallHandler()
     else if ((unsigned int)syscallNumber == SYS_CREATE)                 { sysCreate((struct fileParameter *)arg1, currentPid); }
     else if ((unsigned int)syscallNumber == SYS_DELETE)                 { sysDelete((struct fileParameter *)arg1, currentPid); }
     else if ((unsigned int)syscallNumber == SYS_OPEN_EMPTY)             { sysOpenEmpty((struct fileParameter *)arg1, currentPid); }
+    else if ((unsigned int)syscallNumber == SYS_FORK)                   { sysFork((uint32_t *)arg1, currentPid); }
+    else if ((unsigned int)syscallNumber == SYS_BRK)                    { sysBrk(arg1, currentPid); }
+    else if ((unsigned int)syscallNumber == SYS_MMAP_RANGE)             { sysMmapRange((struct mmapParameter *)arg1, currentPid); }
+    else if ((unsigned int)syscallNumber == SYS_MUNMAP)                 { sysMunmap((struct mmapParameter *)arg1, currentPid); }
+    else if ((unsigned int)syscallNumber == SYS_IDLE)                   { sysIdle(); }
 
     scheduler(currentPid);
 
     returnedPid = readValueFromMemLoc(RUNNING_PID_LOC);
-    newSysHandlertaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (returnedPid - 1));
+    newSysHandlertaskStructLocation = (uint32_t)taskStruct(returnedPid);
     newSysHandlerTask = (struct task*)newSysHandlertaskStructLocation;
 
     asm volatile ("popa\n\t");
@@ -979,6 +1164,9 @@ void syscallHandler()
 
     asm volatile ("movl %0, %%ebp\n\t" : : "r" ((uint32_t)newSysHandlerTask->ebp));
 
+    // The result goes back in eax, and it must be loaded last, since the lines above use eax as scratch
+    asm volatile ("movl %0, %%eax\n\t" : : "r" ((uint32_t)newSysHandlerTask->syscallResult));
+
     asm volatile ("iret\n\t");
 
 }
@@ -986,6 +1174,8 @@ void syscallHandler()
 void systemInterruptHandler()
 {    
     asm volatile ("pusha\n\t");
+    // The interrupted code may be in memoryCopyBackward() with the direction flag set, and iret restores it
+    asm volatile ("cld\n\t");
 
     uint8_t currentInterrupt = 0;
     uint32_t currentPid = readValueFromMemLoc(RUNNING_PID_LOC);
@@ -994,7 +1184,7 @@ void systemInterruptHandler()
 
     totalInterruptCount++;
 
-    uint32_t currentTaskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (currentPid - 1));
+    uint32_t currentTaskStructLocation = (uint32_t)taskStruct(currentPid);
     struct task *currentTask;
     currentTask = (struct task*)currentTaskStructLocation;
 
@@ -1002,16 +1192,16 @@ void systemInterruptHandler()
     currentTask->recentRuntime++;
 
     uint32_t taskStructNumber = 0;
-    struct task *Task = (struct task*)PROCESS_TABLE_LOC;
 
     while (taskStructNumber < MAX_PROCESSES)
     {
-        if (Task->state == PROC_SLEEPING)
+        struct task *Task = taskStruct(taskStructNumber + 1);
+
+        if (Task != 0 && Task->state == PROC_SLEEPING)
         {
             Task->sleepTime++;
         }
         taskStructNumber++;
-        Task++;
     }
 
 
@@ -31,7 +31,7 @@ void sysWrite(uint32_t fileDescriptorToPrint, uint32_t currentPid);
  */
 void sysOpen(struct fileParameter *FileParameter, uint32_t currentPid);
 
-/** The kernel routine to close a file.
+/** The kernel routine to close a file. The buffer's pages go back with releasePages() and its addresses with releaseVirtualRange().
  * \param fileDescriptor The file descriptor to close.
  * \param currentPid The pid of the process requesting this action.
  */
@@ -48,6 +48,37 @@ void sysPs(uint32_t currentPid);
 */
 void sysForkExec(struct fileParameter *FileParameter, uint32_t currentPid);
 
+/** Writes a fork result into the caller's address space, splitting off its own copy of the page first if it is shared.
+ * \param forkedPid The address of the result.
+ * \param result The value to write.
+ * \param currentPid The pid whose address space is loaded.
+ */
+void sysForkResult(uint32_t *forkedPid, uint32_t result, uint32_t currentPid);
+
+/** The kernel routine that clones the current process. The address space is shared copy-on-write, so the cost depends on the size of the page table and not on the memory in use. The child runs first and sees 0, and the parent sees the child's pid when it runs again.
+ * \param forkedPid Where the fork result is written, in the caller's address space.
+ * \param currentPid The pid of the process requesting this action.
+ */
+void sysFork(uint32_t *forkedPid, uint32_t currentPid);
+
+/** The kernel routine that moves the program break, the end of the user heap region that starts at USER_BRK_BASE. Pages are mapped and zeroed, or unmapped, between the old and new break. The resulting break is returned in eax, and it does not move if memory runs out.
+ * \param newBreak The requested break, up to USER_BRK_LIMIT. 0 only returns the current break.
+ * \param currentPid The pid of the process requesting this action.
+ */
+void sysBrk(uint32_t newBreak, uint32_t currentPid);
+
+/** The kernel routine that gives a process a range of pages with one call. reserveVirtualRange() picks the address in the mapping region, unless one is asked for. With MMAP_POPULATE every page is mapped and zeroed now, and otherwise the pages are reserved with reservePage() and filled on first touch. The address is returned in eax, or 0 if there is no room.
+ * \param MmapParameter The length, protection and flags of the range.
+ * \param currentPid The pid of the process requesting this action.
+ */
+void sysMmapRange(struct mmapParameter *MmapParameter, uint32_t currentPid);
+
+/** The kernel routine that unmaps a range of pages, mapped or only reserved, in the mapping region, or a single page from sysMmap(). A range in the mapping region can be reserved again. Returns 1 in eax, or 0 if the range is not page aligned or is neither of those.
+ * \param MmapParameter The address and length of the range.
+ * \param currentPid The pid of the process requesting this action.
+ */
+void sysMunmap(struct mmapParameter *MmapParameter, uint32_t currentPid);
+
 /** The kernel routine that exits the current process.
  * \param currentPid The pid of the process requesting this action.
  */
@@ -97,6 +128,9 @@ void sysWait();
 /** The kernel routine that waits for one interrupt. The length of this action varies based on the system's interrupts per second. */
 void sysWaitOneInterrupt();
 
+/** The kernel routine for a process with nothing to do until its next input, such as the shell at its prompt. Fills the zeroed frame pool, so later page requests skip zeroing. */
+void sysIdle();
+
 /** The kernel routine that prints the directory contents to the screen.
  * \param currentPid The pid of the process requesting this action.
  */
@@ -18,11 +18,264 @@
 #include "trap.h"
 #include "schedule.h"
 
+bool execMappingContains(struct execMapping *ExecMapping, uint32_t address)
+{
+    for (uint32_t segment = 0; segment < ExecMapping->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &ExecMapping->segment[segment];
+
+        if (address >= ExecSegment->virtualAddress && address < (ExecSegment->virtualAddress + ExecSegment->memorySize))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct execMapping *execMappingForAddress(uint32_t pid, uint32_t address)
+{
+    struct execMapping *ExecMapping = processExecMapping(pid);
+
+    if (execMappingContains(ExecMapping, address))
+    {
+        return ExecMapping;
+    }
+
+    // Programs are linked against the runtime library's fixed addresses, so it is in every address space without being mapped at exec
+    ExecMapping = (struct execMapping*)RUNTIME_LIBRARY_MAPPING;
+
+    if (execMappingContains(ExecMapping, address))
+    {
+        return ExecMapping;
+    }
+
+    return 0;
+}
+
+bool loadReservedPage(uint32_t pid, uint32_t faultAddress)
+{
+    uint32_t page = faultAddress & PAGE_FRAME_MASK;
+    uint32_t reservation = pageTableEntry(pid, page);
+
+    if (!(reservation & PG_RESERVED))
+    {
+        return false;
+    }
+
+    uint8_t perms = PG_USER_PRESENT_RO;
+
+    if (reservation & PAGE_WRITABLE)
+    {
+        perms = PG_USER_PRESENT_RW;
+    }
+
+    // requestZeroedPage() only takes a page nothing else claims
+    releasePages(pid, page, 1);
+
+    if (!requestZeroedPage(pid, (uint8_t *)page, perms))
+    {
+        panic((uint8_t *)"trap.cpp:loadReservedPage() -> no frame available");
+    }
+
+    return true;
+}
+
+bool loadDemandPage(uint32_t pid, uint32_t faultAddress)
+{
+    struct execMapping *ExecMapping = execMappingForAddress(pid, faultAddress);
+    uint32_t page = faultAddress & PAGE_FRAME_MASK;
+    bool writable = false;
+
+    if (ExecMapping == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t segment = 0; segment < ExecMapping->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &ExecMapping->segment[segment];
+
+        // A page shared by text and data has to be treated as data
+        if ((ExecSegment->flags & ELF_PF_WRITE) && page < (ExecSegment->virtualAddress + ExecSegment->memorySize) && (page + PAGE_SIZE) > ExecSegment->virtualAddress)
+        {
+            writable = true;
+        }
+    }
+
+    // Another process running the same file already has this page. Text is mapped read-only and data is copy-on-write, so read-only covers both.
+    uint32_t frameNumber = findSharedPage(ExecMapping->inodeNumber, ExecMapping->Inode.i_mtime, page);
+
+    if (frameNumber != 0)
+    {
+        referenceFrame(frameNumber);
+        mapPage(pid, page, frameNumber, PG_USER_PRESENT_RO);
+        ExecMapping->pagesShared++;
+        return true;
+    }
+
+    uint32_t loadEnd = page + PAGE_SIZE;
+
+    // A flat image keeps each segment in whole pages of the file, so the rest of the segment comes in with the same multi-block read
+    for (uint32_t segment = 0; ExecMapping->flatImage && segment < ExecMapping->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &ExecMapping->segment[segment];
+
+        while (faultAddress >= ExecSegment->virtualAddress && loadEnd < (ExecSegment->virtualAddress + ExecSegment->memorySize) && !(pageTableEntry(pid, loadEnd) & PAGE_PRESENT) && findSharedPage(ExecMapping->inodeNumber, ExecMapping->Inode.i_mtime, loadEnd) == 0)
+        {
+            loadEnd = loadEnd + PAGE_SIZE;
+        }
+    }
+
+    for (uint32_t loadPage = page; loadPage < loadEnd; loadPage = loadPage + PAGE_SIZE)
+    {
+        frameNumber = execCacheAllocateFrame(pid);
+
+        if (frameNumber == 0)
+        {
+            panic((uint8_t *)"trap.cpp:loadDemandPage() -> no frame available");
+        }
+
+        // The page stays writable until it is filled, since the kernel also honors read-only pages
+        mapPage(pid, loadPage, frameNumber, PG_USER_PRESENT_RW);
+        fillMemory((uint8_t *)loadPage, 0x0, PAGE_SIZE);
+    }
+
+    // Two segments of an ELF file can share a page, so every segment's file bytes that land in the pages are read
+    for (uint32_t segment = 0; segment < ExecMapping->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &ExecMapping->segment[segment];
+        uint32_t fileDataStart = ExecSegment->virtualAddress;
+        uint32_t fileDataEnd = ExecSegment->virtualAddress + ExecSegment->fileSize;
+
+        if (fileDataStart < page)
+        {
+            fileDataStart = page;
+        }
+
+        if (fileDataEnd > loadEnd)
+        {
+            fileDataEnd = loadEnd;
+        }
+
+        if (fileDataStart < fileDataEnd)
+        {
+            readFileRange(&ExecMapping->Inode, ExecSegment->fileOffset + (fileDataStart - ExecSegment->virtualAddress), (fileDataEnd - fileDataStart), (uint8_t *)fileDataStart);
+        }
+    }
+
+    for (uint32_t loadPage = page; loadPage < loadEnd; loadPage = loadPage + PAGE_SIZE)
+    {
+        frameNumber = pageTableEntry(pid, loadPage) / PAGE_SIZE;
+        ExecMapping->pagesLoaded++;
+
+        // The exec cache keeps its own reference, so the page outlives this process and a warm exec maps it without disk I/O
+        if (execCacheFindInode(ExecMapping->inodeNumber, ExecMapping->Inode.i_mtime) && insertSharedPage(ExecMapping->inodeNumber, ExecMapping->Inode.i_mtime, loadPage, frameNumber))
+        {
+            referenceFrame(frameNumber);
+            referenceFrame(frameNumber);
+            mapPage(pid, loadPage, frameNumber, PG_USER_PRESENT_RO);
+        }
+        else if (!writable)
+        {
+            mapPage(pid, loadPage, frameNumber, PG_USER_PRESENT_RO);
+        }
+    }
+
+    return true;
+}
+
+bool copyOnWritePage(uint32_t pid, uint32_t faultAddress)
+{
+    struct execMapping *ExecMapping = execMappingForAddress(pid, faultAddress);
+    uint32_t page = faultAddress & PAGE_FRAME_MASK;
+    uint32_t frameNumber = pageTableEntry(pid, page) / PAGE_SIZE;
+
+    // Pages shared by fork() are marked in the page table, since they need not belong to an exec segment
+    bool writable = (pageTableEntry(pid, page) & PG_COPY_ON_WRITE) != 0;
+
+    for (uint32_t segment = 0; ExecMapping != 0 && segment < ExecMapping->segments; segment++)
+    {
+        struct execSegment *ExecSegment = &ExecMapping->segment[segment];
+
+        if ((ExecSegment->flags & ELF_PF_WRITE) && faultAddress >= ExecSegment->virtualAddress && faultAddress < (ExecSegment->virtualAddress + ExecSegment->memorySize))
+        {
+            writable = true;
+        }
+    }
+
+    // Writing to text, or to a page that was never shared, is a real protection fault
+    if (!writable || frameReferences(frameNumber) == 0)
+    {
+        return false;
+    }
+
+    // The last reference can keep the frame once the exec cache has let go of it. It is dirty from now on, so nobody else may share it.
+    if (frameReferences(frameNumber) == 1)
+    {
+        claimSharedFrame(pid, frameNumber);
+        mapPage(pid, page, frameNumber, PG_USER_PRESENT_RW);
+        return true;
+    }
+
+    uint32_t newFrameNumber = execCacheAllocateFrame(pid);
+
+    if (newFrameNumber == 0)
+    {
+        panic((uint8_t *)"trap.cpp:copyOnWritePage() -> no frame available");
+    }
+
+    // Frames are only reachable through the page, so the copy goes through a kernel buffer while the page is remapped
+    bytecpy((uint8_t *)COPY_ON_WRITE_BUFFER, (uint8_t *)page, PAGE_SIZE);
+    mapPage(pid, page, newFrameNumber, PG_USER_PRESENT_RW);
+    bytecpy((uint8_t *)page, (uint8_t *)COPY_ON_WRITE_BUFFER, PAGE_SIZE);
+    freeFrame(frameNumber);
+
+    return true;
+}
+
 void pageFault()
 {
+    asm volatile ("pusha\n\t");
+    asm volatile ("cld\n\t");
+
     uint32_t cr2Value;
+    uint32_t errorCode;
     asm volatile ("movl %%cr2, %0\n\t" : "=r" (cr2Value) : );
 
+    // The CPU pushes an error code below the return address for a page fault
+    asm volatile ("movl 4(%%ebp), %0\n\t" : "=r" (errorCode) : );
+
+    // Each pid has its own page directory, so CR3 says which process faulted
+    uint32_t pid = pidForPageDirectory(readCR3() & PAGE_FRAME_MASK);
+
+    bool resolved = false;
+
+    // Touching a page of a demand paged executable for the first time, or writing to a copy-on-write page, is not an error
+    if (pid != 0)
+    {
+        if (!(errorCode & PAGE_FAULT_PRESENT) && (pageTableEntry(pid, cr2Value) & PG_RESERVED))
+        {
+            resolved = loadReservedPage(pid, cr2Value);
+        }
+        else if (!(errorCode & PAGE_FAULT_PRESENT))
+        {
+            resolved = loadDemandPage(pid, cr2Value);
+        }
+        else if (errorCode & PAGE_FAULT_WRITE)
+        {
+            resolved = copyOnWritePage(pid, cr2Value);
+        }
+    }
+
+    if (resolved)
+    {
+        asm volatile ("popa\n\t");
+        asm volatile ("leave\n\t");
+        asm volatile ("add $4, %esp\n\t");
+        asm volatile ("iret\n\t");
+    }
+
     // CR2 holds the virtual address that caused the page fault.
     // Printing the string representation of decimal value of the virtual address
     // in the panic message.
@@ -34,6 +287,7 @@ void pageFault()
 
 void generalProtectionFault()
 {
+    asm volatile ("cld\n\t");
     disableCursor();
     panic((uint8_t *)"General Protection Fault!");
 }
\ No newline at end of file
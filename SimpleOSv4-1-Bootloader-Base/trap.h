@@ -7,5 +7,35 @@
 /** The function referenced in the interrupt descriptor table when a page fault is detected. */
 void pageFault();
 
+/** Returns true if the address is inside one of the segments of an exec mapping.
+ * \param ExecMapping The exec mapping.
+ * \param address The virtual address.
+ */
+bool execMappingContains(struct execMapping *ExecMapping, uint32_t address);
+
+/** Returns the exec mapping that covers an address of a process: its own executable first, then the runtime library at RUNTIME_LIBRARY_MAPPING. Returns 0 if neither does.
+ * \param pid The pid.
+ * \param address The virtual address.
+ */
+struct execMapping *execMappingForAddress(uint32_t pid, uint32_t address);
+
+/** Resolves a page fault on a demand paged executable. If the address is inside one of the segments of the process's executable or of the runtime library, the page is mapped read-only from another process running the same file, or else loaded from the file into a new frame and offered to the shared page table. For a flat executable the rest of the segment's missing pages are loaded by the same read. Returns false if the address is not in a segment.
+ * \param pid The pid that faulted.
+ * \param faultAddress The virtual address from CR2.
+ */
+bool loadDemandPage(uint32_t pid, uint32_t faultAddress);
+
+/** Resolves a fault on a page reserved by reservePage() by mapping a zeroed frame with the permissions kept in the page table entry. Returns false if the page is not reserved.
+ * \param pid The pid that faulted.
+ * \param faultAddress The virtual address from CR2.
+ */
+bool loadReservedPage(uint32_t pid, uint32_t faultAddress);
+
+/** Resolves a write fault on a shared page of a writable exec segment, or on a page marked PG_COPY_ON_WRITE by fork, by giving the process its own copy. Returns false for any other protection fault.
+ * \param pid The pid that faulted.
+ * \param faultAddress The virtual address from CR2.
+ */
+bool copyOnWritePage(uint32_t pid, uint32_t faultAddress);
+
 /** The function referenced in the interrupt descriptor table when a general protection fault is detected. */
 void generalProtectionFault();
\ No newline at end of file
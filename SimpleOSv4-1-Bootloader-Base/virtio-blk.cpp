@@ -0,0 +1,258 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+#include "block-device.h"
+#include "virtio-blk.h"
+#include "pci.h"
+#include "vm.h"
+#include "x86.h"
+#include "constants.h"
+#include "exceptions.h"
+
+bool virtioBlockInitialize()
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+    struct pciDevice PciDevice;
+
+    if (!pciFindDevice(PCI_VENDOR_VIRTIO, PCI_DEVICE_VIRTIO_BLK_LEGACY, &PciDevice))
+    {
+        return false;
+    }
+
+    // Modern-only devices have no I/O BAR and are not supported
+    uint32_t bar0 = pciConfigRead(&PciDevice, PCI_CONFIG_BAR0);
+
+    if (!(bar0 & PCI_BAR_IO_SPACE))
+    {
+        return false;
+    }
+
+    fillMemory((uint8_t *)VIRTIO_BLK_STATE, 0x0, PAGE_SIZE);
+    VirtioBlockDevice->ioBase = bar0 & 0xFFFC;
+    VirtioBlockDevice->interruptLine = pciConfigRead(&PciDevice, PCI_CONFIG_INTERRUPT_LINE) & 0xFF;
+    pciEnableDevice(&PciDevice);
+
+    uint16_t ioBase = VirtioBlockDevice->ioBase;
+
+    // Reset, then tell the device we found it and know how to drive it
+    outputIOPort(ioBase + VIRTIO_DEVICE_STATUS, 0x0);
+    outputIOPort(ioBase + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outputIOPort(ioBase + VIRTIO_DEVICE_STATUS, (VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER));
+
+    uint32_t guestFeatures = inputIOPortLong(ioBase + VIRTIO_DEVICE_FEATURES) & VIRTIO_BLK_FEATURE_FLUSH;
+    outputIOPortLong(ioBase + VIRTIO_GUEST_FEATURES, guestFeatures);
+    VirtioBlockDevice->flushSupported = (guestFeatures != 0);
+
+    outputIOPortWord(ioBase + VIRTIO_QUEUE_SELECT, 0);
+    VirtioBlockDevice->queueSize = inputIOPortWord(ioBase + VIRTIO_QUEUE_SIZE);
+
+    if (VirtioBlockDevice->queueSize < VIRTIO_BLK_DESCRIPTORS_PER_REQUEST || VirtioBlockDevice->queueSize > VIRTIO_BLK_MAX_QUEUE_SIZE)
+    {
+        outputIOPort(ioBase + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    // The legacy interface takes the page frame number of a contiguous descriptor table, available ring and used ring
+    fillMemory((uint8_t *)VIRTIO_BLK_QUEUE, 0x0, VIRTIO_BLK_QUEUE_PAGES * PAGE_SIZE);
+    outputIOPortLong(ioBase + VIRTIO_QUEUE_ADDRESS, (VIRTIO_BLK_QUEUE / PAGE_SIZE));
+
+    VirtioBlockDevice->capacitySectors = inputIOPortLong(ioBase + VIRTIO_BLK_CONFIG_CAPACITY);
+
+    outputIOPort(ioBase + VIRTIO_DEVICE_STATUS, (VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK));
+
+    return true;
+}
+
+void virtioBlockBuildRequest(uint32_t request, uint32_t type, uint32_t sectorNumber, uint8_t *buffer, uint32_t length)
+{
+    struct virtqDescriptor *Descriptor = (struct virtqDescriptor*)VIRTIO_BLK_QUEUE;
+    struct virtioBlockRequestHeader *Header = (struct virtioBlockRequestHeader*)(VIRTIO_BLK_STATE + VIRTIO_BLK_HEADERS_OFFSET) + request;
+    uint8_t *requestStatus = (uint8_t *)(VIRTIO_BLK_STATE + VIRTIO_BLK_STATUS_OFFSET + request);
+    uint32_t descriptor = request * VIRTIO_BLK_DESCRIPTORS_PER_REQUEST;
+
+    Header->type = type;
+    Header->reserved = 0;
+    Header->sectorLow = sectorNumber;
+    Header->sectorHigh = 0;
+    *requestStatus = 0xFF;
+
+    // The header and status byte are in the identity mapped kernel region
+    Descriptor[descriptor].addressLow = (uint32_t)Header;
+    Descriptor[descriptor].addressHigh = 0;
+    Descriptor[descriptor].length = sizeof(struct virtioBlockRequestHeader);
+    Descriptor[descriptor].flags = VIRTQ_DESC_FLAG_NEXT;
+    Descriptor[descriptor].next = descriptor + 1;
+    descriptor++;
+
+    // The buffer may be a user address, so each page gets its own descriptor
+    while (length > 0)
+    {
+        uint32_t physicalAddress = virtualToPhysical(buffer);
+        uint32_t lengthInPage = PAGE_SIZE - (physicalAddress & (PAGE_SIZE - 1));
+
+        if (lengthInPage > length)
+        {
+            lengthInPage = length;
+        }
+
+        Descriptor[descriptor].addressLow = physicalAddress;
+        Descriptor[descriptor].addressHigh = 0;
+        Descriptor[descriptor].length = lengthInPage;
+        Descriptor[descriptor].flags = VIRTQ_DESC_FLAG_NEXT | ((type == VIRTIO_BLK_REQUEST_IN) ? VIRTQ_DESC_FLAG_WRITE : 0);
+        Descriptor[descriptor].next = descriptor + 1;
+        descriptor++;
+
+        buffer = buffer + lengthInPage;
+        length = length - lengthInPage;
+    }
+
+    Descriptor[descriptor].addressLow = (uint32_t)requestStatus;
+    Descriptor[descriptor].addressHigh = 0;
+    Descriptor[descriptor].length = 1;
+    Descriptor[descriptor].flags = VIRTQ_DESC_FLAG_WRITE;
+    Descriptor[descriptor].next = 0;
+}
+
+void virtioBlockSubmit(uint32_t numberOfRequests)
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+    uint32_t queueSize = VirtioBlockDevice->queueSize;
+    uint16_t *availableRing = (uint16_t *)(VIRTIO_BLK_QUEUE + (sizeof(struct virtqDescriptor) * queueSize));
+    uint32_t usedRingOffset = (sizeof(struct virtqDescriptor) * queueSize) + (sizeof(uint16_t) * (3 + queueSize));
+    usedRingOffset = (usedRingOffset + PAGE_SIZE - 1) & PAGE_FRAME_MASK;
+    volatile uint16_t *usedRing = (volatile uint16_t *)(VIRTIO_BLK_QUEUE + usedRingOffset);
+
+    // availableRing[0] is flags, [1] is the index and the ring entries start at [2]
+    for (uint32_t request = 0; request < numberOfRequests; request++)
+    {
+        availableRing[2 + (VirtioBlockDevice->availableIndex % queueSize)] = request * VIRTIO_BLK_DESCRIPTORS_PER_REQUEST;
+        VirtioBlockDevice->availableIndex++;
+    }
+
+    // The ring entries must be visible before the index that publishes them, and the index before the notify
+    asm volatile ("" : : : "memory");
+    availableRing[1] = (uint16_t)VirtioBlockDevice->availableIndex;
+    asm volatile ("" : : : "memory");
+
+    // One notify for the whole batch
+    outputIOPortWord(VirtioBlockDevice->ioBase + VIRTIO_QUEUE_NOTIFY, 0);
+    VirtioBlockDevice->notifyCount++;
+
+    // System calls run with interrupts off, so poll there. Otherwise sleep until the completion interrupt.
+    while (usedRing[1] != (uint16_t)VirtioBlockDevice->availableIndex)
+    {
+        if (readEFLAGS() & EFLAGS_INTERRUPT_ENABLE)
+        {
+            asm volatile ("hlt\n\t");
+        }
+    }
+
+    // Clears the interrupt line if we finished by polling
+    inputIOPort(VirtioBlockDevice->ioBase + VIRTIO_ISR_STATUS);
+
+    for (uint32_t request = 0; request < numberOfRequests; request++)
+    {
+        if (*(volatile uint8_t *)(VIRTIO_BLK_STATE + VIRTIO_BLK_STATUS_OFFSET + request) != VIRTIO_BLK_STATUS_OK)
+        {
+            panic((uint8_t *)"virtio-blk.cpp:virtioBlockSubmit() -> request failed");
+        }
+    }
+}
+
+void virtioBlockTransfer(uint32_t type, uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *buffer)
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+    uint32_t sectorNumber = (blockNumber * SECTORS_PER_BLOCK) + EXT2_SECTOR_START;
+    uint32_t bytesLeft = numberOfBlocks * BLOCK_SIZE;
+    uint32_t maxBatch = VirtioBlockDevice->queueSize / VIRTIO_BLK_DESCRIPTORS_PER_REQUEST;
+    uint32_t request = 0;
+
+    if (maxBatch > VIRTIO_BLK_MAX_BATCH)
+    {
+        maxBatch = VIRTIO_BLK_MAX_BATCH;
+    }
+
+    while (bytesLeft > 0)
+    {
+        uint32_t length = bytesLeft;
+
+        if (length > VIRTIO_BLK_BYTES_PER_REQUEST)
+        {
+            length = VIRTIO_BLK_BYTES_PER_REQUEST;
+        }
+
+        virtioBlockBuildRequest(request, type, sectorNumber, buffer, length);
+        request++;
+
+        sectorNumber = sectorNumber + (length / SECTOR_SIZE);
+        buffer = buffer + length;
+        bytesLeft = bytesLeft - length;
+
+        if (request == maxBatch || bytesLeft == 0)
+        {
+            virtioBlockSubmit(request);
+            request = 0;
+        }
+    }
+}
+
+void virtioBlockReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory)
+{
+    virtioBlockTransfer(VIRTIO_BLK_REQUEST_IN, blockNumber, numberOfBlocks, destinationMemory);
+}
+
+void virtioBlockWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory)
+{
+    virtioBlockTransfer(VIRTIO_BLK_REQUEST_OUT, blockNumber, numberOfBlocks, sourceMemory);
+    virtioBlockFlush();
+}
+
+void virtioBlockFlush()
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+
+    if (!VirtioBlockDevice->flushSupported)
+    {
+        return;
+    }
+
+    virtioBlockBuildRequest(0, VIRTIO_BLK_REQUEST_FLUSH, 0, 0, 0);
+    virtioBlockSubmit(1);
+}
+
+void virtioBlockGeometry(struct blockDeviceGeometry *Geometry)
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+
+    Geometry->blockSize = BLOCK_SIZE;
+    Geometry->totalBlocks = (VirtioBlockDevice->capacitySectors - EXT2_SECTOR_START) / SECTORS_PER_BLOCK;
+}
+
+void virtioBlockInstallInterruptHandler(uint8_t *idtMemory)
+{
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+
+    setInterruptHandler(idtMemory, (PIC_IRQ_VECTOR_BASE + VirtioBlockDevice->interruptLine), &virtioBlockInterruptHandler);
+}
+
+void virtioBlockInterruptHandler()
+{
+    asm volatile ("pusha\n\t");
+    asm volatile ("cld\n\t");
+
+    struct virtioBlockDevice *VirtioBlockDevice = (struct virtioBlockDevice*)VIRTIO_BLK_STATE;
+
+    inputIOPort(VirtioBlockDevice->ioBase + VIRTIO_ISR_STATUS);
+    VirtioBlockDevice->interruptCount++;
+
+    if (VirtioBlockDevice->interruptLine >= PIC_SLAVE_FIRST_IRQ)
+    {
+        outputIOPort(SLAVE_PIC_COMMAND_PORT, INTERRUPT_END_OF_INTERRUPT);
+    }
+    outputIOPort(MASTER_PIC_COMMAND_PORT, INTERRUPT_END_OF_INTERRUPT);
+
+    asm volatile ("popa\n\t");
+    asm volatile ("leave\n\t");
+    asm volatile ("iret\n\t");
+}
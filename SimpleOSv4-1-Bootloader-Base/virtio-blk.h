@@ -0,0 +1,108 @@
+// Copyright (c) 2023-2026 Dan O’Malley
+// This file is licensed under the MIT License. See LICENSE for details.
+
+
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html (legacy interface sections)
+// https://wiki.osdev.org/Virtio
+
+#include "constants.h"
+/**
+ * A virtqueue descriptor. Each one points at a single physically contiguous buffer.
+ */
+struct virtqDescriptor
+{
+    uint32_t addressLow;
+    uint32_t addressHigh;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+};
+
+/**
+ * The header that starts every virtio-blk request.
+ */
+struct virtioBlockRequestHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint32_t sectorLow;
+    uint32_t sectorHigh;
+};
+
+/**
+ * The virtio-blk driver state. This lives at VIRTIO_BLK_STATE so the kernel can keep using the queue that bootloader stage 2 set up.
+ */
+struct virtioBlockDevice
+{
+    /** The I/O port base from BAR0. */
+    uint32_t ioBase;
+    /** The number of descriptors in request queue 0. */
+    uint32_t queueSize;
+    /** The legacy PCI interrupt line (IRQ) of the device. */
+    uint32_t interruptLine;
+    /** The next free slot in the available ring. */
+    uint32_t availableIndex;
+    /** 1 if the device accepted VIRTIO_BLK_FEATURE_FLUSH. */
+    uint32_t flushSupported;
+    /** The disk size in 512-byte sectors. Only the low 32 bits are kept. */
+    uint32_t capacitySectors;
+    /** The number of device interrupts handled. */
+    uint32_t interruptCount;
+    /** The number of queue notifications sent. Divide total requests by this to see the batching rate. */
+    uint32_t notifyCount;
+};
+
+/** Finds a legacy or transitional virtio-blk PCI device, negotiates features and sets up request queue 0. Returns false if no device is present. */
+bool virtioBlockInitialize();
+
+/** Reads consecutive EXT2 blocks from the virtio-blk device. Up to VIRTIO_BLK_MAX_BATCH requests are queued per notify.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to read.
+ * \param destinationMemory The pointer to the destination memory to write the blocks. It may be a mapped user address.
+ */
+void virtioBlockReadBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *destinationMemory);
+
+/** Writes consecutive EXT2 blocks to the virtio-blk device and flushes them.
+ * \param blockNumber The first EXT2 block number, not the disk LBA sector.
+ * \param numberOfBlocks The number of blocks to write.
+ * \param sourceMemory The starting memory address of the blocks to write. It may be a mapped user address.
+ */
+void virtioBlockWriteBlocks(uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *sourceMemory);
+
+/** Sends a flush request if the device supports one. */
+void virtioBlockFlush();
+
+/** Fills in the geometry of the virtio-blk device from its capacity field.
+ * \param Geometry The geometry structure to fill in.
+ */
+void virtioBlockGeometry(struct blockDeviceGeometry *Geometry);
+
+/** Points the device's IRQ vector at virtioBlockInterruptHandler().
+ * \param idtMemory The starting location of the interrupt descriptor table.
+ */
+void virtioBlockInstallInterruptHandler(uint8_t *idtMemory);
+
+/** The virtio-blk interrupt handler. Reading the ISR status register acknowledges the interrupt. */
+void virtioBlockInterruptHandler();
+
+/** Queues the requests in the current batch, notifies the device once and waits for all of them to complete.
+ * \param numberOfRequests The number of requests already built in the descriptor table.
+ */
+void virtioBlockSubmit(uint32_t numberOfRequests);
+
+/** Builds the descriptors for one request slot in the current batch.
+ * \param request The request slot in the batch.
+ * \param type VIRTIO_BLK_REQUEST_IN, VIRTIO_BLK_REQUEST_OUT or VIRTIO_BLK_REQUEST_FLUSH.
+ * \param sectorNumber The first sector of the request in LBA format.
+ * \param buffer The data buffer. Ignored for flush requests.
+ * \param length The number of bytes to transfer. 0 for flush requests.
+ */
+void virtioBlockBuildRequest(uint32_t request, uint32_t type, uint32_t sectorNumber, uint8_t *buffer, uint32_t length);
+
+/** Splits a transfer into page-sized requests and submits them in batches.
+ * \param type VIRTIO_BLK_REQUEST_IN or VIRTIO_BLK_REQUEST_OUT.
+ * \param blockNumber The first EXT2 block number.
+ * \param numberOfBlocks The number of blocks to transfer.
+ * \param buffer The memory to read into or write from.
+ */
+void virtioBlockTransfer(uint32_t type, uint32_t blockNumber, uint32_t numberOfBlocks, uint8_t *buffer);
@@ -10,6 +10,8 @@
 #include "exceptions.h"
 #include "file.h"
 #include "screen.h"
+#include "x86.h"
+#include "block-device.h"
 
 
 void initializePageTables(uint32_t pid)
@@ -22,70 +24,154 @@ void initializePageTables(uint32_t pid)
 
 void fillMemory(uint8_t *memLocation, uint8_t byteToFill, uint32_t numberOfBytes)
 {
-    for (uint32_t currentByte = 0; currentByte < numberOfBytes; currentByte++)
+    uint32_t pattern = byteToFill * 0x01010101;
+
+    // CPU_FEATURES_LOC is stored by bootloader stage 2 and again by kInit(), and is readable from user mode, so user and kernel code skip the slow CPUID instruction
+    if (numberOfBytes >= STREAMING_FILL_THRESHOLD && ((uint32_t)memLocation % 16) == 0 && (readValueFromMemLoc(CPU_FEATURES_LOC) & CPUID_SSE2))
     {
-        *memLocation = byteToFill;
-        memLocation++;
+        uint32_t streamedBytes = numberOfBytes & ~0xF;
+
+        memoryFillStreaming(memLocation, pattern, streamedBytes);
+        memLocation = memLocation + streamedBytes;
+        numberOfBytes = numberOfBytes - streamedBytes;
     }
+
+    memoryFill(memLocation, pattern, numberOfBytes);
 }
 
 
 void contextSwitch(uint32_t pid)
 {
-    uint32_t pgdLocation = ((pid - 1) * MAX_PGTABLES_SIZE) + PAGE_DIR_BASE;
-    
-    asm volatile ("movl %0, %%eax\n\t" : : "r" (pgdLocation));
-    asm volatile ("movl %eax, %cr3\n\t");
-    asm volatile ("movl %cr0, %ebx\n\t");
-    asm volatile ("or $0x80000000, %ebx\n\t");
-    asm volatile ("movl %ebx, %cr0\n\t");
+    uint32_t pgdLocation = taskStruct(pid)->pgd;
+
+    // Reloading the directory that is already loaded would only throw away the user TLB entries
+    if ((readCR0() & CR0_PAGING) && (readCR3() & PAGE_FRAME_MASK) == pgdLocation)
+    {
+        return;
+    }
+
+    // Kernel pages are PAGE_GLOBAL, so their TLB entries survive the reload
+    writeCR3(pgdLocation);
+
+    // Only the first switch turns on paging, plus write protect so the kernel also faults on read-only user pages. Copy-on-write depends on it.
+    if (!(readCR0() & CR0_PAGING))
+    {
+        writeCR0(readCR0() | CR0_PAGING | CR0_WRITE_PROTECT);
+    }
+}
+
+void installKernelLargePage(uint32_t *pageDirectory, uint32_t virtualAddress, uint32_t cacheFlags)
+{
+    uint32_t pageDirectoryEntry = virtualAddress / PAGE_TABLE_SPAN;
+    uint32_t largePage = (virtualAddress & ~(PAGE_TABLE_SPAN - 1)) | PAGE_LARGE | PAGE_GLOBAL | PG_KERNEL_PRESENT_RW | cacheFlags;
+
+    // Page directories come from the kernel frame pool, which is identity mapped both before and after paging is on
+    if (pageDirectory[pageDirectoryEntry] != largePage)
+    {
+        pageDirectory[pageDirectoryEntry] = largePage;
+    }
+}
+
+uint32_t virtualToPhysical(uint8_t *virtualAddress)
+{
+    if (!(readCR0() & CR0_PAGING))
+    {
+        return (uint32_t)virtualAddress;
+    }
+
+    // Page directories and page tables live in the identity mapped kernel region, so they can be read directly
+    uint32_t *pageDirectory = (uint32_t *)(readCR3() & PAGE_FRAME_MASK);
+    uint32_t pageDirectoryEntry = pageDirectory[(uint32_t)virtualAddress / PAGE_TABLE_SPAN];
+
+    if (!(pageDirectoryEntry & PAGE_PRESENT))
+    {
+        panic((uint8_t *)"vm.cpp:virtualToPhysical() -> page table not present");
+    }
+
+    if (pageDirectoryEntry & PAGE_LARGE)
+    {
+        return (pageDirectoryEntry & ~(PAGE_TABLE_SPAN - 1)) | ((uint32_t)virtualAddress & (PAGE_TABLE_SPAN - 1));
+    }
+
+    uint32_t *pageTable = (uint32_t *)(pageDirectoryEntry & PAGE_FRAME_MASK);
+    uint32_t pageTableEntry = pageTable[((uint32_t)virtualAddress / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE];
+
+    if (!(pageTableEntry & PAGE_PRESENT))
+    {
+        panic((uint8_t *)"vm.cpp:virtualToPhysical() -> page not present");
+    }
+
+    return (pageTableEntry & PAGE_FRAME_MASK) | ((uint32_t)virtualAddress & (PAGE_SIZE - 1));
+}
+
+void touchPages(uint8_t *memory, uint32_t numberOfBytes)
+{
+    if (numberOfBytes == 0)
+    {
+        return;
+    }
+
+    for (uint32_t page = ((uint32_t)memory & PAGE_FRAME_MASK); page <= (((uint32_t)memory + numberOfBytes - 1) & PAGE_FRAME_MASK); page = page + PAGE_SIZE)
+    {
+        (void)*(volatile uint8_t *)page;
+    }
 }
 
 uint32_t initializeTask(uint32_t ppid, uint16_t state, uint32_t stack, uint8_t *binaryName, uint32_t priority)
 {
     while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
     
-    uint32_t lastUsedPid = 0;
+    struct processTable *ProcessTable = (struct processTable*)PROCESS_TABLE_LOC;
     uint32_t nextAvailPid = 0;
-    uint32_t taskStructNumber = 0;
 
     if (ppid == 0) { ppid = KERNEL_OWNED; }
 
-    while (nextAvailPid == 0 && taskStructNumber < MAX_PROCESSES)
+    for (uint32_t pid = 1; nextAvailPid == 0 && pid <= MAX_PROCESSES; pid++)
     {
-        lastUsedPid = *(uint32_t *)(PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * taskStructNumber));
-
-        if ((unsigned int)lastUsedPid == 0)
+        if (ProcessTable->task[pid - 1] == 0 || ProcessTable->task[pid - 1]->pid == 0)
         {
-            nextAvailPid = (taskStructNumber + 1);
+            nextAvailPid = pid;
         }
+    }
 
-        if (taskStructNumber == (MAX_PROCESSES - 1))
+    if (nextAvailPid == 0)
+    {
+        while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+        panic((uint8_t *)"vm.cpp:initializeTask() -> reached max process number");
+    }
+
+    // The table only grows. A pid that was used before keeps its frame for the next process.
+    if (ProcessTable->task[nextAvailPid - 1] == 0)
+    {
+        uint32_t taskFrame = allocateKernelFrame();
+
+        if (taskFrame == 0)
         {
             while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
-            panic((uint8_t *)"vm.cpp:initializeTask() -> reached max process number");
+            panic((uint8_t *)"vm.cpp:initializeTask() -> no kernel frame for the task structure");
         }
 
-        taskStructNumber++;
+        ProcessTable->task[nextAvailPid - 1] = (struct task*)(taskFrame * PAGE_SIZE);
     }
-    
-    uint32_t physMemStart = (MAX_PROCESS_SIZE * (nextAvailPid - 1));
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (nextAvailPid - 1));
-    uint32_t pgd = ((nextAvailPid - 1) * MAX_PGTABLES_SIZE) + PAGE_DIR_BASE;
-    
-    struct task *Task = (struct task*)taskStructLocation;
+
+    struct task *Task = ProcessTable->task[nextAvailPid - 1];
+
+    // A reused pid must not keep the page tables, or fault in pages from the executable, of the process that had it before
+    freePageTables(nextAvailPid);
+    fillMemory((uint8_t *)Task, 0x0, TASK_EXEC_MAPPING_OFFSET + EXEC_MAPPING_SIZE);
 
     Task->pid = nextAvailPid;
     Task->ppid = ppid;
     Task->state = state;
-    Task->pgd = pgd;
+    Task->pgd = createPageDirectory();
     Task->stack = stack;
-    Task->physMemStart = physMemStart;
     Task->fileDescriptor[1] = (openFileTableEntry *)(OPEN_FILE_TABLE + (sizeof(openFileTableEntry)));
     Task->nextAvailableFileDescriptor = 3;
     Task->priority = priority;
     Task->runtime = 0;
     Task->binaryName = binaryName;
+    Task->programBreak = USER_BRK_BASE;
+    initializeVirtualAreas(nextAvailPid);
 
     while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
 
@@ -96,14 +182,341 @@ void updateTaskState(uint32_t pid, uint16_t state)
 {
     while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
     
-    uint32_t taskStructLocation = PROCESS_TABLE_LOC + (TASK_STRUCT_SIZE * (pid - 1));
-    
-    struct task *Task = (struct task*)taskStructLocation;
+    struct task *Task = taskStruct(pid);
     Task->state = state;
 
     while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
 }
 
+struct task *taskStruct(uint32_t pid)
+{
+    struct processTable *ProcessTable = (struct processTable*)PROCESS_TABLE_LOC;
+
+    if (pid == 0 || pid > MAX_PROCESSES)
+    {
+        return 0;
+    }
+
+    return ProcessTable->task[pid - 1];
+}
+
+struct execMapping *processExecMapping(uint32_t pid)
+{
+    return (struct execMapping*)((uint32_t)taskStruct(pid) + TASK_EXEC_MAPPING_OFFSET);
+}
+
+struct virtualAreas *processVirtualAreas(uint32_t pid)
+{
+    return (struct virtualAreas*)((uint32_t)taskStruct(pid) + TASK_VIRTUAL_AREAS_OFFSET);
+}
+
+void initializeVirtualAreas(uint32_t pid)
+{
+    struct virtualAreas *VirtualAreas = processVirtualAreas(pid);
+
+    VirtualAreas->freeAreas = 0;
+    virtualAreaInsert(VirtualAreas, USER_MMAP_BASE, (USER_MMAP_LIMIT - USER_MMAP_BASE) / PAGE_SIZE);
+}
+
+uint32_t virtualAreaSearch(struct virtualArea *Areas, uint32_t count, uint32_t start, uint32_t pages, bool bySize)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        bool before = (Areas[middle].start < start);
+
+        if (bySize && Areas[middle].pages != pages)
+        {
+            before = (Areas[middle].pages < pages);
+        }
+
+        if (before)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+bool virtualAreaInsert(struct virtualAreas *VirtualAreas, uint32_t start, uint32_t pages)
+{
+    if (VirtualAreas->freeAreas == MAX_VIRTUAL_AREAS)
+    {
+        return false;
+    }
+
+    uint32_t addressIndex = virtualAreaSearch(VirtualAreas->byAddress, VirtualAreas->freeAreas, start, pages, false);
+    uint32_t sizeIndex = virtualAreaSearch(VirtualAreas->bySize, VirtualAreas->freeAreas, start, pages, true);
+
+    for (uint32_t area = VirtualAreas->freeAreas; area > addressIndex; area--)
+    {
+        VirtualAreas->byAddress[area] = VirtualAreas->byAddress[area - 1];
+    }
+
+    for (uint32_t area = VirtualAreas->freeAreas; area > sizeIndex; area--)
+    {
+        VirtualAreas->bySize[area] = VirtualAreas->bySize[area - 1];
+    }
+
+    VirtualAreas->byAddress[addressIndex].start = start;
+    VirtualAreas->byAddress[addressIndex].pages = pages;
+    VirtualAreas->bySize[sizeIndex].start = start;
+    VirtualAreas->bySize[sizeIndex].pages = pages;
+    VirtualAreas->freeAreas++;
+
+    return true;
+}
+
+void virtualAreaRemove(struct virtualAreas *VirtualAreas, uint32_t start, uint32_t pages)
+{
+    uint32_t addressIndex = virtualAreaSearch(VirtualAreas->byAddress, VirtualAreas->freeAreas, start, pages, false);
+    uint32_t sizeIndex = virtualAreaSearch(VirtualAreas->bySize, VirtualAreas->freeAreas, start, pages, true);
+
+    VirtualAreas->freeAreas--;
+
+    for (uint32_t area = addressIndex; area < VirtualAreas->freeAreas; area++)
+    {
+        VirtualAreas->byAddress[area] = VirtualAreas->byAddress[area + 1];
+    }
+
+    for (uint32_t area = sizeIndex; area < VirtualAreas->freeAreas; area++)
+    {
+        VirtualAreas->bySize[area] = VirtualAreas->bySize[area + 1];
+    }
+}
+
+uint8_t *reserveVirtualRange(uint32_t pid, uint32_t address, uint32_t numberOfPages)
+{
+    struct virtualAreas *VirtualAreas = processVirtualAreas(pid);
+    struct virtualArea FreeArea;
+
+    if (numberOfPages == 0 || numberOfPages > ((USER_MMAP_LIMIT - USER_MMAP_BASE) / PAGE_SIZE))
+    {
+        return 0;
+    }
+
+    if (address == 0)
+    {
+        uint32_t sizeIndex = virtualAreaSearch(VirtualAreas->bySize, VirtualAreas->freeAreas, 0, numberOfPages, true);
+
+        if (sizeIndex == VirtualAreas->freeAreas)
+        {
+            return 0;
+        }
+
+        FreeArea = VirtualAreas->bySize[sizeIndex];
+        address = FreeArea.start;
+    }
+    else
+    {
+        // The free range holding the address is the last one starting at or below it
+        uint32_t addressIndex = virtualAreaSearch(VirtualAreas->byAddress, VirtualAreas->freeAreas, address + 1, 0, false);
+
+        if ((address & ~PAGE_FRAME_MASK) != 0 || addressIndex == 0)
+        {
+            return 0;
+        }
+
+        FreeArea = VirtualAreas->byAddress[addressIndex - 1];
+
+        if (((address - FreeArea.start) / PAGE_SIZE) + numberOfPages > FreeArea.pages)
+        {
+            return 0;
+        }
+    }
+
+    uint32_t pagesBefore = (address - FreeArea.start) / PAGE_SIZE;
+    uint32_t pagesAfter = FreeArea.pages - pagesBefore - numberOfPages;
+
+    // Splitting a range in the middle leaves one more free range, so the table must have room before anything is taken out
+    if (pagesBefore != 0 && pagesAfter != 0 && VirtualAreas->freeAreas == MAX_VIRTUAL_AREAS)
+    {
+        return 0;
+    }
+
+    virtualAreaRemove(VirtualAreas, FreeArea.start, FreeArea.pages);
+
+    if (pagesBefore != 0)
+    {
+        virtualAreaInsert(VirtualAreas, FreeArea.start, pagesBefore);
+    }
+
+    if (pagesAfter != 0)
+    {
+        virtualAreaInsert(VirtualAreas, address + (numberOfPages * PAGE_SIZE), pagesAfter);
+    }
+
+    return (uint8_t *)address;
+}
+
+bool releaseVirtualRange(uint32_t pid, uint32_t address, uint32_t numberOfPages)
+{
+    struct virtualAreas *VirtualAreas = processVirtualAreas(pid);
+    uint32_t end = address + (numberOfPages * PAGE_SIZE);
+
+    if (address < USER_MMAP_BASE || end > USER_MMAP_LIMIT || end <= address)
+    {
+        return false;
+    }
+
+    uint32_t addressIndex = virtualAreaSearch(VirtualAreas->byAddress, VirtualAreas->freeAreas, address, 0, false);
+
+    if (addressIndex != 0 && (VirtualAreas->byAddress[addressIndex - 1].start + (VirtualAreas->byAddress[addressIndex - 1].pages * PAGE_SIZE)) >= address)
+    {
+        addressIndex--;
+    }
+
+    // A range that touches no free range needs a new entry
+    bool mergesWithFreeArea = (addressIndex < VirtualAreas->freeAreas && VirtualAreas->byAddress[addressIndex].start <= end);
+
+    if (!mergesWithFreeArea && VirtualAreas->freeAreas == MAX_VIRTUAL_AREAS)
+    {
+        return false;
+    }
+
+    // Every free range that overlaps or touches the released one is taken out and becomes part of it
+    while (addressIndex < VirtualAreas->freeAreas && VirtualAreas->byAddress[addressIndex].start <= end)
+    {
+        struct virtualArea FreeArea = VirtualAreas->byAddress[addressIndex];
+        uint32_t freeAreaEnd = FreeArea.start + (FreeArea.pages * PAGE_SIZE);
+
+        if (FreeArea.start < address)
+        {
+            address = FreeArea.start;
+        }
+
+        if (freeAreaEnd > end)
+        {
+            end = freeAreaEnd;
+        }
+
+        virtualAreaRemove(VirtualAreas, FreeArea.start, FreeArea.pages);
+    }
+
+    return virtualAreaInsert(VirtualAreas, address, (end - address) / PAGE_SIZE);
+}
+
+uint32_t pidForPageDirectory(uint32_t pageDirectory)
+{
+    for (uint32_t pid = 1; pid <= MAX_PROCESSES; pid++)
+    {
+        struct task *Task = taskStruct(pid);
+
+        if (Task != 0 && Task->pid != 0 && Task->pgd == pageDirectory)
+        {
+            return pid;
+        }
+    }
+
+    return 0;
+}
+
+void markKernelPagesGlobal(uint32_t pid)
+{
+    uint32_t *pageTable = pageTableFor(pid, KERNEL_BASE, false);
+
+    if (pageTable == 0)
+    {
+        return;
+    }
+
+    // Only identity mapped pages are the same in every address space
+    for (uint32_t page = (KERNEL_BASE / PAGE_SIZE); page < PAGE_ENTRIES_PER_TABLE; page++)
+    {
+        if ((pageTable[page] & PAGE_PRESENT) && (pageTable[page] & PAGE_FRAME_MASK) == (page * PAGE_SIZE))
+        {
+            pageTable[page] = pageTable[page] | PAGE_GLOBAL;
+        }
+    }
+}
+
+uint32_t createPageDirectory()
+{
+    uint32_t pageDirectoryFrame = allocateKernelFrame();
+    uint32_t pageTableFrame = allocateKernelFrame();
+
+    if (pageDirectoryFrame == 0 || pageTableFrame == 0)
+    {
+        panic((uint8_t *)"vm.cpp:createPageDirectory() -> no kernel frame for the page directory");
+    }
+
+    uint32_t *pageDirectory = (uint32_t *)(pageDirectoryFrame * PAGE_SIZE);
+
+    // The kernel windows go in even before paging is on, since the first directory loaded must already reach the frame metadata
+    frameMetadataMapWindow(pageDirectory);
+    blockDeviceMapWindow(pageDirectory);
+
+    pageDirectory[0] = (pageTableFrame * PAGE_SIZE) | PG_USER_PRESENT_RW;
+
+    return (uint32_t)pageDirectory;
+}
+
+uint32_t *pageTableFor(uint32_t pid, uint32_t virtualAddress, bool create)
+{
+    uint32_t *pageDirectory = (uint32_t *)taskStruct(pid)->pgd;
+    uint32_t pageDirectoryEntry = virtualAddress / PAGE_TABLE_SPAN;
+
+    if ((pageDirectory[pageDirectoryEntry] & PAGE_PRESENT) && !(pageDirectory[pageDirectoryEntry] & PAGE_USER))
+    {
+        if (create)
+        {
+            panic((uint8_t *)"vm.cpp:pageTableFor() -> address is in a kernel window");
+        }
+
+        return 0;
+    }
+
+    if (!(pageDirectory[pageDirectoryEntry] & PAGE_PRESENT))
+    {
+        if (!create)
+        {
+            return 0;
+        }
+
+        uint32_t pageTableFrame = allocateKernelFrame();
+
+        if (pageTableFrame == 0)
+        {
+            panic((uint8_t *)"vm.cpp:pageTableFor() -> no kernel frame for the page table");
+        }
+
+        pageDirectory[pageDirectoryEntry] = (pageTableFrame * PAGE_SIZE) | PG_USER_PRESENT_RW;
+    }
+
+    return (uint32_t *)(pageDirectory[pageDirectoryEntry] & PAGE_FRAME_MASK);
+}
+
+void freePageTables(uint32_t pid)
+{
+    struct task *Task = taskStruct(pid);
+
+    if (Task == 0 || Task->pgd == 0)
+    {
+        return;
+    }
+
+    uint32_t *pageDirectory = (uint32_t *)Task->pgd;
+
+    for (uint32_t pageDirectoryEntry = 0; pageDirectoryEntry < PAGE_ENTRIES_PER_TABLE; pageDirectoryEntry++)
+    {
+        if ((pageDirectory[pageDirectoryEntry] & PAGE_PRESENT) && (pageDirectory[pageDirectoryEntry] & PAGE_USER))
+        {
+            freeKernelFrame(pageDirectory[pageDirectoryEntry] / PAGE_SIZE);
+        }
+    }
+
+    freeKernelFrame(Task->pgd / PAGE_SIZE);
+    Task->pgd = 0;
+}
+
 uint32_t requestSpecificPage(uint32_t pid, uint8_t *pageMemoryLocation, uint8_t perms)
 {
     
@@ -113,6 +526,25 @@ uint32_t requestSpecificPage(uint32_t pid, uint8_t *pageMemoryLocation, uint8_t
     
 }
 
+uint32_t requestZeroedPage(uint32_t pid, uint8_t *pageMemoryLocation, uint8_t perms)
+{
+    if (pageTableEntry(pid, (uint32_t)pageMemoryLocation) & (PAGE_PRESENT | PG_RESERVED))
+    {
+        return 0;
+    }
+
+    uint32_t frameNumber = allocateZeroedFrame(pid);
+
+    if (frameNumber == 0)
+    {
+        return 0;
+    }
+
+    mapPage(pid, (uint32_t)pageMemoryLocation, frameNumber, perms);
+
+    return 1;
+}
+
 uint8_t *findBuffer(uint32_t pid, uint32_t numberOfPages, uint8_t perms)
 {
     
@@ -131,20 +563,207 @@ uint8_t *requestAvailablePage(uint32_t pid, uint8_t perms)
     
 }
 
+uint32_t pageTableEntry(uint32_t pid, uint32_t virtualAddress)
+{
+    uint32_t *pageTable = pageTableFor(pid, virtualAddress, false);
+
+    if (pageTable == 0)
+    {
+        return 0;
+    }
+
+    return pageTable[(virtualAddress / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE];
+}
+
+void mapPage(uint32_t pid, uint32_t virtualAddress, uint32_t frameNumber, uint8_t perms)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+
+    uint32_t *pageTable = pageTableFor(pid, virtualAddress, true);
+    uint32_t page = (virtualAddress / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE;
+
+    // A sysMmap() page split by copy-on-write can still be unmapped
+    pageTable[page] = (pageTable[page] & PG_MMAP_PAGE) | (frameNumber * PAGE_SIZE) | perms;
+
+    // Only the loaded page directory can have a stale TLB entry
+    if ((readCR3() & PAGE_FRAME_MASK) == taskStruct(pid)->pgd)
+    {
+        invalidatePage(virtualAddress);
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+}
+
+void releaseSharedPages(uint32_t pid)
+{
+    uint32_t *pageDirectory = (uint32_t *)taskStruct(pid)->pgd;
+
+    for (uint32_t pageDirectoryEntry = 0; pageDirectoryEntry < PAGE_ENTRIES_PER_TABLE; pageDirectoryEntry++)
+    {
+        if (!(pageDirectory[pageDirectoryEntry] & PAGE_PRESENT) || !(pageDirectory[pageDirectoryEntry] & PAGE_USER))
+        {
+            continue;
+        }
+
+        uint32_t *pageTable = (uint32_t *)(pageDirectory[pageDirectoryEntry] & PAGE_FRAME_MASK);
+
+        for (uint32_t page = 0; page < PAGE_ENTRIES_PER_TABLE; page++)
+        {
+            // The first page table also maps the kernel
+            if (pageDirectoryEntry == 0 && page >= (KERNEL_BASE / PAGE_SIZE))
+            {
+                break;
+            }
+
+            if ((pageTable[page] & PAGE_PRESENT) && frameReferences(pageTable[page] / PAGE_SIZE) != 0)
+            {
+                freeFrame(pageTable[page] / PAGE_SIZE);
+                pageTable[page] = 0x0;
+            }
+        }
+    }
+}
+
+void duplicatePageTables(uint32_t parentPid, uint32_t childPid)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+
+    uint32_t *parentPageDirectory = (uint32_t *)taskStruct(parentPid)->pgd;
+    uint32_t *childPageDirectory = (uint32_t *)taskStruct(childPid)->pgd;
+
+    for (uint32_t pageDirectoryEntry = 0; pageDirectoryEntry < PAGE_ENTRIES_PER_TABLE; pageDirectoryEntry++)
+    {
+        if (!(parentPageDirectory[pageDirectoryEntry] & PAGE_PRESENT))
+        {
+            continue;
+        }
+
+        // Kernel page tables, such as the RAM disk window, are the same in every directory. Only the user tables are per process.
+        if (!(parentPageDirectory[pageDirectoryEntry] & PAGE_USER))
+        {
+            childPageDirectory[pageDirectoryEntry] = parentPageDirectory[pageDirectoryEntry];
+            continue;
+        }
+
+        uint32_t *parentPageTable = (uint32_t *)(parentPageDirectory[pageDirectoryEntry] & PAGE_FRAME_MASK);
+        uint32_t *childPageTable = pageTableFor(childPid, pageDirectoryEntry * PAGE_TABLE_SPAN, true);
+
+        childPageDirectory[pageDirectoryEntry] = (uint32_t)childPageTable | (parentPageDirectory[pageDirectoryEntry] & ~PAGE_FRAME_MASK);
+        bytecpy((uint8_t *)childPageTable, (uint8_t *)parentPageTable, PAGE_SIZE);
+
+        for (uint32_t page = 0; page < PAGE_ENTRIES_PER_TABLE; page++)
+        {
+            // The first page table also maps the kernel
+            if (pageDirectoryEntry == 0 && page >= (KERNEL_BASE / PAGE_SIZE))
+            {
+                break;
+            }
+
+            uint32_t frameNumber = parentPageTable[page] / PAGE_SIZE;
+            uint8_t frameOwner = *(uint8_t *)(PAGEFRAME_MAP_BASE + frameNumber);
+
+            // Frames the parent does not own, like the kernel's low memory, are mapped the same way in both
+            if (!(parentPageTable[page] & PAGE_PRESENT) || !(parentPageTable[page] & PAGE_USER) || (frameOwner != parentPid && frameOwner != PAGEFRAME_SHARED))
+            {
+                continue;
+            }
+
+            // A private frame gains a reference for each table, an already shared frame only for the child
+            if (frameOwner != PAGEFRAME_SHARED)
+            {
+                referenceFrame(frameNumber);
+            }
+
+            referenceFrame(frameNumber);
+
+            // Nothing is copied now. The first write from either side gets its own frame in copyOnWritePage().
+            if (parentPageTable[page] & PAGE_WRITABLE)
+            {
+                parentPageTable[page] = (parentPageTable[page] & ~PAGE_WRITABLE) | PG_COPY_ON_WRITE;
+            }
+
+            childPageTable[page] = parentPageTable[page];
+        }
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+
+    // One CR3 reload drops every writable TLB entry of the parent at once. contextSwitch() skips the directory that is already loaded.
+    if ((readCR3() & PAGE_FRAME_MASK) == (uint32_t)parentPageDirectory)
+    {
+        writeCR3(readCR3());
+    }
+}
+
 void freePage(uint32_t pid, uint8_t *pageToFree)
 {
     while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
 
-    uint32_t ptLocation = ((pid - 1) * MAX_PGTABLES_SIZE) + PAGE_TABLE_BASE;
-    uint32_t pageNumberToFree = (uint32_t)pageToFree / PAGE_SIZE;
-    uint32_t physicalAddressToFree = *(uint32_t *)((int)ptLocation + (pageNumberToFree * 4));
+    uint32_t *pageTable = pageTableFor(pid, (uint32_t)pageToFree, false);
+    uint32_t pageNumberToFree = ((uint32_t)pageToFree / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE;
+
+    if (pageTable != 0 && (pageTable[pageNumberToFree] & PAGE_PRESENT))
+    {
+        freeFrame(pageTable[pageNumberToFree] / PAGE_SIZE);
+        pageTable[pageNumberToFree] = 0x0;
+
+        // Only the loaded page directory can have a stale TLB entry
+        if ((readCR3() & PAGE_FRAME_MASK) == taskStruct(pid)->pgd)
+        {
+            invalidatePage((uint32_t)pageToFree);
+        }
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+}
+
+void reservePage(uint32_t pid, uint32_t virtualAddress, uint8_t perms)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+
+    uint32_t *pageTable = pageTableFor(pid, virtualAddress, true);
 
-    freeFrame((physicalAddressToFree / PAGE_SIZE));
-    *(uint32_t *)((uint32_t)ptLocation + (pageNumberToFree * 4)) = 0x0;
+    pageTable[(virtualAddress / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE] = PG_RESERVED | (perms & ~PAGE_PRESENT);
 
     while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
 }
 
+void markMmapPage(uint32_t pid, uint32_t virtualAddress)
+{
+    while (!acquireLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+
+    uint32_t *pageTable = pageTableFor(pid, virtualAddress, false);
+
+    if (pageTable != 0)
+    {
+        pageTable[(virtualAddress / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE] |= PG_MMAP_PAGE;
+    }
+
+    while (!releaseLock(KERNEL_OWNED, (uint8_t *)PROCESS_TABLE_LOC)) {}
+}
+
+void releasePages(uint32_t pid, uint32_t virtualAddress, uint32_t numberOfPages)
+{
+    for (uint32_t page = virtualAddress; page < (virtualAddress + (numberOfPages * PAGE_SIZE)); page = page + PAGE_SIZE)
+    {
+        uint32_t *pageTable = pageTableFor(pid, page, false);
+
+        if (pageTable == 0)
+        {
+            continue;
+        }
+
+        if (pageTable[(page / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE] & PAGE_PRESENT)
+        {
+            freePage(pid, (uint8_t *)page);
+        }
+        else
+        {
+            pageTable[(page / PAGE_SIZE) % PAGE_ENTRIES_PER_TABLE] = 0x0;
+        }
+    }
+}
+
 bool acquireLock(uint32_t currentPid, uint8_t *memoryLocation)
 {
     uint32_t semaphoreNumber = 0;
@@ -37,7 +37,49 @@ struct task {
     uint16_t ds;
 	void *fileDescriptor[MAX_FILE_DESCRIPTORS];
     uint8_t *binaryName;
-	//struct is 168 bytes in total
+    uint32_t programBreak;
+    uint32_t syscallResult;
+	//struct is 176 bytes in total
+};
+
+/** The process table at PROCESS_TABLE_LOC. A pid's task structure is allocated from the kernel frame pool the first time the pid is used, and its exec mapping sits TASK_EXEC_MAPPING_OFFSET bytes into the same frame. */
+struct processTable
+{
+    /** The task structure of each pid, at index pid - 1. 0 if the pid was never used. */
+    struct task *task[MAX_PROCESSES];
+};
+
+/** A range of free pages in the mapping region of a process. */
+struct virtualArea
+{
+    /** The address of the first page. */
+    uint32_t start;
+    /** The number of pages. */
+    uint32_t pages;
+};
+
+/** The free ranges of a process's mapping region, USER_MMAP_BASE to USER_MMAP_LIMIT, kept TASK_VIRTUAL_AREAS_OFFSET bytes into the frame of its task structure. Every range is listed twice, sorted by address and sorted by size, so a binary search finds both the best fit and the neighbours a released range merges with. */
+struct virtualAreas
+{
+    /** The number of free ranges. */
+    uint32_t freeAreas;
+    /** The free ranges by start address. Free ranges never touch, since they are merged. */
+    struct virtualArea byAddress[MAX_VIRTUAL_AREAS];
+    /** The same ranges by number of pages, then by start address. */
+    struct virtualArea bySize[MAX_VIRTUAL_AREAS];
+};
+
+/** The parameters of SYS_MMAP_RANGE and SYS_MUNMAP. */
+struct mmapParameter
+{
+    /** The start of the range to unmap. For SYS_MMAP_RANGE, 0 lets the kernel pick the address, and anything else asks for the range at exactly that address. */
+    uint32_t address;
+    /** The length of the range in bytes. It is rounded up to whole pages. */
+    uint32_t length;
+    /** MMAP_PROT_READ, optionally with MMAP_PROT_WRITE. */
+    uint32_t protection;
+    /** MMAP_POPULATE maps every page now. Otherwise the pages are only reserved and each one is mapped the first time it is touched. */
+    uint32_t flags;
 };
 
 /** The structure of the semaphore. */
@@ -49,24 +91,125 @@ struct semaphore
     uint32_t maxValue;
 };
 
-/** Fills memory with a certain byte value.
+/** Fills memory with a certain byte value, with memoryFill(). Page sized and larger fills use memoryFillStreaming() when the CPU has SSE2, since the memory is rarely read again right away.
  * \param memLocation The pointer to start the fill.
  * \param byteToFill The byte value used to fill.
  * \param numberOfBytes The number of bytes to fill starting at memLocation.
  */
 void fillMemory(uint8_t *memLocation, uint8_t byteToFill, uint32_t numberOfBytes);
 
-/** Creates the page directory and single page table structures for a particular pid.
+/** Fills in the first page table of a particular pid. initializeTask() already allocated the page directory (Task->pgd) and the page table its entry 0 points to; pageTableFor() finds it.
  * \param pid The pid associated with the page directory and table you'd like to create.
  */
 void initializePageTables(uint32_t pid);
 
-/** Performs a context switch to the given pid.
+/** Returns the task structure of a pid, or 0 if the pid was never used.
+ * \param pid The pid you are interested in.
+ */
+struct task *taskStruct(uint32_t pid);
+
+/** Returns the exec mapping of a pid, which lives in the same kernel frame as its task structure.
+ * \param pid The pid you are interested in.
+ */
+struct execMapping *processExecMapping(uint32_t pid);
+
+/** Returns the free ranges of the mapping region of a pid, which live in the same kernel frame as its task structure.
+ * \param pid The pid you are interested in.
+ */
+struct virtualAreas *processVirtualAreas(uint32_t pid);
+
+/** Makes the whole mapping region of a pid one free range.
+ * \param pid The pid you are interested in.
+ */
+void initializeVirtualAreas(uint32_t pid);
+
+/** Returns the index of the first range in a sorted array that does not come before a key, which is count if every range does.
+ * \param Areas The array, VirtualAreas->byAddress or VirtualAreas->bySize.
+ * \param count The number of ranges in the array.
+ * \param start The start address of the key.
+ * \param pages The number of pages of the key. Only used for the size order.
+ * \param bySize True for the size order, false for the address order.
+ */
+uint32_t virtualAreaSearch(struct virtualArea *Areas, uint32_t count, uint32_t start, uint32_t pages, bool bySize);
+
+/** Adds a free range to both arrays. Returns false and adds nothing if the table already holds MAX_VIRTUAL_AREAS ranges.
+ * \param VirtualAreas The free ranges.
+ * \param start The address of the first page.
+ * \param pages The number of pages.
+ */
+bool virtualAreaInsert(struct virtualAreas *VirtualAreas, uint32_t start, uint32_t pages);
+
+/** Takes a free range out of both arrays. The range must be listed exactly.
+ * \param VirtualAreas The free ranges.
+ * \param start The address of the first page.
+ * \param pages The number of pages.
+ */
+void virtualAreaRemove(struct virtualAreas *VirtualAreas, uint32_t start, uint32_t pages);
+
+/** Reserves a range of the mapping region of a pid. The smallest free range that fits is used, and what is left of it stays free. Returns the address of the range, or 0 if nothing fits or the split would overflow the free range table.
+ * \param pid The pid you are interested in.
+ * \param address 0 for the best fit, or the address the range must start at. Then the free range holding it is split around it.
+ * \param numberOfPages The number of pages.
+ */
+uint8_t *reserveVirtualRange(uint32_t pid, uint32_t address, uint32_t numberOfPages);
+
+/** Gives a range of the mapping region of a pid back, merged with the free ranges it touches. Pages of the range that are already free are not counted twice. The pages themselves are unmapped separately, with releasePages(). Returns false, and changes nothing, if the range is outside the mapping region or the free range table is full.
+ * \param pid The pid you are interested in.
+ * \param address The address of the first page.
+ * \param numberOfPages The number of pages.
+ */
+bool releaseVirtualRange(uint32_t pid, uint32_t address, uint32_t numberOfPages);
+
+/** Returns the pid whose page directory is at a physical address, or 0 if there is none.
+ * \param pageDirectory The page directory address, as in CR3.
+ */
+uint32_t pidForPageDirectory(uint32_t pageDirectory);
+
+/** Sets PAGE_GLOBAL on the identity mapped pages from KERNEL_BASE up in the first page table of a pid, so their TLB entries survive a CR3 reload once CR4_PAGE_GLOBAL_ENABLE is on. Called after initializePageTables().
+ * \param pid The pid you are interested in.
+ */
+void markKernelPagesGlobal(uint32_t pid);
+
+/** Allocates an empty page directory and its first page table from the kernel frame pool, and installs the kernel windows (the frame metadata and the block device window) in it. Works before and after paging is enabled. Returns the page directory address.
+ */
+uint32_t createPageDirectory();
+
+/** Returns the page table that maps a virtual address in a pid's address space. A process can have a page table for every 4 MB outside the kernel windows.
+ * \param pid The pid you are interested in.
+ * \param virtualAddress The virtual address you are interested in.
+ * \param create If true, a missing page table is allocated from the kernel frame pool. Otherwise 0 is returned for it.
+ */
+uint32_t *pageTableFor(uint32_t pid, uint32_t virtualAddress, bool create);
+
+/** Returns a pid's page tables and page directory to the kernel frame pool. The frames they map are left to freeAllFrames(). The pid must not be running, and the process table lock is not taken.
+ * \param pid The pid you are interested in.
+ */
+void freePageTables(uint32_t pid);
+
+/** Performs a context switch to the given pid. Loads its page directory unless it is already loaded, and turns on paging the first time.
  * \param pid The pid you'd like to switch to.
  */
 void contextSwitch(uint32_t pid);
 
-/** Creates the task structure values for a new process.
+/** Identity maps the 4 MB region holding virtualAddress with one 4 MB page (PAGE_LARGE) in a page directory. Used for kernel-only windows above the 4 MB the processes map, so each window costs one TLB entry and no page table. The page only takes effect once kInit() sets CR4_PAGE_SIZE_EXTENSION.
+ * \param pageDirectory The page directory to add the page to, from the kernel frame pool.
+ * \param virtualAddress Any address inside the 4 MB region.
+ * \param cacheFlags PAGE_WRITE_THROUGH and PAGE_CACHE_DISABLE for device memory, or 0.
+ */
+void installKernelLargePage(uint32_t *pageDirectory, uint32_t virtualAddress, uint32_t cacheFlags);
+
+/** Translates a virtual address to a physical address using the page directory loaded in CR3. Before paging is enabled the address is returned unchanged.
+ * \param virtualAddress The virtual address to translate. It must be mapped.
+ */
+uint32_t virtualToPhysical(uint8_t *virtualAddress);
+
+/** Reads one byte from every page of a memory range, so any demand page fault on it happens before the caller starts.
+ * \param memory The start of the range.
+ * \param numberOfBytes The length of the range.
+ */
+void touchPages(uint8_t *memory, uint32_t numberOfBytes);
+
+/** Creates the task structure values and the page directory for a new process. The task structure is cleared first, so nothing is left over from an earlier process with the same pid.
  * \param ppid The parent pid of the new process.
  * \param state The state value of the new process.
  * \param stack The stack location for the new process.
@@ -81,27 +224,79 @@ uint32_t initializeTask(uint32_t ppid, uint16_t state, uint32_t stack, uint8_t *
  */
 void updateTaskState(uint32_t pid, uint16_t state);
 
-/** Requests allocation of a particular page in a pid's address space. Returns 0 if unsuccessful. Returns 1 if successful. 
+/** Requests allocation of a particular page in a pid's address space. Returns 0 if unsuccessful. Returns 1 if successful. When the pid's page directory is the loaded one, flush the page's old TLB entry with invalidatePage(), like mapPage() does. 
  * \param pid The pid associated with the process space you are interested in.
  * \param pageMemoryLocation The virtual address you are interested in allocating.
  * \param perms The requested permissions of the new page.
 */
 uint32_t requestSpecificPage(uint32_t pid, uint8_t *pageMemoryLocation, uint8_t perms);
 
+/** Like requestSpecificPage(), but the page is backed by a frame from allocateZeroedFrame(), so it already reads as zero and the caller skips its own fillMemory(). Returns 0 if the page is mapped or reserved already, or no frame is available. Returns 1 if successful.
+ * \param pid The pid associated with the process space you are interested in.
+ * \param pageMemoryLocation The virtual address you are interested in allocating.
+ * \param perms The requested permissions of the new page. A read-only page can be asked for directly, since nothing has to be written to it.
+*/
+uint32_t requestZeroedPage(uint32_t pid, uint8_t *pageMemoryLocation, uint8_t perms);
+
 /** Requests allocation of any available page in a pid's address space. Returns pointer to the allocated page if successful. 
  * \param pid The pid associated with the process space you are interested in.
  * \param perms The requested permissions of the new page.
 */
 uint8_t *requestAvailablePage(uint32_t pid, uint8_t perms);
 
-/** Finds an open buffer using a first-fit algorithm for the number of pages requested in the pid's address space.
+/** Finds an open buffer using a first-fit algorithm for the number of pages requested in the pid's address space. A page table entry holding PG_RESERVED is in use even though it is not present.
  * \param pid The pid you are interested in.
  * \param numberOfPages The number of contiguous pages you are looking for.
  * \param perms The requested permissions of the new pages.
  */
 uint8_t *findBuffer(uint32_t pid, uint32_t numberOfPages, uint8_t perms);
 
-/** Frees a particular page in a pid's address space.
+/** Returns the page table entry that maps a virtual address in a pid's address space.
+ * \param pid The pid you are interested in.
+ * \param virtualAddress The virtual address you are interested in.
+ */
+uint32_t pageTableEntry(uint32_t pid, uint32_t virtualAddress);
+
+/** Points a page of a pid's address space at a frame that is already allocated, such as a shared frame, and flushes the old TLB entry.
+ * \param pid The pid you are interested in.
+ * \param virtualAddress The virtual address of the page.
+ * \param frameNumber The frame to map.
+ * \param perms The permissions of the page, such as PG_USER_PRESENT_RO.
+ */
+void mapPage(uint32_t pid, uint32_t virtualAddress, uint32_t frameNumber, uint8_t perms);
+
+/** Unmaps every shared frame in a pid's address space and drops its reference, so the frames are freed when no other process maps them. Private frames are left to freeAllFrames().
+ * \param pid The pid that is exiting.
+ */
+void releaseSharedPages(uint32_t pid);
+
+/** Gives a child the parent's address space without copying any memory. Every user page table is copied, every frame the parent owns becomes a shared frame, and writable pages turn read-only with PG_COPY_ON_WRITE set in both tables.
+ * \param parentPid The pid being forked.
+ * \param childPid The new pid, whose page tables are overwritten.
+ */
+void duplicatePageTables(uint32_t parentPid, uint32_t childPid);
+
+/** Reserves a page of a pid's address space without mapping it. The page table entry is not present but holds PG_RESERVED and the permissions, so findBuffer() passes over it and loadReservedPage() maps a zeroed frame on first touch.
+ * \param pid The pid you are interested in.
+ * \param virtualAddress The virtual address of the page.
+ * \param perms The permissions the page gets when it is mapped, such as PG_USER_PRESENT_RW.
+ */
+void reservePage(uint32_t pid, uint32_t virtualAddress, uint8_t perms);
+
+/** Marks a mapped page with PG_MMAP_PAGE, so sysMunmap() knows sysMmap() handed it out. The mark stays when the page is remapped with mapPage() and goes when it is freed.
+ * \param pid The pid you are interested in.
+ * \param virtualAddress The virtual address of the page.
+ */
+void markMmapPage(uint32_t pid, uint32_t virtualAddress);
+
+/** Unmaps a range of pages in the loaded address space of a pid. Mapped pages are freed through freePage(), and reserved pages lose their reservation.
+ * \param pid The pid you are interested in. Its page directory must be the one in CR3.
+ * \param virtualAddress The first page of the range.
+ * \param numberOfPages The number of pages in the range.
+ */
+void releasePages(uint32_t pid, uint32_t virtualAddress, uint32_t numberOfPages);
+
+/** Frees a particular page in a pid's address space, and flushes its TLB entry if the pid's page directory is loaded.
  * \param pid The pid you are interested in.
  * \param pageToFree The virtual address of the page you want to free.
  */
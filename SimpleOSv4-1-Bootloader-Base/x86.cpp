@@ -20,6 +20,34 @@ uint8_t inputIOPort(uint16_t port)
     return data;
 }
 
+void outputIOPortWord(uint16_t port, uint16_t data)
+{
+    asm volatile("outw %0,%1" : : "a" (data), "d" (port));
+}
+
+uint16_t inputIOPortWord(uint16_t port)
+{
+    uint16_t data;
+    
+    asm volatile("inw %1,%0" : "=a" (data) : "d" (port));
+    
+    return data;
+}
+
+void outputIOPortLong(uint16_t port, uint32_t data)
+{
+    asm volatile("outl %0,%1" : : "a" (data), "d" (port));
+}
+
+uint32_t inputIOPortLong(uint16_t port)
+{
+    uint32_t data;
+    
+    asm volatile("inl %1,%0" : "=a" (data) : "d" (port));
+    
+    return data;
+}
+
 void ioPortWordToMem(uint16_t port, uint8_t *destinationMemory, uint32_t numberOfWords)
 {
     asm volatile ("mov %0, %%dx\n\t" : : "r" (port));
@@ -38,13 +66,108 @@ void memToIoPortWord(uint16_t destinationPort, uint8_t *sourceMemory, uint32_t n
     asm volatile ("rep outsw");
 }
 
-void memoryCopy(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfWords)
+void memoryCopy(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfBytes)
 {
-    asm volatile ("movl %0, %%esi\n\t" : : "r" (startingMemory));
-    asm volatile ("movl %0, %%edi\n\t" : : "r" (destinationMemory));
-    asm volatile ("cld\n\t");
-    asm volatile ("movl %0, %%ecx\n\t" : : "r" (numberOfWords));                  
-    asm volatile ("rep movsw\n\t");
+    uint32_t numberOfDwords = numberOfBytes / 4;
+    uint32_t remainingBytes = numberOfBytes % 4;
+
+    asm volatile ("cld\n\t"
+                  "rep movsl\n\t"
+                  "movl %3, %%ecx\n\t"
+                  "rep movsb\n\t"
+                  : "+S" (startingMemory), "+D" (destinationMemory), "+c" (numberOfDwords)
+                  : "r" (remainingBytes)
+                  : "memory");
+}
+
+void memoryCopyBackward(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfBytes)
+{
+    uint32_t numberOfDwords = numberOfBytes / 4;
+    uint32_t remainingBytes = numberOfBytes % 4;
+    uint8_t *lastSourceByte = startingMemory + numberOfBytes - 1;
+    uint8_t *lastDestinationByte = destinationMemory + numberOfBytes - 1;
+
+    // The bytes past the last whole dword go first, then esi and edi step back to the start of the last dword
+    asm volatile ("std\n\t"
+                  "rep movsb\n\t"
+                  "subl $3, %%esi\n\t"
+                  "subl $3, %%edi\n\t"
+                  "movl %3, %%ecx\n\t"
+                  "rep movsl\n\t"
+                  "cld\n\t"
+                  : "+S" (lastSourceByte), "+D" (lastDestinationByte), "+c" (remainingBytes)
+                  : "r" (numberOfDwords)
+                  : "memory");
+}
+
+void memoryFill(uint8_t *destinationMemory, uint32_t pattern, uint32_t numberOfBytes)
+{
+    uint32_t numberOfDwords = numberOfBytes / 4;
+    uint32_t remainingBytes = numberOfBytes % 4;
+
+    asm volatile ("cld\n\t"
+                  "rep stosl\n\t"
+                  "movl %3, %%ecx\n\t"
+                  "rep stosb\n\t"
+                  : "+D" (destinationMemory), "+c" (numberOfDwords)
+                  : "a" (pattern), "r" (remainingBytes)
+                  : "memory");
+}
+
+void memoryFillStreaming(uint8_t *destinationMemory, uint32_t pattern, uint32_t numberOfBytes)
+{
+    uint32_t numberOfBlocks = numberOfBytes / 16;
+
+    if (numberOfBlocks == 0)
+    {
+        return;
+    }
+
+    // movnti stores are weakly ordered, so sfence makes them visible before anything that follows
+    asm volatile ("1:\n\t"
+                  "movnti %2, (%0)\n\t"
+                  "movnti %2, 4(%0)\n\t"
+                  "movnti %2, 8(%0)\n\t"
+                  "movnti %2, 12(%0)\n\t"
+                  "addl $16, %0\n\t"
+                  "decl %1\n\t"
+                  "jnz 1b\n\t"
+                  "sfence\n\t"
+                  : "+r" (destinationMemory), "+r" (numberOfBlocks)
+                  : "r" (pattern)
+                  : "memory", "cc");
+}
+
+uint32_t cpuidFeatures()
+{
+    uint32_t leaf = 1;
+    uint32_t subleaf = 0;
+    uint32_t brandIndex;
+    uint32_t features;
+
+    asm volatile ("cpuid\n\t" : "+a" (leaf), "=b" (brandIndex), "+c" (subleaf), "=d" (features) : );
+
+    return features;
+}
+
+uint32_t readTimeStampCounter()
+{
+    uint32_t cycles;
+
+    asm volatile ("rdtsc\n\t" : "=a" (cycles) : : "edx");
+
+    return cycles;
+}
+
+void setInterruptHandler(uint8_t *idtMemory, uint32_t vector, void (*handler)())
+{
+    idtMemory = idtMemory + (vector * 8);
+
+    *(uint16_t *)idtMemory = ((uint32_t)(handler) & 0xffff);
+    *(uint16_t *)(idtMemory + 2) = (uint8_t)0x8; //selector
+    *(idtMemory + 4) = (uint8_t)0x00; //reserved
+    *(idtMemory + 5) = (uint8_t)0xee; //attributes
+    *(uint16_t *)(idtMemory + 6) = ((uint32_t)(handler) >> 16);
 }
 
 void loadTaskRegister(uint16_t taskRegisterValue)
@@ -53,6 +176,63 @@ void loadTaskRegister(uint16_t taskRegisterValue)
     asm volatile ("ltr %ax\n\t");
 }
 
+uint32_t readEFLAGS()
+{
+    uint32_t eflagsValue;
+
+    asm volatile ("pushf\n\t"
+                  "popl %0\n\t" : "=r" (eflagsValue) : );
+
+    return eflagsValue;
+}
+
+uint32_t readCR0()
+{
+    uint32_t cr0Value;
+
+    asm volatile ("movl %%cr0, %0\n\t" : "=r" (cr0Value) : );
+
+    return cr0Value;
+}
+
+void writeCR0(uint32_t cr0Value)
+{
+    asm volatile ("movl %0, %%cr0\n\t" : : "r" (cr0Value) : "memory");
+}
+
+uint32_t readCR3()
+{
+    uint32_t cr3Value;
+
+    asm volatile ("movl %%cr3, %0\n\t" : "=r" (cr3Value) : );
+
+    return cr3Value;
+}
+
+void writeCR3(uint32_t cr3Value)
+{
+    asm volatile ("movl %0, %%cr3\n\t" : : "r" (cr3Value) : "memory");
+}
+
+uint32_t readCR4()
+{
+    uint32_t cr4Value;
+
+    asm volatile ("movl %%cr4, %0\n\t" : "=r" (cr4Value) : );
+
+    return cr4Value;
+}
+
+void writeCR4(uint32_t cr4Value)
+{
+    asm volatile ("movl %0, %%cr4\n\t" : : "r" (cr4Value) : "memory");
+}
+
+void invalidatePage(uint32_t virtualAddress)
+{
+    asm volatile ("invlpg (%0)\n\t" : : "r" (virtualAddress) : "memory");
+}
+
 void storeValueAtMemLoc(uint8_t *destinationMemory, uint32_t value)
 {
     asm volatile ("movl %0, %%ebx\n\t" : : "r" (destinationMemory));
@@ -80,6 +260,8 @@ uint32_t sysCall(uint32_t sysCallNumber, uint32_t arg1, uint32_t currentPid)
     asm volatile ("movl %0, %%eax\n\t" : : "r" (sysCallNumber)); 
     asm volatile ("pusha\n\t");
     asm volatile ("int $0x80\n\t");
+    // The kernel returns the result in eax, so it goes into the eax slot popa restores from
+    asm volatile ("movl %eax, 28(%esp)\n\t");
     asm volatile ("popa\n\t"); 
     asm volatile ("movl %%eax, %0\n\t" : "=r" (returnValue) : );
 
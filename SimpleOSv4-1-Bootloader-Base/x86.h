@@ -14,6 +14,28 @@ void outputIOPort(uint16_t port, uint8_t data);
  */
 uint8_t inputIOPort(uint16_t port);
 
+/** Send a 16-bit word to an I/O port
+ * \param port The port number.
+ * \param data The word you want to send.
+ */
+void outputIOPortWord(uint16_t port, uint16_t data);
+
+/** Reads a 16-bit word from an I/O port. Returns the word.
+ * \param port The port number you want to read.
+ */
+uint16_t inputIOPortWord(uint16_t port);
+
+/** Send a 32-bit value to an I/O port
+ * \param port The port number.
+ * \param data The 32-bit value you want to send.
+ */
+void outputIOPortLong(uint16_t port, uint32_t data);
+
+/** Reads a 32-bit value from an I/O port. Returns the value.
+ * \param port The port number you want to read.
+ */
+uint32_t inputIOPortLong(uint16_t port);
+
 /** Allows you to read and transfer multiple words from a port to a memory location.
  * \param port The port number to read.
  * \param destinationMemory The memory address you want to store the words from the I/O port.
@@ -28,12 +50,71 @@ void ioPortWordToMem(uint16_t port, uint8_t *destinationMemory, uint32_t numberO
  */
 void memToIoPortWord(uint16_t destinationPort, uint8_t *sourceMemory, uint32_t numberOfWords);
 
-/** Copies memory from one location to another, in 16-bit words.
- * \param startingMemory The pointer to the beginning pouint32_t to copy.
- * \param destinationMemory The destination pointer that words will be copied to.
- * \param numberOfWords The number of 16-bit words to copy from source to destination.
+/** Copies memory from one location to another front to back, in dwords with rep movsl and then the remaining bytes. Overlapping ranges are only safe when the destination is below the source.
+ * \param startingMemory The pointer to the beginning point to copy.
+ * \param destinationMemory The destination pointer that bytes will be copied to.
+ * \param numberOfBytes The number of bytes to copy from source to destination.
+ */
+void memoryCopy(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfBytes);
+
+/** Copies memory from one location to another back to front with the direction flag set, for overlapping ranges where the destination is above the source. Interrupts stay on, so every interrupt entry path clears the direction flag.
+ * \param startingMemory The pointer to the beginning point to copy.
+ * \param destinationMemory The destination pointer that bytes will be copied to.
+ * \param numberOfBytes The number of bytes to copy from source to destination.
+ */
+void memoryCopyBackward(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfBytes);
+
+/** Fills memory in dwords with rep stosl, and the bytes past the last whole dword with rep stosb.
+ * \param destinationMemory The pointer to start the fill.
+ * \param pattern The dword to store. The remaining bytes take its low byte, so pass one byte repeated four times.
+ * \param numberOfBytes The number of bytes to fill.
+ */
+void memoryFill(uint8_t *destinationMemory, uint32_t pattern, uint32_t numberOfBytes);
+
+/** Fills memory with movnti non-temporal stores, which go around the cache instead of evicting what is in it, and fences them with sfence. Needs SSE2 (CPUID_SSE2), but no XMM registers, so there is no FPU state to save.
+ * \param destinationMemory The pointer to start the fill, 16 byte aligned.
+ * \param pattern The dword to store.
+ * \param numberOfBytes The number of bytes to fill, a multiple of 16.
  */
-void memoryCopy(uint8_t *startingMemory, uint8_t *destinationMemory, uint32_t numberOfWords);
+void memoryFillStreaming(uint8_t *destinationMemory, uint32_t pattern, uint32_t numberOfBytes);
+
+/** Returns the feature flags CPUID leaf 1 reports in edx, such as CPUID_SSE2. */
+uint32_t cpuidFeatures();
+
+/** Returns the low 32 bits of the time stamp counter, which counts CPU cycles. */
+uint32_t readTimeStampCounter();
+
+/** Reads and returns the EFLAGS register. */
+uint32_t readEFLAGS();
+
+/** Reads and returns the CR0 control register. */
+uint32_t readCR0();
+
+/** Writes the CR0 control register, such as CR0_PAGING.
+ * \param cr0Value The new value.
+ */
+void writeCR0(uint32_t cr0Value);
+
+/** Reads and returns the CR3 control register, which holds the physical address of the current page directory. */
+uint32_t readCR3();
+
+/** Writes the CR3 control register, which loads a page directory and flushes every TLB entry not marked PAGE_GLOBAL.
+ * \param cr3Value The physical address of the page directory.
+ */
+void writeCR3(uint32_t cr3Value);
+
+/** Reads and returns the CR4 control register. */
+uint32_t readCR4();
+
+/** Writes the CR4 control register, such as CR4_PAGE_SIZE_EXTENSION.
+ * \param cr4Value The new value.
+ */
+void writeCR4(uint32_t cr4Value);
+
+/** Drops the TLB entry for one page after its page table entry changes.
+ * \param virtualAddress Any address inside the page.
+ */
+void invalidatePage(uint32_t virtualAddress);
 
 /** Stores a 32-bit value to a memory location.
  * \param destinationMemory The target destination.
@@ -46,13 +127,20 @@ void storeValueAtMemLoc(uint8_t *destinationMemory, uint32_t value);
  */
 uint32_t readValueFromMemLoc(uint8_t *sourceMemory);
 
-/** The primary sysCall function. This is used by LibC function to trigger system calls from ring 3.
+/** The primary sysCall function. This is used by LibC function to trigger system calls from ring 3. Returns the result the kernel leaves in eax, or 0 for system calls that return nothing.
  * \param sysCallNumber The system call number.
  * \param arg1 An argument to pass to the kernel, if necessary. This may be an blank, an integer, a memory location, or a pointer to a certain type of structure, depending on the system call.
  * \param currentPid The pid requesting the system call.
  */
 uint32_t sysCall(uint32_t sysCallNumber, uint32_t arg1, uint32_t currentPid);
 
+/** Points a single interrupt descriptor table entry at a handler. Used for device interrupts that are set up after loadIDT().
+ * \param idtMemory The starting location of the interrupt descriptor table.
+ * \param vector The interrupt vector to set.
+ * \param handler The interrupt handler function.
+ */
+void setInterruptHandler(uint8_t *idtMemory, uint32_t vector, void (*handler)());
+
 /** Loads the Intel task register. This is used during kernel initialization just prior to the jump to shell in ring 3.
  * \param taskRegisterValue Used to load the tss_kernel_descriptor from bootloader-stage 1.
  */
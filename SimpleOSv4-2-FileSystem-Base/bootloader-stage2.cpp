@@ -7,14 +7,26 @@
 #include "constants.h"
 #include "exceptions.h"
 #include "vm.h"
+#include "block-device.h"
+#include "x86.h"
 
 
 void main()
 {
+    // Recorded before the first fillMemory(), which picks its store instructions from it
+    storeValueAtMemLoc(CPU_FEATURES_LOC, cpuidFeatures());
+
     // Clear all upper memory areas for warm reboot
     fillMemory((uint8_t *)0x100000, 0x0, 0x29E000); 
     fillMemory((uint8_t *)KERNEL_SEMAPHORE_TABLE, 0x0, PAGE_SIZE); 
     fillMemory((uint8_t *)OPEN_FILE_TABLE, 0x0, PAGE_SIZE);
+    fillMemory((uint8_t *)KERNEL_CONFIGURATION, 0x0, PAGE_SIZE);
+
+    // Use a virtio-blk or AHCI disk if QEMU attached one, otherwise stay on the primary ATA drive
+    if (!selectBlockDevice(BLOCK_DEVICE_VIRTIO))
+    {
+        selectBlockDevice(BLOCK_DEVICE_AHCI);
+    }
 
     // Load the superblock and block group descriptor table
     fillMemory(SUPERBLOCK_LOC, 0x0, PAGE_SIZE);
@@ -31,14 +43,18 @@ void main()
     {
         panic((uint8_t *)"Bootloader-stage2.cpp -> Cannot find kernel in root directory");
     }
-    loadFileFromInodeStruct(KERNEL_TEMP_INODE_LOC, KERNEL_TEMP_FILE_LOC);
-    loadElfFile(KERNEL_TEMP_FILE_LOC);
 
-    printString(COLOR_WHITE, cursorRow++, 0, (uint8_t *)"Kernel binary loaded...jumping to kernel main...");  
+    // Paging is off, so the kernel segments are streamed straight to their physical addresses
+    uint32_t kernelEntryPoint = loadElfSegments(KERNEL_TEMP_INODE_LOC, 0);
 
-    struct elfHeader *ELFHeader = (struct elfHeader*)KERNEL_TEMP_FILE_LOC;
+    if (kernelEntryPoint == 0)
+    {
+        panic((uint8_t *)"Bootloader-stage2.cpp -> Kernel is not an ELF file");
+    }
+
+    printString(COLOR_WHITE, cursorRow++, 0, (uint8_t *)"Kernel binary loaded...jumping to kernel main...");  
 
-    (*(void(*)())ELFHeader->e_entry)(); 
+    (*(void(*)())kernelEntryPoint)(); 
 
     panic((uint8_t *)"bootloader-stage2.cpp -> Error launching kernel binary");
 
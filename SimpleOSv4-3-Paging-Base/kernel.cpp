@@ -16,6 +16,7 @@
 #include "exceptions.h"
 #include "vmmonitor.h"
 #include "file.h"
+#include "block-device.h"
 
 uint32_t currentPid = 0;
 uint32_t cursorRow = 0;
@@ -25,6 +26,9 @@ uint8_t *cursorMemory = (uint8_t *)SHELL_CURSOR_POS;
 
 void kInit()
 {
+    // Stored again in case the loader did not, since fillMemory() below reads it
+    storeValueAtMemLoc(CPU_FEATURES_LOC, cpuidFeatures());
+
     disableCursor();
 
     createSemaphore(KERNEL_OWNED, (uint8_t *)OPEN_FILE_TABLE, 1, 1);
@@ -35,30 +39,66 @@ void kInit()
 
     printString(COLOR_LIGHT_BLUE, cursorRow++, 0, (uint8_t *)"Starting Kernel Initialization:");
 
-    // zero out process table memory, kernel heap and user heap
+    // zero out process table memory and user heap
     fillMemory((uint8_t *)(PROCESS_TABLE_LOC) , (uint8_t)0x0, PAGE_SIZE);
-    fillMemory((uint8_t *)(KERNEL_HEAP) , (uint8_t)0x0, PAGE_SIZE);
     fillMemory((uint8_t *)(USER_HEAP) , (uint8_t)0x0, PAGE_SIZE);
+    fillMemory((uint8_t *)(PAGEFRAME_MAP_BASE), (uint8_t)0x0, PAGEFRAME_MAP_SIZE);
+    fillMemory((uint8_t *)(PAGEFRAME_REFCOUNT_BASE), (uint8_t)0x0, PAGEFRAME_MAP_SIZE);
+    fillMemory((uint8_t *)(SHARED_PAGE_TABLE), (uint8_t)0x0, PAGE_SIZE);
+    fillMemory((uint8_t *)(EXEC_CACHE), (uint8_t)0x0, PAGE_SIZE);
     
     startApplicationProcessor();
 
+    // Stage 2 already picked the disk we booted from. BOOT_BLOCK_DEVICE can move us to another one, like the RAM disk.
+    struct kernelConfiguration *KernelConfiguration = (struct kernelConfiguration*)KERNEL_CONFIGURATION;
+
+    if (BOOT_BLOCK_DEVICE != BLOCK_DEVICE_KEEP_BOOT_DISK && !selectBlockDevice(BOOT_BLOCK_DEVICE))
+    {
+        printString(COLOR_RED, cursorRow++, 0, (uint8_t *)"   -> Requested Block Device Not Available");
+    }
+    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Block Device Selected -> ID: ");
+    printHexNumber(COLOR_GREEN, (cursorRow - 1), 35, KernelConfiguration->blockDevice);
+
     struct blockGroupDescriptor *BlockGroupDescriptor = (blockGroupDescriptor*)(BLOCK_GROUP_DESCRIPTOR_TABLE);
     readBlock(BlockGroupDescriptor->bgd_block_address_of_block_usage, (uint8_t *)EXT2_BLOCK_USAGE_MAP);
     readBlock(BlockGroupDescriptor->bgd_block_address_of_inode_usage, (uint8_t *)EXT2_INODE_USAGE_MAP);
 
+    // Page directories and task structures come from the frame allocator, so it is ready before the first task
+    createPageFrameMap((uint8_t *)PAGEFRAME_MAP_BASE, physicalFrames());
+    initializeFrameAllocator((uint8_t *)PAGEFRAME_MAP_BASE);
+    initializeKernelHeap();
     currentPid = initializeTask(currentPid, PROC_SLEEPING, STACK_START_LOC, (uint8_t *)"shell2", 100);
-    createPageFrameMap((uint8_t *)PAGEFRAME_MAP_BASE, 0x400);
 
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Initialized Task Struct -> PID: ");
     printHexNumber(COLOR_GREEN, (cursorRow - 1), 38, currentPid);
     
     initializePageTables(currentPid);
+    markKernelPagesGlobal(currentPid);
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Initialized Page Directory and Page Table -> PID: ");
     printHexNumber(COLOR_GREEN, (cursorRow - 1), 56, currentPid);
+
+    // The kernel windows above the first 4 MB, such as the frame metadata, are 4 MB pages. Asked of the CPU itself, since paging cannot work without it.
+    uint32_t cpuFeatures = cpuidFeatures();
+
+    if (!(cpuFeatures & CPUID_PSE))
+    {
+        panic((uint8_t *)"kernel.cpp -> CPU has no 4 MB pages");
+    }
+
+    writeCR4(readCR4() | CR4_PAGE_SIZE_EXTENSION);
+
+    // Without global pages every switch also flushes the kernel translations, which is slower but still correct
+    if (cpuFeatures & CPUID_PGE)
+    {
+        writeCR4(readCR4() | CR4_PAGE_GLOBAL_ENABLE);
+    }
     
     contextSwitch(currentPid); 
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Paging Enabled");
 
+    refillZeroedFrames(ZEROED_POOL_SIZE);
+    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Zeroed Frame Pool Filled");
+
     remapPIC(INTERRUPT_MASK_ALL_ENABLED, INTERRUPT_MASK_ALL_ENABLED);
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Programmable Interrupt Controller (PIC) Remapping Complete");
 
@@ -67,6 +107,7 @@ void kInit()
     fillMemory((uint8_t *)(INTERRUPT_DESC_TABLE + PAGE_SIZE), (uint8_t)0x0, PAGE_SIZE);
     loadIDT((uint8_t *)INTERRUPT_DESC_TABLE);
     loadIDTR((uint8_t *)INTERRUPT_DESC_TABLE, (uint8_t *)INTERRUPT_DESC_TABLE_REG);
+    blockDeviceInstallInterruptHandler((uint8_t *)INTERRUPT_DESC_TABLE);
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Interrupt Descriptor Table (IDT) Setup Complete");
 
     printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Kernel Initialization Complete");
@@ -108,7 +149,28 @@ void logonPrompt()
     }
 }
 
-void loadShell()
+void loadRuntimeLibrary()
+{
+    if (!fsFindFile((uint8_t *)"libsimpleos", KERNEL_TEMP_INODE_LOC))
+    {
+        panic((uint8_t *)"kernel.cpp -> Cannot find libsimpleos in root directory");
+    }
+
+    struct execCacheEntry *ExecCacheEntry = execCacheInsert((uint8_t *)"libsimpleos", KERNEL_TEMP_INODE_LOC, returnInodeofFileName((uint8_t *)"libsimpleos"));
+
+    if (ExecCacheEntry == 0)
+    {
+        panic((uint8_t *)"kernel.cpp -> libsimpleos is not an ELF file");
+    }
+
+    // Every process maps the library, so its pages stay in the shared page table for good
+    ExecCacheEntry->pinned = true;
+    execMappingFromCache((struct execMapping*)RUNTIME_LIBRARY_MAPPING, ExecCacheEntry);
+
+    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Runtime library shared with every process");
+}
+
+uint32_t loadShell()
 {
     if (!requestSpecificPage(currentPid, (uint8_t *)(STACK_PAGE - PAGE_SIZE), PG_USER_PRESENT_RW))
     {
@@ -124,16 +186,14 @@ void loadShell()
         panic((uint8_t *)"kernel.cpp -> STACK_PAGE page request");
     }
 
-    if (!requestSpecificPage(currentPid, (uint8_t *)(USER_HEAP), PG_USER_PRESENT_RW))
+    // The heap state lives in this page, and malloc() only trusts it when it starts zeroed
+    if (!requestZeroedPage(currentPid, (uint8_t *)(USER_HEAP), PG_USER_PRESENT_RW))
     {
         clearScreen();
         printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
         panic((uint8_t *)"kernel.cpp -> USER_HEAP page request");
     }
 
-    cursorRow++;
-    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Loading binary to Temp File Storage");
-
     if (!requestSpecificPage(currentPid, USER_TEMP_INODE_LOC, PG_USER_PRESENT_RW))
     {
         clearScreen();
@@ -146,51 +206,23 @@ void loadShell()
         panic((uint8_t *)"kernel.cpp -> Cannot find shell in root directory");
     }
 
-    struct inode *Inode = (struct inode*)USER_TEMP_INODE_LOC;
-    uint32_t pagesNeedForTmpBinary = ceiling(Inode->i_size, PAGE_SIZE);
+    cursorRow++;
+    struct execCacheEntry *ExecCacheEntry = execCacheInsert((uint8_t *)"shell2", USER_TEMP_INODE_LOC, returnInodeofFileName((uint8_t *)"shell2"));
 
-    //request pages for temporary file storage to load raw ELF file
-    for (uint32_t tempFileLoc = 0; tempFileLoc < (pagesNeedForTmpBinary * PAGE_SIZE); tempFileLoc = tempFileLoc + PAGE_SIZE)
+    if (ExecCacheEntry == 0)
     {
-        if (!requestSpecificPage(currentPid, (USER_TEMP_FILE_LOC + tempFileLoc), PG_USER_PRESENT_RW))
-        {
-            clearScreen();
-            printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
-            panic((uint8_t *)"kernel.cpp -> USER_TEMP_FILE_LOC page request");
-        }
+        panic((uint8_t *)"kernel.cpp -> shell is not an ELF file");
     }
-    
-    loadFileFromInodeStruct(USER_TEMP_INODE_LOC, USER_TEMP_FILE_LOC); 
-    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Raw binary loaded to 0x31000");
-    
-    struct elfHeader *ELFHeader = (struct elfHeader*)USER_TEMP_FILE_LOC;
-    struct pHeader *ProgHeaderTextSegment, *ProgHeaderDataSegment;
-    ProgHeaderTextSegment = (struct pHeader*)((uint8_t * )(int)ELFHeader + ELFHeader->e_phoff + ELF_PROGRAM_HEADER_SIZE);
-    ProgHeaderDataSegment = (struct pHeader*)((uint8_t * )(int)ELFHeader + (ELFHeader->e_phoff + (ELF_PROGRAM_HEADER_SIZE * 2)));
 
-    uint32_t totalTextSegmentPagesNeeded = ceiling(ProgHeaderTextSegment->p_memsz, PAGE_SIZE);
-    uint32_t totalDataSegmentPagesNeeded = ceiling(ProgHeaderDataSegment->p_memsz, PAGE_SIZE);
+    uint32_t entryPoint = mapElfSegments(ExecCacheEntry, currentPid);
 
-    // request enough pages at the required virtual address to load and run binary
-    for (uint32_t tempFileLoc = 0; tempFileLoc < ((totalTextSegmentPagesNeeded + totalDataSegmentPagesNeeded) * PAGE_SIZE); tempFileLoc = tempFileLoc + PAGE_SIZE)
-    {
-        if (!requestSpecificPage(currentPid, (uint8_t *)(ProgHeaderTextSegment->p_vaddr + tempFileLoc), PG_USER_PRESENT_RW))
-        {
-            clearScreen();
-            printString(COLOR_RED, 2, 2, (uint8_t *)"Requested page is not available");
-            panic((uint8_t *)"kernel.cpp -> USERPROG TEXT and DATA VADDR page requests");
-        }
+    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Binary segments mapped, pages load on first touch");
 
-    }
-    
-    loadElfFile(USER_TEMP_FILE_LOC);
-    printString(COLOR_GREEN, cursorRow++, 0, (uint8_t *)"   -> Binary loaded from 0x31000 to desired location");
+    return entryPoint;
 }
 
-void launchShell()
+void launchShell(uint32_t entryPoint)
 {
-    struct elfHeader *ELFHeaderLaunch = (struct elfHeader*)USER_TEMP_FILE_LOC;
-
     // RUNNING_PID_LOC will store some information for the currently running process, such as
     // what its PID is
     storeValueAtMemLoc(RUNNING_PID_LOC, currentPid);
@@ -201,7 +233,7 @@ void launchShell()
     setSystemTimer(SYSTEM_INTERRUPTS_PER_SECOND);
 
     loadTaskRegister(0x28);
-    switchToRing3LaunchBinary((uint8_t *)ELFHeaderLaunch->e_entry);
+    switchToRing3LaunchBinary((uint8_t *)entryPoint);
 }
 
 
@@ -211,9 +243,9 @@ void main()
 
     // Disabling logon prompt to save time while iterating through code.
     // logonPrompt();
-    
-    loadShell();
-    launchShell();
+
+    loadRuntimeLibrary();
+    launchShell(loadShell());
 
     panic((uint8_t *)"kernel.cpp -> Unable to launch shell, returned to kernel.cpp");
 }
\ No newline at end of file